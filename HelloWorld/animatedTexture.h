@@ -0,0 +1,184 @@
+#ifndef ANIMATEDTEXTURE_H
+#define ANIMATEDTEXTURE_H
+
+#include <glad/glad.h>
+
+#include "stb_image.h"
+
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <vector>
+
+/*
+ Plays an animated GIF from a GL_TEXTURE_2D_ARRAY with one layer per frame. Loading only
+ reads the file and allocates the array; the frames are decoded one at a time as playback
+ reaches them and go straight into their layer, so the decoder only ever holds the few
+ frames it composites with instead of the whole animation. Once every frame is on the GPU
+ the file is dropped as well, and looping costs nothing but picking a layer.
+
+ Frames have to be decoded in order, since every frame is drawn on top of the ones before.
+ If a long frame step skips some of them they are still decoded on the way, and uploadAll()
+ can be used to get all of the decoding out of the way at load time instead.
+ */
+class AnimatedTexture {
+
+public:
+    // Browsers show frames with a delay below MIN_DELAY for 100 ms instead, and GIFs are made to look right in browsers
+    static const int MIN_DELAY = 20;
+    static const int DEFAULT_DELAY = 100;
+
+    AnimatedTexture() : texture(0), frames(NULL), width(0), height(0), uploaded(0), current(0), elapsed(0) {
+    }
+
+    ~AnimatedTexture() {
+        stbi_gif_frames_close(frames);
+        if (texture) {
+            glDeleteTextures(1, &texture);
+        }
+    }
+
+    AnimatedTexture(const AnimatedTexture&) = delete;
+    AnimatedTexture& operator=(const AnimatedTexture&) = delete;
+
+    // Opens the GIF and creates its array texture, returns false if the file can't be read as a GIF
+    bool load(const char *path, bool flipVertically) {
+        std::ifstream file(path, std::ios::binary);
+        contents.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        if (contents.empty()) {
+            std::cout << "ERROR::ANIMATEDTEXTURE::FAILED_TO_READ " << path << std::endl;
+            return false;
+        }
+
+        stbi_load_options options;
+        stbi_load_options_default(&options);
+        options.flip_vertically = flipVertically;
+        int frameCount = 0;
+        frames = stbi_gif_frames_open_with_options(&contents[0], (int) contents.size(), &width, &height, &frameCount,
+                                                   &options);
+        if (!frames || frameCount == 0) {
+            std::cout << "ERROR::ANIMATEDTEXTURE::NOT_A_GIF " << path << std::endl;
+            return false;
+        }
+
+        int maxLayers;
+        glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+        if (frameCount > maxLayers) {
+            std::cout << "ERROR::ANIMATEDTEXTURE::TOO_MANY_FRAMES " << path << " plays its first " << maxLayers
+                      << " frames only" << std::endl;
+            frameCount = maxLayers;
+        }
+        const int *frameDelays = stbi_gif_frames_delays(frames);
+        delays.assign(frameDelays, frameDelays + frameCount);
+
+        // Every frame covers the whole image, so there's no point in keeping mipmaps up to date for them
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, 0);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, width, height, frameCount, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        // The first frame has to be there before anything samples the texture
+        uploadUpTo(0);
+        return uploaded > 0;
+    }
+
+    // Decodes and uploads every frame that isn't on the GPU yet
+    void uploadAll() {
+        uploadUpTo(frameCount() - 1);
+    }
+
+    // Advances playback by the time since the last update and returns the layer to sample
+    int update(float deltaSeconds) {
+        if (delays.empty()) {
+            return 0;
+        }
+        elapsed += (int) (deltaSeconds * 1000.0f + 0.5f);
+
+        // Skipping whole loops first, so a long pause doesn't walk through every frame
+        int total = duration();
+        if (uploaded == frameCount() && elapsed >= total) {
+            elapsed %= total;
+        }
+        while (elapsed >= delay(current)) {
+            elapsed -= delay(current);
+            current = (current + 1) % frameCount();
+            uploadUpTo(current);
+        }
+        return current;
+    }
+
+    // The layer of the frame that is showing
+    int layer() const {
+        return current;
+    }
+
+    unsigned int arrayTexture() const {
+        return texture;
+    }
+
+    int frameCount() const {
+        return (int) delays.size();
+    }
+
+    // How long each frame shows for, in milliseconds as stored in the file
+    const std::vector<int>& frameDelays() const {
+        return delays;
+    }
+
+    // The length of one loop of the animation in milliseconds, as it's played
+    int duration() const {
+        int total = 0;
+        for (int i = 0; i < frameCount(); i++) {
+            total += delay(i);
+        }
+        return total;
+    }
+
+private:
+    unsigned int texture;
+    stbi_gif_frames *frames;
+    std::vector<unsigned char> contents;    // The file, which the decoder reads from until every frame is uploaded
+    std::vector<int> delays;
+    int width, height;
+    int uploaded;
+    int current;
+    int elapsed;                            // Milliseconds the current frame has been showing for
+
+    int delay(int frame) const {
+        return delays[frame] < MIN_DELAY ? DEFAULT_DELAY : delays[frame];
+    }
+
+    void uploadUpTo(int frame) {
+        if (frame < uploaded) {
+            return;
+        }
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        while (uploaded <= frame) {
+            unsigned char *pixels = stbi_gif_frames_next(frames, NULL, 4);
+            if (!pixels) {
+                // The rest of the file is corrupt, so the animation ends with the last frame that could be decoded
+                std::cout << "ERROR::ANIMATEDTEXTURE::CORRUPT_FRAME " << uploaded << std::endl;
+                delays.resize(uploaded);
+                current = current < uploaded ? current : 0;
+                break;
+            }
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, uploaded, width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+            uploaded++;
+        }
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        // Everything is on the GPU, the decoder and the file aren't needed anymore
+        if (uploaded >= frameCount()) {
+            stbi_gif_frames_close(frames);
+            frames = NULL;
+            std::vector<unsigned char>().swap(contents);
+        }
+    }
+};
+
+#endif
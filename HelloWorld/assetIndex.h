@@ -0,0 +1,145 @@
+#ifndef ASSETINDEX_H
+#define ASSETINDEX_H
+
+#include "stb_image.h"
+#include "jobSystem.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// What an image's header says about it, and what that means for the texture it becomes
+struct AssetInfo {
+    std::string path;
+    bool valid;                 // False if the file couldn't be opened or isn't an image stb_image can read
+    size_t fileSize;
+    stbi_header header;
+    size_t textureBytes;        // GPU memory of the whole mip chain, in the format TextureStreamer stores it in
+    size_t decodeCost;          // Roughly proportional to how long a full decode takes, see estimateCost()
+};
+
+/*
+ Reads the headers of many images at once, without decoding any of them, so the sizes of their
+ textures are known before a single pixel is loaded. That's enough to allocate texture storage
+ up front and to start the most expensive decodes first, so the long ones don't end up being
+ the last ones to finish.
+
+ Every file is memory mapped rather than read, so only the pages holding its header are ever
+ loaded from disk, and the files are spread over the job system's threads since most of the
+ time goes into waiting for those pages.
+ */
+class AssetIndex {
+
+public:
+    AssetIndex() {
+    }
+
+    // Reads the headers of all of the files, in parallel, and adds them to the index
+    void scan(JobSystem &jobSystem, const std::vector<std::string> &paths) {
+        size_t first = assets.size();
+        assets.resize(first + paths.size());
+        jobSystem.parallelFor(paths.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                readHeader(paths[i], assets[first + i]);
+            }
+        });
+        for (size_t i = first; i < assets.size(); i++) {
+            byPath[assets[i].path] = i;
+        }
+    }
+
+    // The entry of a file that was scanned, or NULL if it wasn't
+    const AssetInfo* find(const std::string &path) const {
+        std::map<std::string, size_t>::const_iterator found = byPath.find(path);
+        return found != byPath.end() ? &assets[found->second] : NULL;
+    }
+
+    const std::vector<AssetInfo>& entries() const {
+        return assets;
+    }
+
+    // The GPU memory all of the valid images will need once they are fully loaded
+    size_t totalTextureBytes() const {
+        size_t total = 0;
+        for (size_t i = 0; i < assets.size(); i++) {
+            total += assets[i].valid ? assets[i].textureBytes : 0;
+        }
+        return total;
+    }
+
+    // The valid images, most expensive to decode first, which is the order to hand them to the workers in
+    std::vector<const AssetInfo*> decodeOrder() const {
+        std::vector<const AssetInfo*> order;
+        for (size_t i = 0; i < assets.size(); i++) {
+            if (assets[i].valid) {
+                order.push_back(&assets[i]);
+            }
+        }
+        std::stable_sort(order.begin(), order.end(), [](const AssetInfo *a, const AssetInfo *b) {
+            return a->decodeCost > b->decodeCost;
+        });
+        return order;
+    }
+
+    // Fills in the entry of a single file, returns false if it isn't a readable image
+    static bool readHeader(const std::string &path, AssetInfo &info) {
+        info.path = path;
+        info.valid = false;
+        info.fileSize = 0;
+        info.textureBytes = 0;
+        info.decodeCost = 0;
+        memset(&info.header, 0, sizeof(info.header));
+
+        int file = open(path.c_str(), O_RDONLY);
+        if (file < 0) {
+            return false;
+        }
+        struct stat status;
+        if (fstat(file, &status) != 0 || status.st_size <= 0 || status.st_size > INT_MAX) {
+            close(file);
+            return false;
+        }
+        info.fileSize = (size_t) status.st_size;
+        void *mapped = mmap(NULL, info.fileSize, PROT_READ, MAP_PRIVATE, file, 0);
+        close(file);    // The mapping keeps the file open for as long as it needs
+        if (mapped == MAP_FAILED) {
+            return false;
+        }
+        info.valid = stbi_header_from_memory((const stbi_uc*) mapped, (int) info.fileSize, &info.header) != 0;
+        munmap(mapped, info.fileSize);
+        if (!info.valid) {
+            return false;
+        }
+
+        // Every image ends up as four channels, with a mip chain adding about a third on top
+        size_t texelSize = info.header.bits_per_channel == 8 ? 4 : 8;
+        info.textureBytes = (size_t) info.header.x * info.header.y * texelSize * 4 / 3;
+        info.decodeCost = estimateCost(info);
+        return true;
+    }
+
+private:
+    std::vector<AssetInfo> assets;
+    std::map<std::string, size_t> byPath;
+
+    /*
+     Decoding time mostly follows the size of the decoded image. Progressive JPEGs go over every
+     coefficient once per scan, which takes them about twice as long as baseline ones (see the
+     --benchmark-images numbers), and on top of that everything has to read its whole file.
+     */
+    static size_t estimateCost(const AssetInfo &info) {
+        size_t decodedBytes = (size_t) info.header.x * info.header.y * info.header.channels *
+                              (info.header.bits_per_channel / 8);
+        return decodedBytes * (info.header.is_progressive ? 2 : 1) + info.fileSize;
+    }
+};
+
+#endif
@@ -0,0 +1,598 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <glm/glm.hpp>
+
+#include "frustum.h"
+
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BVH_SSE2
+#include <emmintrin.h>
+#endif
+
+// An axis aligned bounding box
+struct AABB {
+    glm::vec3 minimum;
+    glm::vec3 maximum;
+
+    AABB() : minimum(FLT_MAX), maximum(-FLT_MAX) {
+    }
+
+    AABB(const glm::vec3 &minimum, const glm::vec3 &maximum) : minimum(minimum), maximum(maximum) {
+    }
+
+    void grow(const AABB &other) {
+        minimum = glm::min(minimum, other.minimum);
+        maximum = glm::max(maximum, other.maximum);
+    }
+
+    void grow(const glm::vec3 &point) {
+        minimum = glm::min(minimum, point);
+        maximum = glm::max(maximum, point);
+    }
+
+    glm::vec3 center() const {
+        return (minimum + maximum) * 0.5f;
+    }
+
+    float surfaceArea() const {
+        glm::vec3 size = maximum - minimum;
+        if (size.x < 0.0f) {
+            return 0.0f;
+        }
+        return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+    }
+
+    // The bounds of a box after it has been transformed by an affine matrix
+    static AABB transformed(const glm::mat4 &matrix, const AABB &box) {
+        glm::vec3 center = box.center();
+        glm::vec3 extent = (box.maximum - box.minimum) * 0.5f;
+        glm::vec3 worldCenter = glm::vec3(matrix * glm::vec4(center, 1.0f));
+        glm::vec3 worldExtent;
+        for (int row = 0; row < 3; row++) {
+            worldExtent[row] = std::fabs(matrix[0][row]) * extent.x + std::fabs(matrix[1][row]) * extent.y +
+                               std::fabs(matrix[2][row]) * extent.z;
+        }
+        return AABB(worldCenter - worldExtent, worldCenter + worldExtent);
+    }
+};
+
+/*
+ A bounding volume hierarchy over the bounding boxes of our objects, so that frustum
+ culling and picking don't have to look at every single object.
+
+ The tree is built with the surface area heuristic into a binary tree, which is then
+ collapsed into a tree where every node has up to four children. The nodes are stored
+ in one flat array with the bounds of all four children laid out component by
+ component, so a node can be tested against a plane or a ray with one SIMD instruction
+ per component. Parents always come before their children in the array.
+
+ When objects move, refit() recomputes the bounds bottom-up without changing the shape
+ of the tree, which is much cheaper than a rebuild as long as objects don't move far.
+ */
+class BVH {
+
+public:
+    // Builds the hierarchy from scratch. Primitive i is the object with bounding box boxes[i]
+    void build(const std::vector<AABB> &boxes) {
+        primitiveBoxes = boxes;
+        nodes.clear();
+        leaves.clear();
+        primitives.resize(boxes.size());
+        for (size_t i = 0; i < boxes.size(); i++) {
+            primitives[i] = (uint32_t) i;
+        }
+        if (boxes.empty()) {
+            return;
+        }
+
+        std::vector<BuildNode> buildNodes;
+        buildNodes.reserve(boxes.size() * 2);
+        buildBinary(buildNodes, 0, (uint32_t) boxes.size());
+
+        if (buildNodes[0].count > 0) {
+            // Everything fit into a single leaf, so the root just has one child
+            nodes.push_back(Node());
+            setLeafChild(0, 0, buildNodes[0]);
+        } else {
+            collapse(buildNodes, 0);
+        }
+    }
+
+    // Changes the bounding box of a primitive, the tree itself isn't updated until refit() is called
+    void setBox(uint32_t primitive, const AABB &box) {
+        primitiveBoxes[primitive] = box;
+    }
+
+    // Updates the bounds of every node after primitives have moved
+    void refit() {
+        for (size_t n = nodes.size(); n-- > 0;) {
+            Node &node = nodes[n];
+            for (int k = 0; k < 4; k++) {
+                AABB bounds;
+                if (node.child[k] == EMPTY) {
+                    continue;
+                } else if (node.child[k] < 0) {
+                    const Leaf &leaf = leaves[~node.child[k]];
+                    for (uint32_t i = leaf.first; i < leaf.first + leaf.count; i++) {
+                        bounds.grow(primitiveBoxes[primitives[i]]);
+                    }
+                } else {
+                    // Children come after their parents, so this one has already been refitted
+                    bounds = nodeBounds(nodes[node.child[k]]);
+                }
+                setChildBounds(node, k, bounds);
+            }
+        }
+    }
+
+    // Calls visit(primitive) for every primitive whose bounds intersect the frustum
+    template <typename Function>
+    void queryFrustum(const Frustum &frustum, const Function &visit) const {
+        if (nodes.empty()) {
+            return;
+        }
+        std::vector<int32_t> stack;
+        stack.reserve(64);
+        stack.push_back(0);
+
+        while (!stack.empty()) {
+            const Node &node = nodes[stack.back()];
+            stack.pop_back();
+            int insideMask;
+            int visibleMask = frustumMask(node, frustum, insideMask);
+
+            for (int k = 0; k < 4; k++) {
+                if (!(visibleMask & (1 << k))) {
+                    continue;
+                }
+                if (insideMask & (1 << k)) {
+                    // Completely inside the frustum, so nothing below needs to be tested
+                    visitAll(node.child[k], visit);
+                } else if (node.child[k] < 0) {
+                    const Leaf &leaf = leaves[~node.child[k]];
+                    for (uint32_t i = leaf.first; i < leaf.first + leaf.count; i++) {
+                        const AABB &box = primitiveBoxes[primitives[i]];
+                        if (frustum.intersectsBox(box.minimum, box.maximum)) {
+                            visit(primitives[i]);
+                        }
+                    }
+                } else {
+                    stack.push_back(node.child[k]);
+                }
+            }
+        }
+    }
+
+    /*
+     Finds the closest primitive whose bounds are hit by the ray, or -1 if there is none.
+     The distance along the ray to the hit is written into distance.
+     */
+    int raycast(const glm::vec3 &origin, const glm::vec3 &direction, float &distance) const {
+        int closest = -1;
+        distance = FLT_MAX;
+        if (nodes.empty()) {
+            return closest;
+        }
+
+        Ray ray;
+        ray.origin = origin;
+        ray.inverseDirection = glm::vec3(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+
+        std::vector<int32_t> stack;
+        stack.reserve(64);
+        stack.push_back(0);
+
+        while (!stack.empty()) {
+            const Node &node = nodes[stack.back()];
+            stack.pop_back();
+            float entry[4];
+            int hitMask = rayMask(node, ray, distance, entry);
+
+            for (int k = 0; k < 4; k++) {
+                // Skipping children that start further along the ray than the closest hit so far
+                if (!(hitMask & (1 << k)) || entry[k] >= distance) {
+                    continue;
+                }
+                if (node.child[k] < 0) {
+                    const Leaf &leaf = leaves[~node.child[k]];
+                    for (uint32_t i = leaf.first; i < leaf.first + leaf.count; i++) {
+                        float t;
+                        if (intersectRay(primitiveBoxes[primitives[i]], ray, t) && t < distance) {
+                            distance = t;
+                            closest = (int) primitives[i];
+                        }
+                    }
+                } else {
+                    stack.push_back(node.child[k]);
+                }
+            }
+        }
+        return closest;
+    }
+
+private:
+    // Leaves hold at most this many primitives
+    static const uint32_t MAX_LEAF_SIZE = 4;
+    // Number of buckets the centroids are binned into when looking for the best split
+    static const int SAH_BINS = 12;
+    // Marks an unused child slot, its bounds are inverted so that every test fails
+    static const int32_t EMPTY = INT32_MIN;
+
+    struct Node {
+        float minX[4], minY[4], minZ[4];
+        float maxX[4], maxY[4], maxZ[4];
+        int32_t child[4];       // Index of a child node, ~index of a leaf, or EMPTY
+
+        Node() {
+            for (int k = 0; k < 4; k++) {
+                minX[k] = minY[k] = minZ[k] = FLT_MAX;
+                maxX[k] = maxY[k] = maxZ[k] = -FLT_MAX;
+                child[k] = EMPTY;
+            }
+        }
+    };
+
+    // A range of the primitives array
+    struct Leaf {
+        uint32_t first;
+        uint32_t count;
+    };
+
+    // Node of the temporary binary tree, a leaf if count is non-zero
+    struct BuildNode {
+        AABB bounds;
+        uint32_t left, right;
+        uint32_t first, count;
+    };
+
+    struct Ray {
+        glm::vec3 origin;
+        glm::vec3 inverseDirection;
+    };
+
+    std::vector<Node> nodes;
+    std::vector<Leaf> leaves;
+    std::vector<uint32_t> primitives;       // Primitive indices, grouped by leaf
+    std::vector<AABB> primitiveBoxes;
+
+    uint32_t buildBinary(std::vector<BuildNode> &buildNodes, uint32_t first, uint32_t count) {
+        uint32_t index = (uint32_t) buildNodes.size();
+        buildNodes.push_back(BuildNode());
+
+        AABB bounds, centroidBounds;
+        for (uint32_t i = first; i < first + count; i++) {
+            bounds.grow(primitiveBoxes[primitives[i]]);
+            centroidBounds.grow(primitiveBoxes[primitives[i]].center());
+        }
+        buildNodes[index].bounds = bounds;
+
+        // Picking the axis the centroids are most spread out on
+        glm::vec3 extent = centroidBounds.maximum - centroidBounds.minimum;
+        int axis = 0;
+        if (extent.y > extent[axis]) {
+            axis = 1;
+        }
+        if (extent.z > extent[axis]) {
+            axis = 2;
+        }
+
+        uint32_t split = 0;
+        if (count > MAX_LEAF_SIZE && extent[axis] > 0.0f) {
+            split = findSAHSplit(first, count, axis, centroidBounds);
+        }
+
+        if (split == 0) {
+            buildNodes[index].first = first;
+            buildNodes[index].count = count;
+            return index;
+        }
+
+        uint32_t left = buildBinary(buildNodes, first, split);
+        uint32_t right = buildBinary(buildNodes, first + split, count - split);
+        buildNodes[index].left = left;
+        buildNodes[index].right = right;
+        buildNodes[index].first = 0;
+        buildNodes[index].count = 0;
+        return index;
+    }
+
+    /*
+     Bins the centroids along the axis and evaluates the surface area heuristic for
+     every split between bins, then partitions the primitives around the cheapest one.
+     Returns how many primitives ended up on the left.
+     */
+    uint32_t findSAHSplit(uint32_t first, uint32_t count, int axis, const AABB &centroidBounds) {
+        AABB binBounds[SAH_BINS];
+        uint32_t binCounts[SAH_BINS] = { 0 };
+        float binScale = (float) SAH_BINS / (centroidBounds.maximum[axis] - centroidBounds.minimum[axis]);
+
+        for (uint32_t i = first; i < first + count; i++) {
+            const AABB &box = primitiveBoxes[primitives[i]];
+            int bin = binFor(box.center()[axis], centroidBounds.minimum[axis], binScale);
+            binBounds[bin].grow(box);
+            binCounts[bin]++;
+        }
+
+        // Sweeping from the right first so the left sweep can evaluate every split in one go
+        float rightAreas[SAH_BINS];
+        uint32_t rightCounts[SAH_BINS];
+        AABB accumulated;
+        uint32_t accumulatedCount = 0;
+        for (int bin = SAH_BINS - 1; bin > 0; bin--) {
+            accumulated.grow(binBounds[bin]);
+            accumulatedCount += binCounts[bin];
+            rightAreas[bin] = accumulated.surfaceArea();
+            rightCounts[bin] = accumulatedCount;
+        }
+
+        float bestCost = FLT_MAX;
+        int bestBin = -1;
+        accumulated = AABB();
+        accumulatedCount = 0;
+        for (int bin = 1; bin < SAH_BINS; bin++) {
+            accumulated.grow(binBounds[bin - 1]);
+            accumulatedCount += binCounts[bin - 1];
+            if (accumulatedCount == 0 || rightCounts[bin] == 0) {
+                continue;
+            }
+            float cost = accumulated.surfaceArea() * accumulatedCount + rightAreas[bin] * rightCounts[bin];
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestBin = bin;
+            }
+        }
+
+        if (bestBin < 0) {
+            // Every centroid landed in the same bin, so just cutting the range in half
+            return count / 2;
+        }
+
+        // Partitioning the primitives in place around the chosen bin
+        uint32_t *begin = &primitives[first];
+        uint32_t *end = begin + count;
+        while (begin < end) {
+            if (binFor(primitiveBoxes[*begin].center()[axis], centroidBounds.minimum[axis], binScale) < bestBin) {
+                begin++;
+            } else {
+                end--;
+                uint32_t swap = *begin;
+                *begin = *end;
+                *end = swap;
+            }
+        }
+        return (uint32_t) (begin - &primitives[first]);
+    }
+
+    static int binFor(float centroid, float minimum, float binScale) {
+        int bin = (int) ((centroid - minimum) * binScale);
+        return bin < 0 ? 0 : (bin >= SAH_BINS ? SAH_BINS - 1 : bin);
+    }
+
+    // Turns a binary node and its descendants into 4-wide nodes, returning the new node's index
+    int32_t collapse(const std::vector<BuildNode> &buildNodes, uint32_t binaryIndex) {
+        // Opening up the interior child with the largest area until we have four children
+        uint32_t children[4] = { buildNodes[binaryIndex].left, buildNodes[binaryIndex].right, 0, 0 };
+        int childCount = 2;
+        while (childCount < 4) {
+            int largest = -1;
+            float largestArea = -1.0f;
+            for (int k = 0; k < childCount; k++) {
+                const BuildNode &candidate = buildNodes[children[k]];
+                if (candidate.count == 0 && candidate.bounds.surfaceArea() > largestArea) {
+                    largest = k;
+                    largestArea = candidate.bounds.surfaceArea();
+                }
+            }
+            if (largest < 0) {
+                break;
+            }
+            uint32_t opened = children[largest];
+            children[largest] = buildNodes[opened].left;
+            children[childCount++] = buildNodes[opened].right;
+        }
+
+        // Adding the node before its children keeps parents in front of them in the array
+        int32_t index = (int32_t) nodes.size();
+        nodes.push_back(Node());
+        for (int k = 0; k < childCount; k++) {
+            const BuildNode &child = buildNodes[children[k]];
+            if (child.count > 0) {
+                setLeafChild(index, k, child);
+            } else {
+                int32_t childIndex = collapse(buildNodes, children[k]);
+                nodes[index].child[k] = childIndex;
+                setChildBounds(nodes[index], k, child.bounds);
+            }
+        }
+        return index;
+    }
+
+    void setLeafChild(int32_t nodeIndex, int slot, const BuildNode &buildNode) {
+        Leaf leaf;
+        leaf.first = buildNode.first;
+        leaf.count = buildNode.count;
+        nodes[nodeIndex].child[slot] = ~(int32_t) leaves.size();
+        leaves.push_back(leaf);
+        setChildBounds(nodes[nodeIndex], slot, buildNode.bounds);
+    }
+
+    static void setChildBounds(Node &node, int slot, const AABB &bounds) {
+        node.minX[slot] = bounds.minimum.x;
+        node.minY[slot] = bounds.minimum.y;
+        node.minZ[slot] = bounds.minimum.z;
+        node.maxX[slot] = bounds.maximum.x;
+        node.maxY[slot] = bounds.maximum.y;
+        node.maxZ[slot] = bounds.maximum.z;
+    }
+
+    static AABB nodeBounds(const Node &node) {
+        AABB bounds;
+        for (int k = 0; k < 4; k++) {
+            if (node.child[k] != EMPTY) {
+                bounds.grow(AABB(glm::vec3(node.minX[k], node.minY[k], node.minZ[k]),
+                                 glm::vec3(node.maxX[k], node.maxY[k], node.maxZ[k])));
+            }
+        }
+        return bounds;
+    }
+
+    // A bit for every child slot that is in use
+    static int usedChildren(const Node &node) {
+        int mask = 0;
+        for (int k = 0; k < 4; k++) {
+            if (node.child[k] != EMPTY) {
+                mask |= 1 << k;
+            }
+        }
+        return mask;
+    }
+
+    // Calls visit() for every primitive under the child without any further testing
+    template <typename Function>
+    void visitAll(int32_t child, const Function &visit) const {
+        if (child < 0) {
+            const Leaf &leaf = leaves[~child];
+            for (uint32_t i = leaf.first; i < leaf.first + leaf.count; i++) {
+                visit(primitives[i]);
+            }
+            return;
+        }
+        const Node &node = nodes[child];
+        for (int k = 0; k < 4; k++) {
+            if (node.child[k] != EMPTY) {
+                visitAll(node.child[k], visit);
+            }
+        }
+    }
+
+    /*
+     Tests the four children of a node against the frustum. Returns a bit per child that
+     is at least partially inside, and sets insideMask to the children that are entirely
+     inside. For every plane, the corner furthest along the normal decides whether the
+     box is outside, and the nearest corner whether it is entirely inside.
+     */
+    static int frustumMask(const Node &node, const Frustum &frustum, int &insideMask) {
+#ifdef BVH_SSE2
+        __m128 minX = _mm_loadu_ps(node.minX), minY = _mm_loadu_ps(node.minY), minZ = _mm_loadu_ps(node.minZ);
+        __m128 maxX = _mm_loadu_ps(node.maxX), maxY = _mm_loadu_ps(node.maxY), maxZ = _mm_loadu_ps(node.maxZ);
+        __m128 zero = _mm_setzero_ps();
+        __m128 outside = zero;
+        __m128 straddling = zero;
+
+        for (int p = 0; p < 6; p++) {
+            const glm::vec4 &plane = frustum.planes[p];
+            __m128 nx = _mm_set1_ps(plane.x), ny = _mm_set1_ps(plane.y), nz = _mm_set1_ps(plane.z);
+            __m128 w = _mm_set1_ps(plane.w);
+
+            // The sign of the normal is the same for all four boxes, so the corners can be picked up front
+            __m128 farX = plane.x >= 0.0f ? maxX : minX, nearX = plane.x >= 0.0f ? minX : maxX;
+            __m128 farY = plane.y >= 0.0f ? maxY : minY, nearY = plane.y >= 0.0f ? minY : maxY;
+            __m128 farZ = plane.z >= 0.0f ? maxZ : minZ, nearZ = plane.z >= 0.0f ? minZ : maxZ;
+
+            __m128 farDistance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, farX), _mm_mul_ps(ny, farY)),
+                                            _mm_add_ps(_mm_mul_ps(nz, farZ), w));
+            __m128 nearDistance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nearX), _mm_mul_ps(ny, nearY)),
+                                             _mm_add_ps(_mm_mul_ps(nz, nearZ), w));
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(farDistance, zero));
+            straddling = _mm_or_ps(straddling, _mm_cmplt_ps(nearDistance, zero));
+        }
+
+        int visibleMask = ~_mm_movemask_ps(outside) & usedChildren(node);
+        insideMask = ~_mm_movemask_ps(straddling) & visibleMask;
+        return visibleMask;
+#else
+        int visibleMask = 0;
+        insideMask = 0;
+        for (int k = 0; k < 4; k++) {
+            if (node.child[k] == EMPTY) {
+                continue;
+            }
+            bool outside = false;
+            bool straddling = false;
+            for (int p = 0; p < 6; p++) {
+                const glm::vec4 &plane = frustum.planes[p];
+                float farDistance = plane.x * (plane.x >= 0.0f ? node.maxX[k] : node.minX[k]) +
+                                    plane.y * (plane.y >= 0.0f ? node.maxY[k] : node.minY[k]) +
+                                    plane.z * (plane.z >= 0.0f ? node.maxZ[k] : node.minZ[k]) + plane.w;
+                float nearDistance = plane.x * (plane.x >= 0.0f ? node.minX[k] : node.maxX[k]) +
+                                     plane.y * (plane.y >= 0.0f ? node.minY[k] : node.maxY[k]) +
+                                     plane.z * (plane.z >= 0.0f ? node.minZ[k] : node.maxZ[k]) + plane.w;
+                outside = outside || farDistance < 0.0f;
+                straddling = straddling || nearDistance < 0.0f;
+            }
+            if (!outside) {
+                visibleMask |= 1 << k;
+                if (!straddling) {
+                    insideMask |= 1 << k;
+                }
+            }
+        }
+        return visibleMask;
+#endif
+    }
+
+    // Slab tests the ray against the four children, returning a bit per child hit closer than maxDistance
+    static int rayMask(const Node &node, const Ray &ray, float maxDistance, float entry[4]) {
+#ifdef BVH_SSE2
+        __m128 originX = _mm_set1_ps(ray.origin.x), originY = _mm_set1_ps(ray.origin.y), originZ = _mm_set1_ps(ray.origin.z);
+        __m128 inverseX = _mm_set1_ps(ray.inverseDirection.x);
+        __m128 inverseY = _mm_set1_ps(ray.inverseDirection.y);
+        __m128 inverseZ = _mm_set1_ps(ray.inverseDirection.z);
+
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minX), originX), inverseX);
+        __m128 t2 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxX), originX), inverseX);
+        __m128 entryT = _mm_min_ps(t1, t2);
+        __m128 exitT = _mm_max_ps(t1, t2);
+
+        t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minY), originY), inverseY);
+        t2 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxY), originY), inverseY);
+        entryT = _mm_max_ps(entryT, _mm_min_ps(t1, t2));
+        exitT = _mm_min_ps(exitT, _mm_max_ps(t1, t2));
+
+        t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minZ), originZ), inverseZ);
+        t2 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxZ), originZ), inverseZ);
+        entryT = _mm_max_ps(entryT, _mm_min_ps(t1, t2));
+        exitT = _mm_min_ps(exitT, _mm_max_ps(t1, t2));
+
+        entryT = _mm_max_ps(entryT, _mm_setzero_ps());
+        __m128 hit = _mm_and_ps(_mm_cmple_ps(entryT, exitT), _mm_cmplt_ps(entryT, _mm_set1_ps(maxDistance)));
+        _mm_storeu_ps(entry, entryT);
+        // Inverted bounds don't make the slab test fail on their own, so empty slots have to be masked out
+        return _mm_movemask_ps(hit) & usedChildren(node);
+#else
+        int hitMask = 0;
+        for (int k = 0; k < 4; k++) {
+            entry[k] = FLT_MAX;
+            if (node.child[k] == EMPTY) {
+                continue;
+            }
+            AABB box(glm::vec3(node.minX[k], node.minY[k], node.minZ[k]), glm::vec3(node.maxX[k], node.maxY[k], node.maxZ[k]));
+            if (intersectRay(box, ray, entry[k]) && entry[k] < maxDistance) {
+                hitMask |= 1 << k;
+            }
+        }
+        return hitMask;
+#endif
+    }
+
+    static bool intersectRay(const AABB &box, const Ray &ray, float &entry) {
+        float entryT = 0.0f;
+        float exitT = FLT_MAX;
+        for (int axis = 0; axis < 3; axis++) {
+            float t1 = (box.minimum[axis] - ray.origin[axis]) * ray.inverseDirection[axis];
+            float t2 = (box.maximum[axis] - ray.origin[axis]) * ray.inverseDirection[axis];
+            entryT = std::fmax(entryT, std::fmin(t1, t2));
+            exitT = std::fmin(exitT, std::fmax(t1, t2));
+        }
+        entry = entryT;
+        return entryT <= exitT;
+    }
+};
+
+#endif
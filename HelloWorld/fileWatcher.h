@@ -0,0 +1,149 @@
+#ifndef FILEWATCHER_H
+#define FILEWATCHER_H
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+/*
+ Tells which of a set of files were saved since the last time it was asked, without ever
+ blocking, so it can be asked every frame. On Linux the kernel reports the changes through
+ inotify and asking costs one read() that usually comes back empty. Everywhere else the
+ modification times of the files are compared instead, at most every POLL_INTERVAL seconds.
+
+ The directories of the files are watched rather than the files themselves, since most
+ editors save by writing a new file and renaming it over the old one, which a watch on the
+ old file would never hear about.
+ */
+class FileWatcher {
+
+public:
+    static constexpr double POLL_INTERVAL = 0.25;
+
+    FileWatcher() : inotify(-1), lastPoll(std::chrono::steady_clock::now()) {
+#ifdef __linux__
+        inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotify < 0) {
+            std::cout << "ERROR::FILEWATCHER::INOTIFY_UNAVAILABLE, checking modification times instead" << std::endl;
+        }
+#endif
+    }
+
+    ~FileWatcher() {
+        if (inotify >= 0) {
+            close(inotify);
+        }
+    }
+
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher& operator=(const FileWatcher&) = delete;
+
+    void watch(const std::string &path) {
+        WatchedFile file;
+        file.path = path;
+        size_t slash = path.find_last_of('/');
+        std::string directory = slash == std::string::npos ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+        file.name = slash == std::string::npos ? path : path.substr(slash + 1);
+        file.modified = modificationTime(path);
+        file.watch = -1;
+#ifdef __linux__
+        // Watching the same directory twice hands back the same watch, so files can share one
+        if (inotify >= 0) {
+            file.watch = inotify_add_watch(inotify, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+        }
+#endif
+        files.push_back(file);
+    }
+
+    // The watched files that were saved since the last call, each of them once
+    std::vector<std::string> poll() {
+        std::vector<bool> changed(files.size(), false);
+        readEvents(changed);
+
+        // Files without a watch fall back on their modification times
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (std::chrono::duration<double>(now - lastPoll).count() >= POLL_INTERVAL) {
+            lastPoll = now;
+            for (size_t i = 0; i < files.size(); i++) {
+                if (files[i].watch >= 0) {
+                    continue;
+                }
+                // A file that's missing is most likely in the middle of being replaced, it shows up changed once it's back
+                long long modified = modificationTime(files[i].path);
+                if (modified >= 0 && modified != files[i].modified) {
+                    files[i].modified = modified;
+                    changed[i] = true;
+                }
+            }
+        }
+
+        std::vector<std::string> paths;
+        for (size_t i = 0; i < files.size(); i++) {
+            if (changed[i]) {
+                paths.push_back(files[i].path);
+            }
+        }
+        return paths;
+    }
+
+    // In nanoseconds, -1 if the file doesn't exist
+    static long long modificationTime(const std::string &path) {
+        struct stat status;
+        if (stat(path.c_str(), &status) != 0) {
+            return -1;
+        }
+#ifdef __APPLE__
+        return (long long) status.st_mtimespec.tv_sec * 1000000000LL + status.st_mtimespec.tv_nsec;
+#else
+        return (long long) status.st_mtim.tv_sec * 1000000000LL + status.st_mtim.tv_nsec;
+#endif
+    }
+
+private:
+    struct WatchedFile {
+        std::string path;
+        std::string name;       // Without its directory, which is how inotify names it
+        int watch;              // The inotify watch of its directory, or -1 if its modification time is polled
+        long long modified;     // In nanoseconds, -1 if the file didn't exist
+    };
+
+    int inotify;
+    std::vector<WatchedFile> files;
+    std::chrono::steady_clock::time_point lastPoll;
+
+    // Drains the pending inotify events, marking the files they are about
+    void readEvents(std::vector<bool> &changed) {
+#ifdef __linux__
+        if (inotify < 0) {
+            return;
+        }
+        alignas(struct inotify_event) char buffer[4096];
+        for (;;) {
+            ssize_t length = read(inotify, buffer, sizeof(buffer));
+            if (length <= 0) {
+                break;  // EAGAIN, nothing else has happened
+            }
+            for (ssize_t offset = 0; offset < length; ) {
+                const struct inotify_event *event = (const struct inotify_event*) (buffer + offset);
+                for (size_t i = 0; event->len > 0 && i < files.size(); i++) {
+                    if (files[i].watch == event->wd && files[i].name == event->name) {
+                        changed[i] = true;
+                    }
+                }
+                offset += sizeof(struct inotify_event) + event->len;
+            }
+        }
+#else
+        (void) changed;
+#endif
+    }
+};
+
+#endif
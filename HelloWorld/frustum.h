@@ -0,0 +1,60 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+
+// The six planes of a view frustum, used for throwing away objects that can't be seen
+class Frustum {
+
+public:
+    // Each plane is stored as (normal, distance) with the normal pointing into the frustum
+    glm::vec4 planes[6];
+
+    Frustum() {
+    }
+
+    // Extracts the planes from a combined projection * view matrix (Gribb/Hartmann)
+    Frustum(const glm::mat4 &viewProjection) {
+        // glm matrices are column major, so m[column][row]
+        for (int i = 0; i < 3; i++) {
+            glm::vec4 row = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+            glm::vec4 w = glm::vec4(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+            planes[i * 2] = normalizePlane(w + row);
+            planes[i * 2 + 1] = normalizePlane(w - row);
+        }
+    }
+
+    // Returns false if the sphere is completely outside of the frustum
+    bool intersectsSphere(const glm::vec3 &center, float radius) const {
+        for (int i = 0; i < 6; i++) {
+            if (planes[i].x * center.x + planes[i].y * center.y + planes[i].z * center.z + planes[i].w < -radius) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Returns false if the axis aligned box is completely outside of the frustum
+    bool intersectsBox(const glm::vec3 &minimum, const glm::vec3 &maximum) const {
+        for (int i = 0; i < 6; i++) {
+            // Only the corner furthest along the plane's normal needs to be tested
+            float x = planes[i].x >= 0.0f ? maximum.x : minimum.x;
+            float y = planes[i].y >= 0.0f ? maximum.y : minimum.y;
+            float z = planes[i].z >= 0.0f ? maximum.z : minimum.z;
+            if (planes[i].x * x + planes[i].y * y + planes[i].z * z + planes[i].w < 0.0f) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    static glm::vec4 normalizePlane(const glm::vec4 &plane) {
+        float length = std::sqrt(plane.x * plane.x + plane.y * plane.y + plane.z * plane.z);
+        return plane / length;
+    }
+};
+
+#endif
@@ -0,0 +1,738 @@
+#ifndef IMAGEBENCHMARK_H
+#define IMAGEBENCHMARK_H
+
+#include "stb_image.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+/*
+ Measures how fast stb_image decodes each format, so a decoder change can be compared
+ against a baseline instead of guessed at. Every image is decoded from memory over and over
+ until the timings settle, and the median decode is reported as images per second and as
+ MB/s of both the file and the decoded pixels.
+
+ The synthetic corpus covers every format except JPEG, which would need an encoder of its own:
+ PNGs for every filter type at 8 and 16 bits, BMP, TGA with and without RLE, PSD with and
+ without RLE, RLE HDR and an animated GIF. Real files can be added on top, which is also the
+ way to measure baseline and progressive JPEGs.
+
+ Each row ends with a checksum of the decoded pixels, so diffing the output of a run before
+ and after an optimization also shows whether it changed what comes out.
+ */
+class ImageBenchmark {
+
+public:
+    // Every image is decoded for at least this long, and at least MIN_RUNS times
+    static constexpr double MIN_SECONDS = 0.5;
+    static const int MIN_RUNS = 5;
+
+    static const int SYNTHETIC_SIZE = 1024;
+    static const int GIF_SIZE = 256;
+    static const int GIF_FRAMES = 16;
+
+    ImageBenchmark() {
+    }
+
+    void addSynthetic() {
+        const int size = SYNTHETIC_SIZE;
+        static const char *FILTER_NAMES[5] = { "none", "sub", "up", "average", "paeth" };
+        for (int depth = 8; depth <= 16; depth += 8) {
+            std::vector<unsigned char> pixels = image(size, size, 3, depth / 8);
+            for (int filter = 0; filter < 5; filter++) {
+                add("PNG " + std::to_string(depth) + "-bit " + FILTER_NAMES[filter], "synthetic",
+                    encodePNG(pixels, size, size, 3, depth, filter), depth == 16 ? DECODE_16 : DECODE_8);
+            }
+        }
+        add("BMP 24-bit", "synthetic", encodeBMP(image(size, size, 3, 1), size, size, 3), DECODE_8);
+        add("BMP 32-bit", "synthetic", encodeBMP(image(size, size, 4, 1), size, size, 4), DECODE_8);
+        add("TGA 24-bit", "synthetic", encodeTGA(image(size, size, 3, 1), size, size, 3, false), DECODE_8);
+        add("TGA 32-bit RLE", "synthetic", encodeTGA(flatten(image(size, size, 4, 1)), size, size, 4, true), DECODE_8);
+        add("PSD", "synthetic", encodePSD(image(size, size, 3, 1), size, size, false), DECODE_8);
+        add("PSD RLE", "synthetic", encodePSD(flatten(image(size, size, 3, 1)), size, size, true), DECODE_8);
+        add("HDR", "synthetic", encodeHDR(size, size), DECODE_FLOAT);
+        add("GIF " + std::to_string(GIF_FRAMES) + " frames", "synthetic", encodeGIF(GIF_SIZE, GIF_SIZE, GIF_FRAMES),
+            DECODE_GIF);
+    }
+
+    // Adds an image file, returns false if stb_image can't read it
+    bool addFile(const char *path) {
+        std::ifstream file(path, std::ios::binary);
+        std::vector<unsigned char> contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        int width, height, channels;
+        if (contents.empty() || !stbi_info_from_memory(&contents[0], (int) contents.size(), &width, &height, &channels)) {
+            return false;
+        }
+
+        std::string format = "other";
+        Decoder decoder = DECODE_8;
+        const unsigned char *c = &contents[0];
+        if (stbi_is_hdr_from_memory(c, (int) contents.size())) {
+            format = "HDR";
+            decoder = DECODE_FLOAT;
+        } else if (stbi_is_16_bit_from_memory(c, (int) contents.size())) {
+            decoder = DECODE_16;
+        }
+        if (contents.size() > 2 && c[0] == 0xFF && c[1] == 0xD8) {
+            stbi_progressive_jpeg *jpeg = stbi_progressive_jpeg_open(c, (int) contents.size());
+            format = jpeg && stbi_progressive_jpeg_is_progressive(jpeg) ? "JPEG progressive" : "JPEG baseline";
+            stbi_progressive_jpeg_close(jpeg);
+        } else if (contents.size() > 24 && memcmp(c, "\x89PNG", 4) == 0) {
+            format = "PNG " + std::to_string(c[24]) + "-bit";
+        } else if (memcmp(c, "BM", 2) == 0) {
+            format = "BMP";
+        } else if (contents.size() > 4 && memcmp(c, "GIF8", 4) == 0) {
+            format = "GIF";
+            decoder = DECODE_GIF;
+        } else if (contents.size() > 4 && memcmp(c, "8BPS", 4) == 0) {
+            format = "PSD";
+        }
+
+        std::string name = path;
+        size_t slash = name.find_last_of("/\\");
+        add(format, slash == std::string::npos ? name : name.substr(slash + 1), contents, decoder);
+        return true;
+    }
+
+    // Decodes every image until its timings settle and prints one row per image
+    void run() const {
+        std::cout << std::left << std::setw(20) << "format" << std::setw(20) << "source" << std::right
+                  << std::setw(16) << "size" << std::setw(10) << "KB" << std::setw(10) << "ms" << std::setw(10)
+                  << "images/s" << std::setw(10) << "MB/s in" << std::setw(10) << "MB/s out" << "  checksum"
+                  << std::endl;
+        for (size_t i = 0; i < entries.size(); i++) {
+            const Entry &entry = entries[i];
+            Result first = decode(entry);
+            if (!first.ok) {
+                std::cout << std::left << std::setw(20) << entry.format << std::setw(20) << entry.source
+                          << "failed: " << stbi_failure_reason() << std::endl;
+                continue;
+            }
+
+            std::vector<double> times;
+            double total = 0.0;
+            while ((int) times.size() < MIN_RUNS || total < MIN_SECONDS) {
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                decode(entry);
+                double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                times.push_back(seconds);
+                total += seconds;
+            }
+            std::sort(times.begin(), times.end());
+            double median = times[times.size() / 2];
+
+            std::string size = std::to_string(first.width) + "x" + std::to_string(first.height) + "x" +
+                               std::to_string(first.channels);
+            if (first.frames > 1) {
+                size += "x" + std::to_string(first.frames);
+            }
+            std::cout << std::left << std::setw(20) << entry.format << std::setw(20) << entry.source << std::right
+                      << std::setw(16) << size << std::fixed << std::setprecision(0) << std::setw(10)
+                      << entry.contents.size() / 1024.0 << std::setprecision(2) << std::setw(10) << median * 1000.0
+                      << std::setprecision(1) << std::setw(10) << 1.0 / median << std::setw(10)
+                      << entry.contents.size() / median / 1e6 << std::setw(10) << first.bytes / median / 1e6
+                      << "  " << std::hex << std::setw(8) << std::setfill('0') << first.checksum << std::dec
+                      << std::setfill(' ') << std::endl;
+        }
+    }
+
+private:
+    // Which stb_image entry point an image goes through, the same one the app would use for it
+    enum Decoder {
+        DECODE_8,
+        DECODE_16,
+        DECODE_FLOAT,
+        DECODE_GIF      // Every frame, with stbi_load_gif_from_memory
+    };
+
+    struct Entry {
+        std::string format;
+        std::string source;
+        std::vector<unsigned char> contents;
+        Decoder decoder;
+    };
+
+    struct Result {
+        bool ok;
+        int width, height, channels, frames;
+        size_t bytes;
+        uint32_t checksum;
+    };
+
+    std::vector<Entry> entries;
+
+    void add(const std::string &format, const std::string &source, const std::vector<unsigned char> &contents,
+             Decoder decoder) {
+        Entry entry;
+        entry.format = format;
+        entry.source = source;
+        entry.contents = contents;
+        entry.decoder = decoder;
+        entries.push_back(entry);
+    }
+
+    static Result decode(const Entry &entry) {
+        Result result;
+        result.frames = 1;
+        const unsigned char *buffer = &entry.contents[0];
+        int length = (int) entry.contents.size();
+        void *pixels = NULL;
+        size_t sampleSize = 1;
+        switch (entry.decoder) {
+            case DECODE_8:
+                pixels = stbi_load_from_memory(buffer, length, &result.width, &result.height, &result.channels, 0);
+                break;
+            case DECODE_16:
+                pixels = stbi_load_16_from_memory(buffer, length, &result.width, &result.height, &result.channels, 0);
+                sampleSize = 2;
+                break;
+            case DECODE_FLOAT:
+                pixels = stbi_loadf_from_memory(buffer, length, &result.width, &result.height, &result.channels, 0);
+                sampleSize = 4;
+                break;
+            case DECODE_GIF: {
+                int *delays = NULL;
+                pixels = stbi_load_gif_from_memory(buffer, length, &delays, &result.width, &result.height,
+                                                   &result.frames, &result.channels, 0);
+                stbi_image_free(delays);
+                break;
+            }
+        }
+        result.ok = pixels != NULL;
+        if (!result.ok) {
+            return result;
+        }
+        result.bytes = (size_t) result.width * result.height * result.channels * result.frames * sampleSize;
+
+        // FNV-1a
+        result.checksum = 2166136261u;
+        const unsigned char *bytes = (const unsigned char*) pixels;
+        for (size_t i = 0; i < result.bytes; i++) {
+            result.checksum = (result.checksum ^ bytes[i]) * 16777619u;
+        }
+        stbi_image_free(pixels);
+        return result;
+    }
+
+    /*
+     Synthetic images
+     */
+
+    // A gradient with some noise on top, so filters and compression have about as much to work with as on a photo
+    static unsigned char sample(int x, int y, int channel, int frame) {
+        uint32_t hash = (uint32_t) x * 73856093u ^ (uint32_t) y * 19349663u ^ (uint32_t) channel * 83492791u;
+        hash ^= hash >> 13;
+        hash *= 0x5bd1e995u;
+        hash ^= hash >> 15;
+        return (unsigned char) ((x + 2 * y + 64 * channel + 8 * frame) / 4 + (hash & 7));
+    }
+
+    // Samples of bytesPerSample bytes each, 16-bit ones stored big endian
+    static std::vector<unsigned char> image(int width, int height, int channels, int bytesPerSample) {
+        std::vector<unsigned char> pixels((size_t) width * height * channels * bytesPerSample);
+        size_t i = 0;
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                for (int c = 0; c < channels; c++) {
+                    pixels[i++] = sample(x, y, c, 0);
+                    if (bytesPerSample == 2) {
+                        pixels[i++] = (unsigned char) (x * 7 + y * 3 + c);
+                    }
+                }
+            }
+        }
+        return pixels;
+    }
+
+    // Drops the noise from an 8-bit image, leaving runs of equal pixels for the RLE formats
+    static std::vector<unsigned char> flatten(std::vector<unsigned char> pixels) {
+        for (size_t i = 0; i < pixels.size(); i++) {
+            pixels[i] &= 0xF0;
+        }
+        return pixels;
+    }
+
+    static void put16le(std::vector<unsigned char> &out, uint32_t value) {
+        out.push_back((unsigned char) value);
+        out.push_back((unsigned char) (value >> 8));
+    }
+
+    static void put32le(std::vector<unsigned char> &out, uint32_t value) {
+        put16le(out, value);
+        put16le(out, value >> 16);
+    }
+
+    static void put16be(std::vector<unsigned char> &out, uint32_t value) {
+        out.push_back((unsigned char) (value >> 8));
+        out.push_back((unsigned char) value);
+    }
+
+    static void put32be(std::vector<unsigned char> &out, uint32_t value) {
+        put16be(out, value >> 16);
+        put16be(out, value);
+    }
+
+    // Writes bits starting from the least significant one, the way both deflate and GIF pack them
+    struct BitWriter {
+        std::vector<unsigned char> &out;
+        uint32_t buffer;
+        int count;
+
+        BitWriter(std::vector<unsigned char> &out) : out(out), buffer(0), count(0) {
+        }
+
+        void write(uint32_t bits, int n) {
+            buffer |= bits << count;
+            count += n;
+            while (count >= 8) {
+                out.push_back((unsigned char) buffer);
+                buffer >>= 8;
+                count -= 8;
+            }
+        }
+
+        // Huffman codes go out most significant bit first
+        void writeCode(uint32_t code, int n) {
+            uint32_t reversed = 0;
+            for (int i = 0; i < n; i++) {
+                reversed |= ((code >> i) & 1) << (n - 1 - i);
+            }
+            write(reversed, n);
+        }
+
+        void flush() {
+            if (count > 0) {
+                out.push_back((unsigned char) buffer);
+            }
+            buffer = 0;
+            count = 0;
+        }
+    };
+
+    static std::vector<unsigned char> encodeBMP(const std::vector<unsigned char> &pixels, int width, int height,
+                                                int channels) {
+        int stride = (width * channels + 3) & ~3;
+        std::vector<unsigned char> out;
+        out.push_back('B');
+        out.push_back('M');
+        put32le(out, 54 + stride * height);
+        put32le(out, 0);
+        put32le(out, 54);
+        put32le(out, 40);
+        put32le(out, width);
+        put32le(out, height);
+        put16le(out, 1);
+        put16le(out, channels * 8);
+        put32le(out, 0);    // BI_RGB
+        put32le(out, stride * height);
+        put32le(out, 2835);
+        put32le(out, 2835);
+        put32le(out, 0);
+        put32le(out, 0);
+        for (int y = height - 1; y >= 0; y--) {
+            size_t rowStart = out.size();
+            for (int x = 0; x < width; x++) {
+                const unsigned char *p = &pixels[((size_t) y * width + x) * channels];
+                out.push_back(p[2]);
+                out.push_back(p[1]);
+                out.push_back(p[0]);
+                if (channels == 4) {
+                    out.push_back(p[3]);
+                }
+            }
+            out.resize(rowStart + stride, 0);
+        }
+        return out;
+    }
+
+    static std::vector<unsigned char> encodeTGA(const std::vector<unsigned char> &pixels, int width, int height,
+                                                int channels, bool rle) {
+        std::vector<unsigned char> out(18, 0);
+        out[2] = rle ? 10 : 2;
+        out[12] = (unsigned char) width;
+        out[13] = (unsigned char) (width >> 8);
+        out[14] = (unsigned char) height;
+        out[15] = (unsigned char) (height >> 8);
+        out[16] = (unsigned char) (channels * 8);
+        out[17] = 0x20 | (channels == 4 ? 8 : 0);     // Top to bottom, and how many bits of alpha
+
+        size_t count = (size_t) width * height;
+        std::vector<unsigned char> bgr(pixels.size());
+        for (size_t i = 0; i < count; i++) {
+            bgr[i * channels] = pixels[i * channels + 2];
+            bgr[i * channels + 1] = pixels[i * channels + 1];
+            bgr[i * channels + 2] = pixels[i * channels];
+            if (channels == 4) {
+                bgr[i * channels + 3] = pixels[i * channels + 3];
+            }
+        }
+        if (!rle) {
+            out.insert(out.end(), bgr.begin(), bgr.end());
+            return out;
+        }
+
+        // Packets of up to 128 pixels, either one pixel repeated or that many pixels as they are
+        const unsigned char *p = &bgr[0];
+        for (size_t i = 0; i < count; ) {
+            size_t run = 1;
+            while (i + run < count && run < 128 && memcmp(p + (i + run) * channels, p + i * channels, channels) == 0) {
+                run++;
+            }
+            if (run >= 2) {
+                out.push_back((unsigned char) (0x80 | (run - 1)));
+                out.insert(out.end(), p + i * channels, p + (i + 1) * channels);
+                i += run;
+                continue;
+            }
+            size_t literal = 1;
+            while (i + literal < count && literal < 128 &&
+                   (i + literal + 1 >= count ||
+                    memcmp(p + (i + literal) * channels, p + (i + literal + 1) * channels, channels) != 0)) {
+                literal++;
+            }
+            out.push_back((unsigned char) (literal - 1));
+            out.insert(out.end(), p + i * channels, p + (i + literal) * channels);
+            i += literal;
+        }
+        return out;
+    }
+
+    static std::vector<unsigned char> encodePSD(const std::vector<unsigned char> &pixels, int width, int height,
+                                                bool rle) {
+        std::vector<unsigned char> out;
+        out.insert(out.end(), { '8', 'B', 'P', 'S' });
+        put16be(out, 1);
+        out.insert(out.end(), 6, 0);
+        put16be(out, 3);
+        put32be(out, height);
+        put32be(out, width);
+        put16be(out, 8);
+        put16be(out, 3);    // RGB
+        put32be(out, 0);    // No color mode data, image resources or layers
+        put32be(out, 0);
+        put32be(out, 0);
+        put16be(out, rle ? 1 : 0);
+
+        // Every channel is stored as a plane of its own
+        std::vector<std::vector<unsigned char>> rows;
+        for (int c = 0; c < 3; c++) {
+            for (int y = 0; y < height; y++) {
+                std::vector<unsigned char> row(width);
+                for (int x = 0; x < width; x++) {
+                    row[x] = pixels[((size_t) y * width + x) * 3 + c];
+                }
+                rows.push_back(rle ? packBits(row) : row);
+            }
+        }
+        if (rle) {
+            for (size_t i = 0; i < rows.size(); i++) {
+                put16be(out, (uint32_t) rows[i].size());
+            }
+        }
+        for (size_t i = 0; i < rows.size(); i++) {
+            out.insert(out.end(), rows[i].begin(), rows[i].end());
+        }
+        return out;
+    }
+
+    // PSD's RLE: a count byte of n means n + 1 literal bytes follow, -n means the next byte repeats n + 1 times
+    static std::vector<unsigned char> packBits(const std::vector<unsigned char> &row) {
+        std::vector<unsigned char> out;
+        size_t i = 0;
+        while (i < row.size()) {
+            size_t run = 1;
+            while (i + run < row.size() && run < 128 && row[i + run] == row[i]) {
+                run++;
+            }
+            if (run >= 3) {
+                out.push_back((unsigned char) (257 - run));
+                out.push_back(row[i]);
+                i += run;
+                continue;
+            }
+            size_t literal = 0;
+            while (i + literal < row.size() && literal < 128 &&
+                   !(i + literal + 2 < row.size() && row[i + literal] == row[i + literal + 1] &&
+                     row[i + literal] == row[i + literal + 2])) {
+                literal++;
+            }
+            out.push_back((unsigned char) (literal - 1));
+            out.insert(out.end(), row.begin() + i, row.begin() + i + literal);
+            i += literal;
+        }
+        return out;
+    }
+
+    // Radiance RGBE with the run length encoded scanlines every HDR file written in the last 30 years uses
+    static std::vector<unsigned char> encodeHDR(int width, int height) {
+        std::string header = "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y " + std::to_string(height) + " +X " +
+                             std::to_string(width) + "\n";
+        std::vector<unsigned char> out(header.begin(), header.end());
+        std::vector<unsigned char> scanline((size_t) width * 4);
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                float rgb[3];
+                for (int c = 0; c < 3; c++) {
+                    rgb[c] = sample(x, y, c, 0) / 64.0f * (float) (1 << ((x / 128) % 4));
+                }
+                float largest = std::max(rgb[0], std::max(rgb[1], rgb[2]));
+                unsigned char *rgbe = &scanline[(size_t) x * 4];
+                if (largest < 1e-32f) {
+                    rgbe[0] = rgbe[1] = rgbe[2] = rgbe[3] = 0;
+                    continue;
+                }
+                int exponent;
+                float scale = std::frexp(largest, &exponent) * 256.0f / largest;
+                for (int c = 0; c < 3; c++) {
+                    rgbe[c] = (unsigned char) (rgb[c] * scale);
+                }
+                rgbe[3] = (unsigned char) (exponent + 128);
+            }
+
+            out.insert(out.end(), { 2, 2, (unsigned char) (width >> 8), (unsigned char) width });
+            for (int c = 0; c < 4; c++) {
+                std::vector<unsigned char> component(width);
+                for (int x = 0; x < width; x++) {
+                    component[x] = scanline[(size_t) x * 4 + c];
+                }
+                // Runs are 128 + n followed by the value, anything else is n bytes as they are
+                for (int x = 0; x < width; ) {
+                    int run = 1;
+                    while (x + run < width && run < 127 && component[x + run] == component[x]) {
+                        run++;
+                    }
+                    if (run >= 3) {
+                        out.push_back((unsigned char) (128 + run));
+                        out.push_back(component[x]);
+                        x += run;
+                        continue;
+                    }
+                    int dump = 0;
+                    while (x + dump < width && dump < 128 &&
+                           !(x + dump + 2 < width && component[x + dump] == component[x + dump + 1] &&
+                             component[x + dump] == component[x + dump + 2])) {
+                        dump++;
+                    }
+                    out.push_back((unsigned char) dump);
+                    out.insert(out.end(), component.begin() + x, component.begin() + x + dump);
+                    x += dump;
+                }
+            }
+        }
+        return out;
+    }
+
+    static std::vector<unsigned char> encodeGIF(int width, int height, int frames) {
+        std::vector<unsigned char> out;
+        out.insert(out.end(), { 'G', 'I', 'F', '8', '9', 'a' });
+        put16le(out, width);
+        put16le(out, height);
+        out.push_back(0xF7);    // A global color table with 256 entries
+        out.push_back(0);
+        out.push_back(0);
+        for (int i = 0; i < 256; i++) {
+            out.push_back((unsigned char) i);
+            out.push_back((unsigned char) (i * 3));
+            out.push_back((unsigned char) (255 - i));
+        }
+
+        for (int frame = 0; frame < frames; frame++) {
+            // Graphic control extension with a 40 ms delay, then a descriptor for the whole image
+            out.insert(out.end(), { 0x21, 0xF9, 4, 0, 4, 0, 0, 0 });
+            out.push_back(0x2C);
+            put16le(out, 0);
+            put16le(out, 0);
+            put16le(out, width);
+            put16le(out, height);
+            out.push_back(0);
+
+            /*
+             LZW with a clear code every 254 pixels, which keeps the codes at 9 bits and never
+             builds strings longer than one pixel. Not what a real encoder writes, but every frame
+             still goes through the decoder's full LZW and compositing path.
+             */
+            const int CLEAR = 256, END = 257;
+            std::vector<unsigned char> codes;
+            BitWriter bits(codes);
+            int sinceClear = 0;
+            bits.write(CLEAR, 9);
+            for (int y = 0; y < height; y++) {
+                for (int x = 0; x < width; x++) {
+                    if (sinceClear == 254) {
+                        bits.write(CLEAR, 9);
+                        sinceClear = 0;
+                    }
+                    bits.write(sample(x, y, 0, frame), 9);
+                    sinceClear++;
+                }
+            }
+            bits.write(END, 9);
+            bits.flush();
+
+            out.push_back(8);   // Minimum code size
+            for (size_t i = 0; i < codes.size(); i += 255) {
+                size_t block = std::min((size_t) 255, codes.size() - i);
+                out.push_back((unsigned char) block);
+                out.insert(out.end(), codes.begin() + i, codes.begin() + i + block);
+            }
+            out.push_back(0);
+        }
+        out.push_back(0x3B);
+        return out;
+    }
+
+    static std::vector<unsigned char> encodePNG(const std::vector<unsigned char> &pixels, int width, int height,
+                                                int channels, int depth, int filter) {
+        size_t pixelSize = (size_t) channels * depth / 8;
+        size_t stride = width * pixelSize;
+        std::vector<unsigned char> filtered;
+        filtered.reserve((stride + 1) * height);
+        for (int y = 0; y < height; y++) {
+            const unsigned char *row = &pixels[y * stride];
+            const unsigned char *previous = y > 0 ? row - stride : NULL;
+            filtered.push_back((unsigned char) filter);
+            for (size_t i = 0; i < stride; i++) {
+                int a = i >= pixelSize ? row[i - pixelSize] : 0;
+                int b = previous ? previous[i] : 0;
+                int c = previous && i >= pixelSize ? previous[i - pixelSize] : 0;
+                int predicted = 0;
+                switch (filter) {
+                    case 1: predicted = a; break;
+                    case 2: predicted = b; break;
+                    case 3: predicted = (a + b) / 2; break;
+                    case 4: {
+                        int p = a + b - c, pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+                        predicted = pa <= pb && pa <= pc ? a : (pb <= pc ? b : c);
+                        break;
+                    }
+                }
+                filtered.push_back((unsigned char) (row[i] - predicted));
+            }
+        }
+
+        std::vector<unsigned char> out;
+        out.insert(out.end(), { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' });
+        std::vector<unsigned char> header;
+        put32be(header, width);
+        put32be(header, height);
+        header.push_back((unsigned char) depth);
+        header.push_back(channels == 4 ? 6 : 2);
+        header.insert(header.end(), { 0, 0, 0 });
+        writeChunk(out, "IHDR", header);
+        writeChunk(out, "IDAT", zlibCompress(filtered));
+        writeChunk(out, "IEND", std::vector<unsigned char>());
+        return out;
+    }
+
+    static void writeChunk(std::vector<unsigned char> &out, const char *type, const std::vector<unsigned char> &data) {
+        put32be(out, (uint32_t) data.size());
+        size_t start = out.size();
+        out.insert(out.end(), type, type + 4);
+        out.insert(out.end(), data.begin(), data.end());
+
+        uint32_t crc = 0xFFFFFFFFu;
+        for (size_t i = start; i < out.size(); i++) {
+            crc ^= out[i];
+            for (int k = 0; k < 8; k++) {
+                crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+            }
+        }
+        put32be(out, crc ^ 0xFFFFFFFFu);
+    }
+
+    /*
+     A single deflate block with the fixed Huffman codes, and matches found through a hash of
+     the next three bytes that only remembers the last place each hash was seen. That's far from
+     zlib's compression, but the decoder goes through the same literal, length and distance paths.
+     */
+    static std::vector<unsigned char> zlibCompress(const std::vector<unsigned char> &data) {
+        static const int LENGTH_BASE[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
+                                             67, 83, 99, 115, 131, 163, 195, 227, 258 };
+        static const int LENGTH_EXTRA[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                                              4, 4, 4, 4, 5, 5, 5, 5, 0 };
+        static const int DISTANCE_BASE[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385,
+                                               513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385,
+                                               24577 };
+        static const int DISTANCE_EXTRA[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8,
+                                                9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+        const int HASH_BITS = 15, WINDOW = 32768, MAX_MATCH = 258;
+
+        std::vector<unsigned char> out;
+        out.push_back(0x78);
+        out.push_back(0x01);
+        BitWriter bits(out);
+        bits.write(1, 1);   // Final block
+        bits.write(1, 2);   // Fixed Huffman codes
+
+        std::vector<int> head((size_t) 1 << HASH_BITS, -1);
+        size_t size = data.size();
+        for (size_t i = 0; i < size; ) {
+            int length = 0, distance = 0;
+            if (i + 3 <= size) {
+                uint32_t hash = ((data[i] << 16 | data[i + 1] << 8 | data[i + 2]) * 2654435761u) >> (32 - HASH_BITS);
+                int candidate = head[hash];
+                head[hash] = (int) i;
+                if (candidate >= 0 && (int) i - candidate <= WINDOW) {
+                    size_t limit = std::min((size_t) MAX_MATCH, size - i);
+                    while ((size_t) length < limit && data[candidate + length] == data[i + length]) {
+                        length++;
+                    }
+                    distance = (int) i - candidate;
+                }
+            }
+            if (length < 3) {
+                writeLiteral(bits, data[i]);
+                i++;
+                continue;
+            }
+
+            int code = 0;
+            while (code < 28 && LENGTH_BASE[code + 1] <= length) {
+                code++;
+            }
+            writeLiteral(bits, 257 + code);
+            bits.write(length - LENGTH_BASE[code], LENGTH_EXTRA[code]);
+            code = 0;
+            while (code < 29 && DISTANCE_BASE[code + 1] <= distance) {
+                code++;
+            }
+            bits.writeCode(code, 5);
+            bits.write(distance - DISTANCE_BASE[code], DISTANCE_EXTRA[code]);
+            i += length;
+        }
+        writeLiteral(bits, 256);
+        bits.flush();
+
+        uint32_t a = 1, b = 0;
+        for (size_t i = 0; i < size; i++) {
+            a = (a + data[i]) % 65521;
+            b = (b + a) % 65521;
+        }
+        put32be(out, b << 16 | a);
+        return out;
+    }
+
+    // The fixed literal/length code of deflate
+    static void writeLiteral(BitWriter &bits, int symbol) {
+        if (symbol < 144) {
+            bits.writeCode(0x30 + symbol, 8);
+        } else if (symbol < 256) {
+            bits.writeCode(0x190 + symbol - 144, 9);
+        } else if (symbol < 280) {
+            bits.writeCode(symbol - 256, 7);
+        } else {
+            bits.writeCode(0xC0 + symbol - 280, 8);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef INSTANCEBUFFER_H
+#define INSTANCEBUFFER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <utility>
+#include <vector>
+
+/*
+ Keeps a copy of every model matrix on the GPU. The matrices
+ live in a buffer texture (four RGBA32F texels per matrix) which the vertex shader
+ reads with texelFetch(), indexed by the modelIndex uniform plus gl_InstanceID. That
+ way a single draw call can cover any run of consecutive objects.
+
+ Only the ranges of matrices that changed since the last update are uploaded again.
+ The matrices can come from anything with size(), modelData() and takeChangedRanges(),
+ like a TransformStore or a SceneGraph.
+ */
+class InstanceBuffer {
+
+public:
+    // The ID of the buffer that holds the matrices, and of the buffer texture that views it
+    unsigned int buffer;
+    unsigned int texture;
+
+    InstanceBuffer() : buffer(0), texture(0), capacity(0) {
+    }
+
+    ~InstanceBuffer() {
+        if (buffer) {
+            glDeleteBuffers(1, &buffer);
+            glDeleteTextures(1, &texture);
+        }
+    }
+
+    InstanceBuffer(const InstanceBuffer&) = delete;
+    InstanceBuffer& operator=(const InstanceBuffer&) = delete;
+
+    // Uploads whatever changed in the source since the last update, growing the buffer if needed
+    template <typename MatrixSource>
+    void update(MatrixSource &transforms) {
+        if (!buffer) {
+            glGenBuffers(1, &buffer);
+            glGenTextures(1, &texture);
+        }
+
+        transforms.takeChangedRanges(changedRanges);
+
+        glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+        if (transforms.size() > capacity) {
+            // Allocating some headroom so that adding a few objects doesn't reallocate every time
+            capacity = transforms.size() + transforms.size() / 2;
+            glBufferData(GL_TEXTURE_BUFFER, capacity * sizeof(glm::mat4), NULL, GL_DYNAMIC_DRAW);
+            glBufferSubData(GL_TEXTURE_BUFFER, 0, transforms.size() * sizeof(glm::mat4), transforms.modelData());
+
+            // Buffer textures have to be pointed at the buffer again after it has been reallocated
+            glBindTexture(GL_TEXTURE_BUFFER, texture);
+            glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffer);
+        } else {
+            for (size_t i = 0; i < changedRanges.size(); i++) {
+                size_t begin = changedRanges[i].first;
+                size_t end = changedRanges[i].second;
+                glBufferSubData(GL_TEXTURE_BUFFER, begin * sizeof(glm::mat4), (end - begin) * sizeof(glm::mat4),
+                                transforms.modelData() + begin * 16);
+            }
+        }
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    // Binds the matrices to the given texture unit for the vertex shader's samplerBuffer
+    void bind(unsigned int unit) const {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_BUFFER, texture);
+    }
+
+private:
+    size_t capacity;
+    std::vector<std::pair<size_t, size_t>> changedRanges;
+};
+
+#endif
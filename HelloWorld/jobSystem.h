@@ -0,0 +1,452 @@
+#ifndef JOBSYSTEM_H
+#define JOBSYSTEM_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class JobSystem;
+
+// A unit of work that has been handed to the job system
+struct Job {
+    std::function<void()> function;
+    class JobCounter *counter;     // Decremented once the job has run, may be NULL
+};
+
+/*
+ Counts how many jobs of a group are still outstanding. Waiting on a counter lets
+ the waiting thread run other jobs in the meantime, and jobs can be scheduled to
+ start only once a counter has dropped to zero, which is how dependencies between
+ jobs are expressed.
+ */
+class JobCounter {
+
+public:
+    JobCounter() : pending(0), releasing(0) {
+    }
+
+    JobCounter(const JobCounter&) = delete;
+    JobCounter& operator=(const JobCounter&) = delete;
+
+    // A counter may only be destroyed once it is done, which also means no job is still touching it
+    bool done() const {
+        return pending.load(std::memory_order_seq_cst) == 0 && releasing.load(std::memory_order_seq_cst) == 0;
+    }
+
+private:
+    friend class JobSystem;
+
+    std::atomic<int> pending;
+    std::atomic<int> releasing;         // Jobs that have finished but are still decrementing this counter
+    std::mutex continuationMutex;
+    std::vector<Job*> continuations;   // Jobs waiting for this counter to reach zero
+};
+
+/*
+ A fixed size Chase-Lev work-stealing deque. The thread that owns it pushes and pops
+ jobs at the bottom while any other thread may steal from the top.
+ */
+class WorkStealingDeque {
+
+public:
+    static const long CAPACITY = 4096;
+
+    WorkStealingDeque() : top(0), bottom(0) {
+        for (long i = 0; i < CAPACITY; i++) {
+            buffer[i].store(NULL, std::memory_order_relaxed);
+        }
+    }
+
+    // Only called by the owning thread. Returns false if the deque is full
+    bool push(Job *job) {
+        long b = bottom.load(std::memory_order_relaxed);
+        long t = top.load(std::memory_order_acquire);
+        if (b - t >= CAPACITY) {
+            return false;
+        }
+        buffer[b & (CAPACITY - 1)].store(job, std::memory_order_release);
+        bottom.store(b + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Only called by the owning thread, takes the most recently pushed job
+    Job* pop() {
+        long b = bottom.load(std::memory_order_relaxed) - 1;
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        long t = top.load(std::memory_order_relaxed);
+
+        if (t > b) {
+            // The deque was already empty
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return NULL;
+        }
+
+        Job *job = buffer[b & (CAPACITY - 1)].load(std::memory_order_acquire);
+        if (t == b) {
+            // This is the last job, so we have to race any thieves for it
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                job = NULL;
+            }
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return job;
+    }
+
+    // Can be called from any thread, takes the oldest job
+    Job* steal() {
+        long t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        long b = bottom.load(std::memory_order_acquire);
+        if (t >= b) {
+            return NULL;
+        }
+
+        Job *job = buffer[t & (CAPACITY - 1)].load(std::memory_order_acquire);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            // Somebody else got to it first
+            return NULL;
+        }
+        return job;
+    }
+
+    bool empty() const {
+        return top.load(std::memory_order_acquire) >= bottom.load(std::memory_order_acquire);
+    }
+
+private:
+    // Padding the indices apart so thieves hammering the top don't slow down the owner at the bottom
+    std::atomic<long> top;
+    char padding[64 - sizeof(std::atomic<long>)];
+    std::atomic<long> bottom;
+    std::atomic<Job*> buffer[CAPACITY];
+};
+
+/*
+ A work-stealing thread pool that the whole engine shares, so that asset decoding,
+ culling and transform updates don't each spin up their own threads. Every worker
+ owns a deque, as does the thread that created the job system (normally the main
+ thread), which takes part in the work whenever it waits on a counter. Threads
+ that aren't part of the pool submit through a shared queue instead.
+
+ On a machine with N cores the pool should be created with N - 1 workers.
+ */
+class JobSystem {
+
+public:
+    // Starts up the worker threads, the calling thread becomes thread 0 of the pool
+    JobSystem(unsigned int workerCount) : injectedCount(0), running(true), sleepingWorkers(0) {
+        deques.resize(workerCount + 1);
+        for (unsigned int i = 0; i < workerCount + 1; i++) {
+            deques[i] = new WorkStealingDeque();
+        }
+        registerThread(0);
+        for (unsigned int i = 0; i < workerCount; i++) {
+            workers.push_back(std::thread(&JobSystem::workerLoop, this, i + 1));
+        }
+    }
+
+    // Waits for the workers to finish whatever they're doing and joins them
+    ~JobSystem() {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            running.store(false);
+        }
+        sleepCondition.notify_all();
+        for (size_t i = 0; i < workers.size(); i++) {
+            workers[i].join();
+        }
+
+        // Anything that never got to run is simply thrown away
+        for (size_t i = 0; i < deques.size(); i++) {
+            while (Job *job = deques[i]->steal()) {
+                delete job;
+            }
+            delete deques[i];
+        }
+        for (size_t i = 0; i < injected.size(); i++) {
+            delete injected[i];
+        }
+        if (currentThread().system == this) {
+            runExitFunctions();
+            currentThread().system = NULL;
+        }
+    }
+
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    // Number of threads that can work on jobs, including the thread that created the pool
+    unsigned int threadCount() const {
+        return (unsigned int) deques.size();
+    }
+
+    /*
+     Registers a function that every worker runs just before it exits, and that the thread
+     which created the pool runs when destroying it. It is meant for thread local state the
+     jobs leave behind, which would otherwise only be freed when the process exits.
+     */
+    void atThreadExit(const std::function<void()> &function) {
+        std::lock_guard<std::mutex> lock(exitMutex);
+        exitFunctions.push_back(function);
+    }
+
+    // Schedules a job. If a counter is given it is incremented now and decremented once the job has run
+    void run(const std::function<void()> &function, JobCounter *counter = NULL) {
+        if (counter) {
+            counter->pending.fetch_add(1, std::memory_order_relaxed);
+        }
+        Job *job = new Job();
+        job->function = function;
+        job->counter = counter;
+        enqueue(job);
+    }
+
+    // Schedules a job that will only start once the dependency counter has reached zero
+    void runAfter(JobCounter &dependency, const std::function<void()> &function, JobCounter *counter = NULL) {
+        if (counter) {
+            counter->pending.fetch_add(1, std::memory_order_relaxed);
+        }
+        Job *job = new Job();
+        job->function = function;
+        job->counter = counter;
+
+        {
+            // Whoever drops the counter to zero takes the continuations under this same lock
+            std::lock_guard<std::mutex> lock(dependency.continuationMutex);
+            if (dependency.pending.load(std::memory_order_seq_cst) != 0) {
+                dependency.continuations.push_back(job);
+                return;
+            }
+        }
+        enqueue(job);
+    }
+
+    // Runs other jobs on the calling thread until the counter reaches zero
+    void wait(JobCounter &counter) {
+        int index = threadIndex();
+        while (!counter.done()) {
+            Job *job = findJob(index);
+            if (job) {
+                execute(job);
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    /*
+     Calls function(begin, end) over [0, count) split into contiguous ranges of at
+     least batchSize elements and blocks until all of them are done. Every range is
+     disjoint, so each call can write into its own segment of an output buffer
+     without any synchronization. The calling thread works on ranges as well.
+     */
+    template <typename Function>
+    void parallelFor(size_t count, size_t batchSize, const Function &function) {
+        if (count == 0) {
+            return;
+        }
+        if (batchSize == 0) {
+            batchSize = 1;
+        }
+
+        // A few ranges per thread gives the workers something to steal if some ranges turn out slower
+        size_t rangeCount = (count + batchSize - 1) / batchSize;
+        size_t maximumRanges = threadCount() * 4;
+        if (rangeCount > maximumRanges) {
+            rangeCount = maximumRanges;
+        }
+        if (rangeCount <= 1 || threadCount() == 1) {
+            function((size_t) 0, count);
+            return;
+        }
+
+        size_t rangeSize = (count + rangeCount - 1) / rangeCount;
+        JobCounter counter;
+        for (size_t begin = rangeSize; begin < count; begin += rangeSize) {
+            size_t end = begin + rangeSize < count ? begin + rangeSize : count;
+            run([&function, begin, end]() {
+                function(begin, end);
+            }, &counter);
+        }
+
+        function((size_t) 0, rangeSize);
+        wait(counter);
+    }
+
+private:
+    // Which pool (if any) the current thread belongs to, and its deque within that pool
+    struct ThreadState {
+        JobSystem *system;
+        int index;
+    };
+
+    std::vector<std::thread> workers;
+    std::vector<WorkStealingDeque*> deques;
+
+    // Jobs submitted from threads outside of the pool, or that didn't fit into a full deque
+    std::mutex injectedMutex;
+    std::deque<Job*> injected;
+    std::atomic<size_t> injectedCount;
+
+    std::atomic<bool> running;
+    std::atomic<int> sleepingWorkers;
+    std::mutex sleepMutex;
+    std::condition_variable sleepCondition;
+
+    std::mutex exitMutex;
+    std::vector<std::function<void()>> exitFunctions;
+
+    static ThreadState& currentThread() {
+        static thread_local ThreadState state = { NULL, -1 };
+        return state;
+    }
+
+    void registerThread(int index) {
+        currentThread().system = this;
+        currentThread().index = index;
+    }
+
+    // Returns the deque of the calling thread, or -1 if it isn't part of this pool
+    int threadIndex() {
+        return currentThread().system == this ? currentThread().index : -1;
+    }
+
+    void enqueue(Job *job) {
+        int index = threadIndex();
+        if (index < 0 || !deques[index]->push(job)) {
+            std::lock_guard<std::mutex> lock(injectedMutex);
+            injected.push_back(job);
+            injectedCount.fetch_add(1, std::memory_order_seq_cst);
+        }
+
+        // Waking up a worker to take it if they're all asleep
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleepingWorkers.load(std::memory_order_seq_cst) > 0) {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            sleepCondition.notify_one();
+        }
+    }
+
+    Job* popInjected() {
+        if (injectedCount.load(std::memory_order_acquire) == 0) {
+            return NULL;
+        }
+        std::lock_guard<std::mutex> lock(injectedMutex);
+        if (injected.empty()) {
+            return NULL;
+        }
+        Job *job = injected.front();
+        injected.pop_front();
+        injectedCount.fetch_sub(1, std::memory_order_relaxed);
+        return job;
+    }
+
+    // Looks for work in our own deque first, then the shared queue, then tries stealing from everybody else
+    Job* findJob(int index) {
+        Job *job = NULL;
+        if (index >= 0) {
+            job = deques[index]->pop();
+            if (job) {
+                return job;
+            }
+        }
+        job = popInjected();
+        if (job) {
+            return job;
+        }
+
+        size_t dequeCount = deques.size();
+        size_t start = index >= 0 ? (size_t) index + 1 : 0;
+        for (size_t i = 0; i < dequeCount; i++) {
+            size_t victim = (start + i) % dequeCount;
+            if ((int) victim == index) {
+                continue;
+            }
+            job = deques[victim]->steal();
+            if (job) {
+                return job;
+            }
+        }
+        return NULL;
+    }
+
+    bool hasWork() {
+        if (injectedCount.load(std::memory_order_seq_cst) != 0) {
+            return true;
+        }
+        for (size_t i = 0; i < deques.size(); i++) {
+            if (!deques[i]->empty()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void execute(Job *job) {
+        job->function();
+        JobCounter *counter = job->counter;
+        delete job;
+
+        if (!counter) {
+            return;
+        }
+
+        // Anyone waiting on the counter has to hold off on destroying it until we're completely done with it
+        counter->releasing.fetch_add(1, std::memory_order_seq_cst);
+        std::vector<Job*> released;
+        if (counter->pending.fetch_sub(1, std::memory_order_seq_cst) == 1) {
+            // The counter just hit zero so anything that depends on it can be released
+            std::lock_guard<std::mutex> lock(counter->continuationMutex);
+            released.swap(counter->continuations);
+        }
+        counter->releasing.fetch_sub(1, std::memory_order_seq_cst);
+
+        for (size_t i = 0; i < released.size(); i++) {
+            enqueue(released[i]);
+        }
+    }
+
+    void workerLoop(int index) {
+        registerThread(index);
+        int idleSpins = 0;
+
+        while (running.load(std::memory_order_acquire)) {
+            Job *job = findJob(index);
+            if (job) {
+                execute(job);
+                idleSpins = 0;
+                continue;
+            }
+
+            // Spinning for a little while before going to sleep, since new work usually shows up quickly
+            if (++idleSpins < 64) {
+                std::this_thread::yield();
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            sleepingWorkers.fetch_add(1, std::memory_order_seq_cst);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (running.load(std::memory_order_acquire) && !hasWork()) {
+                sleepCondition.wait(lock);
+            }
+            sleepingWorkers.fetch_sub(1, std::memory_order_seq_cst);
+            idleSpins = 0;
+        }
+        runExitFunctions();
+    }
+
+    void runExitFunctions() {
+        std::lock_guard<std::mutex> lock(exitMutex);
+        for (size_t i = 0; i < exitFunctions.size(); i++) {
+            exitFunctions[i]();
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,140 @@
+#ifndef LODCHAIN_H
+#define LODCHAIN_H
+
+#include <glm/glm.hpp>
+
+#include "meshSimplifier.h"
+
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <vector>
+
+// One level of detail: a range of the chain's index list
+struct LodLevel {
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    float error;                // How far the level strays from the full detail mesh, in object units
+    float minimumScreenSize;    // The level is used while the object is at least this many pixels across
+};
+
+/*
+ A mesh along with progressively simpler versions of it. All of the levels share one
+ vertex list, and their indices are stored back to back so the whole chain fits in one
+ VBO and one EBO. Each level has about half the triangles of the one before it.
+
+ The chain is built ahead of time, so the cost of simplifying never shows up in a frame.
+ At runtime selectLevel() picks a level from how large the object appears on the screen.
+ */
+class LodChain {
+
+public:
+    // Interleaved vertex data with stride floats per vertex, the position coming first
+    std::vector<float> vertices;
+    size_t stride;
+
+    std::vector<uint32_t> indices;
+    std::vector<LodLevel> levels;
+
+    // Below a level's screen size, the object has to shrink this much further before dropping to the next one
+    static constexpr float HYSTERESIS = 0.15f;
+
+    LodChain() : stride(0) {
+    }
+
+    /*
+     Builds the chain from a non-indexed triangle list. Vertices that are identical in every
+     attribute are merged first so that the simplifier sees which triangles are connected.
+     Levels stop being added once simplifying would exceed maxError or stops making progress.
+     The full detail level is used for objects at least detailScreenSize pixels across, and
+     every level after it takes over at half the size of the one before.
+     */
+    void build(const float *triangleVertices, size_t vertexCount, size_t vertexStride, size_t maxLevels,
+               float maxError, float detailScreenSize) {
+        stride = vertexStride;
+        vertices.clear();
+        indices.clear();
+        levels.clear();
+
+        std::vector<uint32_t> fullDetail;
+        weld(triangleVertices, vertexCount, fullDetail);
+
+        std::vector<glm::vec3> positions(vertices.size() / stride);
+        for (size_t i = 0; i < positions.size(); i++) {
+            positions[i] = glm::vec3(vertices[i * stride], vertices[i * stride + 1], vertices[i * stride + 2]);
+        }
+        MeshSimplifier simplifier(positions);
+
+        std::vector<uint32_t> levelIndices = fullDetail;
+        float levelError = 0.0f;
+        float screenSize = detailScreenSize;
+        while (true) {
+            LodLevel level;
+            level.firstIndex = (uint32_t) indices.size();
+            level.indexCount = (uint32_t) levelIndices.size();
+            level.error = levelError;
+            level.minimumScreenSize = screenSize;
+            levels.push_back(level);
+            indices.insert(indices.end(), levelIndices.begin(), levelIndices.end());
+
+            if (levels.size() >= maxLevels) {
+                break;
+            }
+            size_t target = levelIndices.size() / 6 * 3;
+            std::vector<uint32_t> simpler = simplifier.simplify(fullDetail, target, maxError, &levelError);
+
+            // Not worth a level of its own if it didn't get rid of at least a tenth of the triangles
+            if (simpler.size() * 10 > levelIndices.size() * 9) {
+                break;
+            }
+            levelIndices.swap(simpler);
+            screenSize *= 0.5f;
+        }
+        levels.back().minimumScreenSize = 0.0f;
+    }
+
+    /*
+     Picks the level for an object that is screenSize pixels across, given the level it used
+     last frame. An object has to get clearly smaller or larger than a level's threshold before
+     it switches, so one sitting right on a threshold doesn't pop back and forth every frame.
+     */
+    size_t selectLevel(size_t current, float screenSize) const {
+        size_t coarser = levelFor(screenSize * (1.0f + HYSTERESIS));
+        if (coarser > current) {
+            return coarser;
+        }
+        size_t finer = levelFor(screenSize * (1.0f - HYSTERESIS));
+        if (finer < current) {
+            return finer;
+        }
+        return current;
+    }
+
+private:
+    size_t levelFor(float screenSize) const {
+        size_t level = 0;
+        while (level + 1 < levels.size() && screenSize < levels[level].minimumScreenSize) {
+            level++;
+        }
+        return level;
+    }
+
+    void weld(const float *triangleVertices, size_t vertexCount, std::vector<uint32_t> &weldedIndices) {
+        std::map<std::vector<float>, uint32_t> seen;
+        weldedIndices.resize(vertexCount);
+        for (size_t i = 0; i < vertexCount; i++) {
+            std::vector<float> vertex(triangleVertices + i * stride, triangleVertices + (i + 1) * stride);
+            std::map<std::vector<float>, uint32_t>::iterator found = seen.find(vertex);
+            if (found != seen.end()) {
+                weldedIndices[i] = found->second;
+                continue;
+            }
+            uint32_t index = (uint32_t) (vertices.size() / stride);
+            vertices.insert(vertices.end(), vertex.begin(), vertex.end());
+            seen[vertex] = index;
+            weldedIndices[i] = index;
+        }
+    }
+};
+
+#endif
@@ -14,21 +14,89 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include "myShader.h"
+#include "fileWatcher.h"
+#include "renderQueue.h"
+#include "jobSystem.h"
+#include "frustum.h"
+#include "sceneGraph.h"
+#include "bvh.h"
+#include "occlusionCuller.h"
+#include "softwareOcclusion.h"
+#include "lodChain.h"
+#include "instanceBuffer.h"
+#include "textureArray.h"
+#include "textureAtlas.h"
+#include "textureStreamer.h"
+#include "assetIndex.h"
+#include "imageBenchmark.h"
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
+#include <thread>
+#include <utility>
+#include <vector>
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void processInput(GLFWwindow *window);
+int buildAtlas(const char *outputPath, int imageCount, const char * const *imagePaths);
+int benchmarkImages(int imageCount, const char * const *imagePaths);
 
 // Screen width and height
 const unsigned int SCREEN_WIDTH = 800;
 const unsigned int SCREEN_HEIGHT = 600;
 
+// Near and far planes of our projection, the render queue also uses them to quantize depth
+const float NEAR_PLANE = 0.1f;
+const float FAR_PLANE = 100.0f;
+
+// The bounds of our cube mesh in its own space
+const AABB CUBE_BOUNDS = AABB(glm::vec3(-0.5f), glm::vec3(0.5f));
+
+// The cube mesh is the full detail level of its LOD chain, simpler levels are only added while they stay within LOD_MAX_ERROR
+const size_t MAX_LOD_LEVELS = 6;
+const float LOD_MAX_ERROR = 0.01f;
+
+// How many pixels across a cube has to be to get its full detail level
+const float LOD_DETAIL_SIZE = 400.0f;
+
+// How much GPU memory streamed textures may take up before their finest mip levels get dropped
+const size_t TEXTURE_MEMORY_BUDGET = 64 * 1024 * 1024;
+
+// Below this many objects per thread, splitting the work up costs more than it saves
+const size_t RECORD_BATCH_SIZE = 256;
+
 // Stores how much we want to mix our textures
 float mixValue = 0.2f;
 
+// How hidden cubes get culled, the O key cycles through these
+enum OcclusionMode {
+    OCCLUSION_OFF,
+    OCCLUSION_QUERIES,      // GPU occlusion queries from the previous frame
+    OCCLUSION_SOFTWARE      // Depth buffer rasterized on the CPU this frame
+};
+OcclusionMode occlusionMode = OCCLUSION_QUERIES;
+
+/*
+ Resolution of the software occlusion depth buffer, and how many of the cubes that are largest
+ on the screen get drawn into it. Occluders can't be culled themselves, so only a few are picked
+ */
+const int OCCLUSION_BUFFER_WIDTH = 256;
+const int OCCLUSION_BUFFER_HEIGHT = 192;
+const size_t MAX_OCCLUDERS = 3;
+
 int main(int argc, const char * argv[]) {
     
+    // Packing images into an atlas file ahead of time instead of running the app: --build-atlas output.atlas images...
+    if (argc >= 4 && strcmp(argv[1], "--build-atlas") == 0) {
+        return buildAtlas(argv[2], argc - 3, argv + 3);
+    }
+    
+    // Timing the image decoders on synthetic images and any files given: --benchmark-images [images...]
+    if (argc >= 2 && strcmp(argv[1], "--benchmark-images") == 0) {
+        return benchmarkImages(argc - 2, argv + 2);
+    }
+    
     // Initializing and configuring GLFW
     glfwInit();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
@@ -54,210 +122,420 @@ int main(int argc, const char * argv[]) {
         return -1;
     }
     /*
-     Building and compiling our shaders
+     Starting up the job system that everything shares. The render thread takes part in
+     the work as well, so we only need workers for the remaining cores
      */
-    Shader myShader("shader.vs", "shader.fs");
+    unsigned int coreCount = std::thread::hardware_concurrency();
+    JobSystem jobSystem(coreCount > 1 ? coreCount - 1 : 0);
+    // Images are decoded on every thread of the pool, each into its own scratch memory that has to go with it
+    jobSystem.atThreadExit(stbi_scratch_release);
     
-    /*
-     Setting up vertex data, VBOs, and VAOs
-     */
-    float vertices[] = {
-        -0.5f, -0.5f, -0.5f,  0.0f, 0.0f,
-         0.5f, -0.5f, -0.5f,  1.0f, 0.0f,
-         0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
-         0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
-        -0.5f,  0.5f, -0.5f,  0.0f, 1.0f,
-        -0.5f, -0.5f, -0.5f,  0.0f, 0.0f,
+    // Everything that owns GL objects lives in here, so it's destroyed while there's still a context to release them in
+    {
+        /*
+         Streaming our textures in on the workers while we compile shaders and set up buffers. Images
+         of the same size are grouped into layers of one texture array, so ours end up sharing one.
+         Their headers are read in one parallel pass first, which is all the streamer needs to know
+         to group them
+         */
+        AssetIndex assetIndex;
+        assetIndex.scan(jobSystem, { "container.jpg", "awesomeface.png" });
+        TextureStreamer textureStreamer(jobSystem, TEXTURE_MEMORY_BUDGET, true);    // Flipping images on the y-axis
+        std::vector<TextureLayer> cubeLayers = textureStreamer.addGrouped({ "container.jpg", "awesomeface.png" }, &assetIndex);
+        const TextureLayer containerLayer = cubeLayers[0];
+        const TextureLayer faceLayer = cubeLayers[1];
+        bool cubeTexturesLoaded = containerLayer.texture >= 0 && faceLayer.texture >= 0;
+        
+        /*
+         Building and compiling our shaders
+         */
+        Shader myShader("shader.vs", "shader.fs");
+        
+        // Rebuilding our shader whenever one of its files is saved, so changes show up without a restart
+        FileWatcher shaderWatcher;
+        shaderWatcher.watch("shader.vs");
+        shaderWatcher.watch("shader.fs");
+        
+        /*
+         Setting up vertex data, VBOs, and VAOs
+         */
+        float vertices[] = {
+            -0.5f, -0.5f, -0.5f,  0.0f, 0.0f,
+             0.5f, -0.5f, -0.5f,  1.0f, 0.0f,
+             0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
+             0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
+            -0.5f,  0.5f, -0.5f,  0.0f, 1.0f,
+            -0.5f, -0.5f, -0.5f,  0.0f, 0.0f,
 
-        -0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
-         0.5f, -0.5f,  0.5f,  1.0f, 0.0f,
-         0.5f,  0.5f,  0.5f,  1.0f, 1.0f,
-         0.5f,  0.5f,  0.5f,  1.0f, 1.0f,
-        -0.5f,  0.5f,  0.5f,  0.0f, 1.0f,
-        -0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
+            -0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
+             0.5f, -0.5f,  0.5f,  1.0f, 0.0f,
+             0.5f,  0.5f,  0.5f,  1.0f, 1.0f,
+             0.5f,  0.5f,  0.5f,  1.0f, 1.0f,
+            -0.5f,  0.5f,  0.5f,  0.0f, 1.0f,
+            -0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
 
-        -0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
-        -0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
-        -0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
-        -0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
-        -0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
-        -0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
+            -0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
+            -0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
+            -0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
+            -0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
+            -0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
+            -0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
 
-         0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
-         0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
-         0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
-         0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
-         0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
-         0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
+             0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
+             0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
+             0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
+             0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
+             0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
+             0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
 
-        -0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
-         0.5f, -0.5f, -0.5f,  1.0f, 1.0f,
-         0.5f, -0.5f,  0.5f,  1.0f, 0.0f,
-         0.5f, -0.5f,  0.5f,  1.0f, 0.0f,
-        -0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
-        -0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
+            -0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
+             0.5f, -0.5f, -0.5f,  1.0f, 1.0f,
+             0.5f, -0.5f,  0.5f,  1.0f, 0.0f,
+             0.5f, -0.5f,  0.5f,  1.0f, 0.0f,
+            -0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
+            -0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
 
-        -0.5f,  0.5f, -0.5f,  0.0f, 1.0f,
-         0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
-         0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
-         0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
-        -0.5f,  0.5f,  0.5f,  0.0f, 0.0f,
-        -0.5f,  0.5f, -0.5f,  0.0f, 1.0f
-    };
-    
-    // Defining the position for 10 cubes
-    glm::vec3 cubePositions[] = {
-        glm::vec3( 0.0f,  0.0f,  0.0f),
-        glm::vec3( 2.0f,  5.0f, -15.0f),
-        glm::vec3(-1.5f, -2.2f, -2.5f),
-        glm::vec3(-3.8f, -2.0f, -12.3f),
-        glm::vec3( 2.4f, -0.4f, -3.5f),
-        glm::vec3(-1.7f,  3.0f, -7.5f),
-        glm::vec3( 1.3f, -2.0f, -2.5f),
-        glm::vec3( 1.5f,  2.0f, -2.5f),
-        glm::vec3( 1.5f,  0.2f, -1.5f),
-        glm::vec3(-1.3f,  1.0f, -1.5f)
-    };
-    
-//    float vertices[] = {
-//         // Positions        // Texture coordinates
-//         0.5f,  0.5f, 0.0f,  1.0f, 1.0f, // Top right corner
-//         0.5f, -0.5f, 0.0f,  1.0f, 0.0f, // Bottom right corner
-//        -0.5f, -0.5f, 0.0f,  0.0f, 0.0f, // Bottom left corner
-//        -0.5f,  0.5f, 0.0f,  0.0f, 1.0f  // Top left corner
-//    };
-    
-    unsigned int indices[] = {
-        0, 1, 3,    // First triangle
-        1, 2, 3     // Second triangle
-    };
-    
-    unsigned int VBO, VAO, EBO;
-    glGenVertexArrays(1, &VAO);
-    glGenBuffers(1, &VBO);
-    glGenBuffers(1, &EBO);
-    
-    // Binding the VAO, then binding and filling the VBO and enabling our attribute(s)
-    glBindVertexArray(VAO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
-    
-    // Position attribute
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * (sizeof(float)), (void*)0);
-    glEnableVertexAttribArray(0);
-    // Texture coordinate attribute
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * (sizeof(float)), (void*) (3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
-    
-    // This can be used to draw our objects in wireframe mode
-    // glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-    
-    // Generating our texture
-    unsigned int texture1, texture2;
-    glGenTextures(1, &texture1);
-    glBindTexture(GL_TEXTURE_2D, texture1);
-    // Setting the texture wrapping and filtering options for the currently bound texture object
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    // Load and generate the texture
-    int width, height, nrChannels;
-    stbi_set_flip_vertically_on_load(true); // Telling stbi_image.h to flip images on the y-axis
-    
-    unsigned char *data = stbi_load("container.jpg", &width, &height, &nrChannels, 0);
-    
-    if (data) {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-    } else {
-        std::cout << "Failed to load texture #1" << std::endl;
-    }
-    stbi_image_free(data);
-    
-    // Moving onto texture 2
-    glGenTextures(1, &texture2);
-    glBindTexture(GL_TEXTURE_2D, texture2);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    
-    data = stbi_load("awesomeface.png", &width, &height, &nrChannels, 0);
-    if (data) {
-        // Note that we need to specify a data type of GL_RGBA since the image has transparency and hence, an alpha channel
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-    } else {
-        std::cout << "Failed to load texture #2" << std::endl;
-    }
-    stbi_image_free(data);
-    
-    // We also need to inform each sampler which texture unit it belongs to
-    myShader.use();    // We need to activate/use the shader before we can set any of the uniforms
-    myShader.setInt("texture1", 0);
-    myShader.setInt("texture2", 1);
-    
-    // Enabling depth testing
-    glEnable(GL_DEPTH_TEST);
-    
-    // This is our render loop
-    while (!glfwWindowShouldClose(window)) {
-        // Handling input
-        processInput(window);
+            -0.5f,  0.5f, -0.5f,  0.0f, 1.0f,
+             0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
+             0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
+             0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
+            -0.5f,  0.5f,  0.5f,  0.0f, 0.0f,
+            -0.5f,  0.5f, -0.5f,  0.0f, 1.0f
+        };
         
-        // Actual rendering commands
-        glClearColor(0.2f, 0.3f, 0.3f, 1.0f);   // Configuring the color buffer for when the screen will be cleared
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        // Defining the position for 10 cubes
+        glm::vec3 cubePositions[] = {
+            glm::vec3( 0.0f,  0.0f,  0.0f),
+            glm::vec3( 2.0f,  5.0f, -15.0f),
+            glm::vec3(-1.5f, -2.2f, -2.5f),
+            glm::vec3(-3.8f, -2.0f, -12.3f),
+            glm::vec3( 2.4f, -0.4f, -3.5f),
+            glm::vec3(-1.7f,  3.0f, -7.5f),
+            glm::vec3( 1.3f, -2.0f, -2.5f),
+            glm::vec3( 1.5f,  2.0f, -2.5f),
+            glm::vec3( 1.5f,  0.2f, -1.5f),
+            glm::vec3(-1.3f,  1.0f, -1.5f)
+        };
         
-        // Binding the texture
-        glActiveTexture(GL_TEXTURE0);   // Making sure to activate the first texture unit
-        glBindTexture(GL_TEXTURE_2D, texture1);
-        glActiveTexture(GL_TEXTURE1);   // Likewise for the second
-        glBindTexture(GL_TEXTURE_2D, texture2);
+    //    float vertices[] = {
+    //         // Positions        // Texture coordinates
+    //         0.5f,  0.5f, 0.0f,  1.0f, 1.0f, // Top right corner
+    //         0.5f, -0.5f, 0.0f,  1.0f, 0.0f, // Bottom right corner
+    //        -0.5f, -0.5f, 0.0f,  0.0f, 0.0f, // Bottom left corner
+    //        -0.5f,  0.5f, 0.0f,  0.0f, 1.0f  // Top left corner
+    //    };
         
-        myShader.setFloat("mixSetting", mixValue);  // Set the texture mix value within the fragment shader
+        /*
+         Building the cube's levels of detail. Their vertices go into the VBO right after the 36
+         original ones, which are still drawn as they are for bounding boxes and occluders
+         */
+        LodChain cubeLods;
+        cubeLods.build(vertices, 36, 5, MAX_LOD_LEVELS, LOD_MAX_ERROR, LOD_DETAIL_SIZE);
+        std::vector<float> vertexData(vertices, vertices + sizeof(vertices) / sizeof(float));
+        vertexData.insert(vertexData.end(), cubeLods.vertices.begin(), cubeLods.vertices.end());
+        std::vector<unsigned int> indices(cubeLods.indices.begin(), cubeLods.indices.end());
+        for (size_t i = 0; i < indices.size(); i++) {
+            indices[i] += 36;
+        }
         
-        // Render the container
-        myShader.use();
+        unsigned int VBO, VAO, EBO;
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &VBO);
+        glGenBuffers(1, &EBO);
         
-        // Setting up our model, view, and projection matrices
-        glm::mat4 view = glm::mat4(1.0f);
-        view = glm::translate(view, glm::vec3(0.0f, 0.0f, -3.0f));
-        glm::mat4 projection = glm::mat4(1.0f);
-        projection = glm::perspective(glm::radians(45.0f), (float) (SCREEN_WIDTH / SCREEN_HEIGHT), 0.1f, 100.0f);
+        // Binding the VAO, then binding and filling the VBO and enabling our attribute(s)
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, vertexData.size() * sizeof(float), &vertexData[0], GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
         
-        myShader.setMat4("view", view);
-        myShader.setMat4("projection", projection);
+        // Position attribute
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * (sizeof(float)), (void*)0);
+        glEnableVertexAttribArray(0);
+        // Texture coordinate attribute
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * (sizeof(float)), (void*) (3 * sizeof(float)));
+        glEnableVertexAttribArray(1);
         
-        glBindVertexArray(VAO);
-        for (unsigned int i = 0; i < 10; i++) {
-            glm::mat4 model = glm::mat4(1.0f);
-            model = glm::translate(model, cubePositions[i]);
-            float angle = 20.0f * i;
-            if (i % 3 == 0) {
-                angle = glfwGetTime() * 25.0f;
-            }
-            model = glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.3f, 0.5f));
-            myShader.setMat4("model", model);
-            glDrawArrays(GL_TRIANGLES, 0, 36);    // Actually drawing the triangles
+        // This can be used to draw our objects in wireframe mode
+        // glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+        
+        // Only the small mip levels are loaded at first, waiting for them so the first frame has something to show
+        textureStreamer.finishLoading();
+        unsigned int containerArray = 0, faceArray = 0;
+        if (cubeTexturesLoaded) {
+            containerArray = textureStreamer.texture(containerLayer.texture);
+            faceArray = textureStreamer.texture(faceLayer.texture);
+        } else {
+            std::cout << "Failed to load textures" << std::endl;
+        }
+        
+        /*
+         Every layer of an array shares the array's parameters, so the wrapping and filtering
+         options live in sampler objects on each texture unit instead
+         */
+        unsigned int samplers[2];
+        glGenSamplers(2, samplers);
+        glSamplerParameteri(samplers[0], GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glSamplerParameteri(samplers[0], GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glSamplerParameteri(samplers[0], GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glSamplerParameteri(samplers[0], GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glSamplerParameteri(samplers[1], GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glSamplerParameteri(samplers[1], GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glSamplerParameteri(samplers[1], GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glSamplerParameteri(samplers[1], GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glBindSampler(0, samplers[0]);
+        glBindSampler(1, samplers[1]);
+        
+        // We also need to inform each sampler which texture unit it belongs to, again for every program a reload swaps in
+        auto setTextureUnits = [&]() {
+            myShader.use();    // We need to activate/use the shader before we can set any of the uniforms
+            myShader.setInt("texture1", 0);
+            myShader.setInt("texture2", 1);
+            myShader.setInt("modelMatrices", 2);    // The instance buffer sits on the unit after our textures
+            myShader.setInt("textureLayers", 3);
+        };
+        setTextureUnits();
+        
+        // Enabling depth testing
+        glEnable(GL_DEPTH_TEST);
+        
+        // All of the cubes share the same program, textures, and VAO so we only need to register them once
+        RenderQueue renderQueue;
+        
+        // Moving our cubes into the scene graph, every cube is a root and spins around the same axis
+        SceneGraph scene;
+        size_t cubeCount = sizeof(cubePositions) / sizeof(cubePositions[0]);
+        for (unsigned int i = 0; i < cubeCount; i++) {
+            scene.addNode(SceneGraph::NO_PARENT, cubePositions[i], glm::vec3(1.0f, 0.3f, 0.5f), glm::radians(20.0f * i));
+        }
+        InstanceBuffer instanceBuffer;
+        TextureLayerBuffer textureLayers;
+        for (size_t i = 0; i < cubeCount; i++) {
+            textureLayers.set(i, containerLayer.layer, faceLayer.layer);
         }
         
-        // glDrawArrays(GL_TRIANGLES, 0, 36);    // Actually drawing the triangles
-        // glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+        // Building the BVH around where the cubes start out, afterwards it only gets refitted when they move
+        scene.update(jobSystem);
+        std::vector<AABB> cubeBounds(cubeCount);
+        std::vector<uint32_t> boundsVersions(cubeCount);
+        for (size_t i = 0; i < cubeCount; i++) {
+            cubeBounds[i] = AABB::transformed(scene.model(i), CUBE_BOUNDS);
+            boundsVersions[i] = scene.worldVersion(i);
+        }
+        BVH bvh;
+        bvh.build(cubeBounds);
+        std::vector<uint8_t> visible(cubeCount);
+        OcclusionCuller occlusionCuller("occlusion.vs", "occlusion.fs");
+        occlusionCuller.resize(cubeCount);
+        SoftwareOcclusion softwareOcclusion(OCCLUSION_BUFFER_WIDTH, OCCLUSION_BUFFER_HEIGHT);
+        std::vector<Occluder> occluders;
+        std::vector<std::pair<float, uint32_t>> occluderCandidates;
+        std::vector<uint8_t> isOccluder(cubeCount);     // The cube is in the software depth buffer this frame
+        std::vector<size_t> cubeLevels(cubeCount, 0);     // The level of detail each cube was drawn with last frame
+        std::vector<float> cubeScreenSizes(cubeCount, 0.0f);
+        bool mouseWasDown = false;
+        unsigned int programSlot = renderQueue.programSlot(myShader.ID);
+        unsigned int textureSet = renderQueue.textureSet(containerArray, faceArray, GL_TEXTURE_2D_ARRAY);
+        unsigned int vaoSlot = renderQueue.vaoSlot(VAO);
         
-        // Checks and calls I/O events; swap buffers
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        // This is our render loop
+        while (!glfwWindowShouldClose(window)) {
+            // Handling input
+            processInput(window);
+            
+            // The old program keeps drawing until the reloaded one has linked, and for good if it doesn't compile
+            if (!shaderWatcher.poll().empty()) {
+                myShader.reload();
+            }
+            unsigned int previousProgram = myShader.ID;
+            if (myShader.update()) {
+                setTextureUnits();
+                renderQueue.replaceProgram(previousProgram, myShader.ID);
+            }
+            
+            // Actual rendering commands
+            glClearColor(0.2f, 0.3f, 0.3f, 1.0f);   // Configuring the color buffer for when the screen will be cleared
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            
+            // Render the container
+            myShader.use();
+            myShader.setFloat("mixSetting", mixValue);  // Set the texture mix value within the fragment shader
+            
+            // Setting up our view and projection matrices
+            glm::mat4 view = glm::mat4(1.0f);
+            view = glm::translate(view, glm::vec3(0.0f, 0.0f, -3.0f));
+            glm::mat4 projection = glm::mat4(1.0f);
+            projection = glm::perspective(glm::radians(45.0f), (float) (SCREEN_WIDTH / SCREEN_HEIGHT), NEAR_PLANE, FAR_PLANE);
+            
+            myShader.setMat4("view", view);
+            myShader.setMat4("projection", projection);
+            
+            // Only every third cube is animated, the rest keep their matrices from the previous frame
+            float angle = glm::radians((float) glfwGetTime() * 25.0f);
+            for (size_t i = 0; i < cubeCount; i += 3) {
+                scene.locals.setAngle(i, angle);
+            }
+            
+            // Rebuilding the world matrices of everything that moved
+            scene.update(jobSystem);
+            
+            // Refitting the BVH around the cubes that moved
+            bool moved = false;
+            for (size_t i = 0; i < cubeCount; i++) {
+                if (scene.worldVersion(i) != boundsVersions[i]) {
+                    cubeBounds[i] = AABB::transformed(scene.model(i), CUBE_BOUNDS);
+                    bvh.setBox((uint32_t) i, cubeBounds[i]);
+                    boundsVersions[i] = scene.worldVersion(i);
+                    moved = true;
+                }
+            }
+            if (moved) {
+                bvh.refit();
+            }
+            
+            // Picking the cube under the cursor when the left mouse button goes down
+            bool mouseDown = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS;
+            if (mouseDown && !mouseWasDown) {
+                double cursorX, cursorY;
+                int windowWidth, windowHeight;
+                glfwGetCursorPos(window, &cursorX, &cursorY);
+                glfwGetWindowSize(window, &windowWidth, &windowHeight);
+                
+                // Unprojecting the cursor onto the near and far planes gives us the ray
+                glm::mat4 inverseViewProjection = glm::inverse(projection * view);
+                float ndcX = 2.0f * (float) cursorX / windowWidth - 1.0f;
+                float ndcY = 1.0f - 2.0f * (float) cursorY / windowHeight;
+                glm::vec4 nearPoint = inverseViewProjection * glm::vec4(ndcX, ndcY, -1.0f, 1.0f);
+                glm::vec4 farPoint = inverseViewProjection * glm::vec4(ndcX, ndcY, 1.0f, 1.0f);
+                glm::vec3 origin = glm::vec3(nearPoint) / nearPoint.w;
+                glm::vec3 direction = glm::normalize(glm::vec3(farPoint) / farPoint.w - origin);
+                
+                float distance;
+                int picked = bvh.raycast(origin, direction, distance);
+                if (picked >= 0) {
+                    std::cout << "Picked cube #" << picked << std::endl;
+                }
+            }
+            mouseWasDown = mouseDown;
+            
+            // Finding the cubes in view with the BVH instead of testing each one
+            glm::mat4 viewProjection = projection * view;
+            Frustum frustum(viewProjection);
+            std::fill(visible.begin(), visible.end(), 0);
+            bvh.queryFrustum(frustum, [&](uint32_t cube) {
+                visible[cube] = 1;
+            });
+            
+            // Finding out which cubes were hidden according to last frame's occlusion queries
+            if (occlusionMode == OCCLUSION_QUERIES) {
+                occlusionCuller.collectResults();
+            }
+            
+            // Or rasterizing the visible cubes that are largest on the screen on the CPU, which are the most likely to hide the rest
+            if (occlusionMode == OCCLUSION_SOFTWARE) {
+                occluderCandidates.clear();
+                for (size_t i = 0; i < cubeCount; i++) {
+                    if (visible[i]) {
+                        // Sorting on the negated radius over depth puts the largest on the screen first
+                        float depth = -(view * scene.model(i)[3]).z;
+                        float radius = 0.5f * glm::length(cubeBounds[i].maximum - cubeBounds[i].minimum);
+                        occluderCandidates.push_back(std::make_pair(-radius / std::max(depth, NEAR_PLANE), (uint32_t) i));
+                    }
+                }
+                if (occluderCandidates.size() > MAX_OCCLUDERS) {
+                    std::nth_element(occluderCandidates.begin(), occluderCandidates.begin() + MAX_OCCLUDERS, occluderCandidates.end());
+                    occluderCandidates.resize(MAX_OCCLUDERS);
+                }
+                occluders.resize(occluderCandidates.size());
+                std::fill(isOccluder.begin(), isOccluder.end(), 0);
+                for (size_t i = 0; i < occluders.size(); i++) {
+                    occluders[i].positions = vertices;
+                    occluders[i].stride = 5;
+                    occluders[i].vertexCount = 36;
+                    occluders[i].model = scene.model(occluderCandidates[i].second);
+                    isOccluder[occluderCandidates[i].second] = 1;
+                }
+                softwareOcclusion.render(jobSystem, occluders, viewProjection);
+            }
+            
+            // Recording a draw for every cube across all of our threads. Each range only writes into its
+            // own slots of the render queue, so the render thread just has to sort and submit afterwards
+            renderQueue.resize(cubeCount);
+            jobSystem.parallelFor(cubeCount, RECORD_BATCH_SIZE, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++) {
+                    OcclusionCuller::Visibility visibility = occlusionMode == OCCLUSION_QUERIES ? occlusionCuller.visibilityOf(i) : OcclusionCuller::VISIBILITY_UNKNOWN;
+                    // An occluder is never tested against the depth buffer, which already holds it and could hide it behind itself
+                    bool hidden = !visible[i] || visibility == OcclusionCuller::VISIBILITY_OCCLUDED ||
+                                  (occlusionMode == OCCLUSION_SOFTWARE && !isOccluder[i] &&
+                                   !softwareOcclusion.isVisible(cubeBounds[i], viewProjection));
+                    if (hidden) {
+                        renderQueue.recordCulled(i);
+                        cubeScreenSizes[i] = 0.0f;
+                        continue;
+                    }
+                    
+                    DrawCommand command;
+                    command.program = myShader.ID;
+                    command.textureSet = textureSet;
+                    command.VAO = VAO;
+                    command.instance = (unsigned int) i;
+                    command.query = visibility == OcclusionCuller::VISIBILITY_PENDING ? occlusionCuller.query(i) : 0;
+                    
+                    // The view-space depth of the cube's center is used to order draws front-to-back
+                    float depth = -(view * scene.model(i)[3]).z;
+                    
+                    // Picking the level of detail from how many pixels across the cube's bounding sphere appears
+                    float radius = 0.5f * glm::length(cubeBounds[i].maximum - cubeBounds[i].minimum);
+                    float screenSize = radius * projection[1][1] * SCREEN_HEIGHT / std::max(depth, NEAR_PLANE);
+                    cubeLevels[i] = cubeLods.selectLevel(cubeLevels[i], screenSize);
+                    cubeScreenSizes[i] = screenSize;
+                    const LodLevel &level = cubeLods.levels[cubeLevels[i]];
+                    command.indexed = true;
+                    command.first = (GLint) level.firstIndex;
+                    command.count = (GLsizei) level.indexCount;
+                    renderQueue.record(i, makeSortKey(PASS_OPAQUE, programSlot, textureSet, vaoSlot, depth, NEAR_PLANE, FAR_PLANE), command);
+                }
+            });
+            
+            // Only the matrices that were rebuilt this frame get uploaded
+            instanceBuffer.update(scene);
+            instanceBuffer.bind(2);
+            textureLayers.update();
+            textureLayers.bind(3);
+            
+            // The largest cube on the screen decides how much of our textures' detail has to be loaded
+            if (cubeTexturesLoaded) {
+                float largestCube = *std::max_element(cubeScreenSizes.begin(), cubeScreenSizes.end());
+                textureStreamer.request(containerLayer.texture, largestCube);
+                textureStreamer.request(faceLayer.texture, largestCube);
+            }
+            textureStreamer.update();
+            
+            renderQueue.sort();
+            renderQueue.submit();
+            
+            // Testing the bounds of everything in the frustum against what we just drew, for use next frame
+            if (occlusionMode == OCCLUSION_QUERIES) {
+                glm::vec3 cameraPosition = glm::vec3(glm::inverse(view)[3]);
+                occlusionCuller.issueQueries(cubeBounds, visible, viewProjection, cameraPosition, VAO);
+            }
+            
+            // glDrawArrays(GL_TRIANGLES, 0, 36);    // Actually drawing the triangles
+            // glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+            
+            // Checks and calls I/O events; swap buffers
+            glfwSwapBuffers(window);
+            glfwPollEvents();
+        }
+        
+        // De-allocating all resources once they've outlived their purpose
+        glDeleteVertexArrays(1, &VAO);
+        glDeleteBuffers(1, &VBO);
+        glDeleteBuffers(1, &EBO);
+        glDeleteSamplers(2, samplers);
     }
     
-    // De-allocating all resources once they've outlived their purpose
-    glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &VBO);
-    glDeleteBuffers(1, &EBO);
-    
     glfwTerminate();
     return 0;
 }
@@ -285,4 +563,57 @@ void processInput(GLFWwindow *window) {
             mixValue = 0.0f;
         }
     }
+    
+    // Only toggling once per key press, not on every frame the key is held down
+    static bool occlusionKeyWasDown = false;
+    bool occlusionKeyDown = glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS;
+    if (occlusionKeyDown && !occlusionKeyWasDown) {
+        const char *modeNames[] = { "off", "occlusion queries", "software rasterizer" };
+        occlusionMode = (OcclusionMode) ((occlusionMode + 1) % 3);
+        std::cout << "Occlusion culling: " << modeNames[occlusionMode] << std::endl;
+    }
+    occlusionKeyWasDown = occlusionKeyDown;
+}
+
+// Packs the given images into a texture atlas and writes it out, so the app can load it without packing anything
+int buildAtlas(const char *outputPath, int imageCount, const char * const *imagePaths) {
+    stbi_load_options options;
+    stbi_load_options_default(&options);
+    options.flip_vertically = 1;    // Matching how the app loads its textures
+    TextureAtlas atlas;
+    for (int i = 0; i < imageCount; i++) {
+        int width, height, channels;
+        unsigned char *data = stbi_load_with_options(imagePaths[i], &width, &height, &channels, 0, &options);
+        if (!data) {
+            std::cout << "Failed to load " << imagePaths[i] << ": " << stbi_failure_reason() << std::endl;
+            return -1;
+        }
+        int region = atlas.add(width, height, channels, data);
+        stbi_image_free(data);
+        if (region < 0) {
+            std::cout << imagePaths[i] << " is too large for an atlas page" << std::endl;
+            return -1;
+        }
+        const AtlasRegion &packed = atlas.region(region);
+        std::cout << imagePaths[i] << ": page " << packed.page << " at " << packed.x << ", " << packed.y << std::endl;
+    }
+    if (!atlas.save(outputPath)) {
+        std::cout << "Failed to write " << outputPath << std::endl;
+        return -1;
+    }
+    std::cout << "Packed " << imageCount << " images into " << atlas.pageCount() << " pages" << std::endl;
+    return 0;
+}
+
+int benchmarkImages(int imageCount, const char * const *imagePaths) {
+    ImageBenchmark benchmark;
+    benchmark.addSynthetic();
+    for (int i = 0; i < imageCount; i++) {
+        if (!benchmark.addFile(imagePaths[i])) {
+            std::cout << "Failed to load " << imagePaths[i] << std::endl;
+            return -1;
+        }
+    }
+    benchmark.run();
+    return 0;
 }
@@ -0,0 +1,283 @@
+#ifndef MESHSIMPLIFIER_H
+#define MESHSIMPLIFIER_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/*
+ Simplifies an indexed triangle mesh by collapsing edges, following Garland and Heckbert's
+ quadric error metric. Every vertex collects the planes of the triangles around it as a
+ quadric, which measures the squared distance of a point to all of those planes at once.
+ Collapsing the edge u -> v costs the combined quadric of u and v evaluated at v, so edges
+ on flat regions are free to collapse while the ones that shape the mesh are kept.
+
+ Vertices are only ever moved onto one of their neighbours, never to a new position, so
+ their texture coordinates and other attributes stay valid and the simplified mesh can keep
+ using the original vertex buffer.
+
+ Edges that belong to a single triangle (the border of the mesh, or a seam where texture
+ coordinates are split) get an extra quadric for the plane standing upright on the edge.
+ That keeps border vertices on their border, so a seam only collapses along itself.
+ */
+class MeshSimplifier {
+
+public:
+    // The positions of the vertices the indices refer to
+    MeshSimplifier(const std::vector<glm::vec3> &positions) : positions(positions) {
+    }
+
+    /*
+     Returns a simplified copy of the triangle list with at most targetIndexCount indices,
+     unless getting there would move the surface further than maxError. In that case it
+     stops early. The largest error of any collapse is written to resultError if it is given.
+     */
+    std::vector<uint32_t> simplify(const std::vector<uint32_t> &indices, size_t targetIndexCount, float maxError,
+                                   float *resultError = NULL) const {
+        std::vector<uint32_t> result = indices;
+        std::vector<Quadric> quadrics(positions.size());
+        computeQuadrics(result, quadrics);
+
+        float maxErrorSquared = maxError * maxError;
+        float largestError = 0.0f;
+
+        // Every pass collapses as many independent edges as it can, cheapest first
+        while (result.size() > targetIndexCount) {
+            std::vector<Collapse> collapses;
+            findCollapses(result, quadrics, collapses);
+            std::sort(collapses.begin(), collapses.end());
+
+            std::vector<uint32_t> adjacencyOffsets, adjacency;
+            buildAdjacency(result, adjacencyOffsets, adjacency);
+
+            std::vector<uint32_t> remap(positions.size());
+            for (uint32_t i = 0; i < remap.size(); i++) {
+                remap[i] = i;
+            }
+            std::vector<uint8_t> locked(positions.size(), 0);
+            size_t triangleCount = result.size() / 3;
+            size_t collapsed = 0;
+
+            for (size_t c = 0; c < collapses.size(); c++) {
+                const Collapse &collapse = collapses[c];
+                if (collapse.cost > maxErrorSquared || triangleCount * 3 <= targetIndexCount) {
+                    break;
+                }
+                if (locked[collapse.from] || locked[collapse.to] ||
+                    flipsTriangles(result, adjacencyOffsets, adjacency, collapse.from, collapse.to)) {
+                    continue;
+                }
+
+                remap[collapse.from] = collapse.to;
+                quadrics[collapse.to].add(quadrics[collapse.from]);
+                largestError = std::max(largestError, collapse.cost);
+                collapsed++;
+
+                // The triangles around the collapsed vertex changed, so none of their vertices can move again this pass
+                for (uint32_t a = adjacencyOffsets[collapse.from]; a < adjacencyOffsets[collapse.from + 1]; a++) {
+                    uint32_t triangle = adjacency[a];
+                    bool degenerate = false;
+                    for (int k = 0; k < 3; k++) {
+                        locked[result[triangle * 3 + k]] = 1;
+                        degenerate = degenerate || result[triangle * 3 + k] == collapse.to;
+                    }
+                    if (degenerate) {
+                        triangleCount--;
+                    }
+                }
+            }
+            if (collapsed == 0) {
+                break;
+            }
+
+            // Applying the collapses and dropping the triangles that lost an edge
+            size_t write = 0;
+            for (size_t i = 0; i < result.size(); i += 3) {
+                uint32_t a = remap[result[i]], b = remap[result[i + 1]], c = remap[result[i + 2]];
+                if (a != b && b != c && a != c) {
+                    result[write++] = a;
+                    result[write++] = b;
+                    result[write++] = c;
+                }
+            }
+            result.resize(write);
+        }
+
+        if (resultError) {
+            *resultError = std::sqrt(largestError);
+        }
+        return result;
+    }
+
+private:
+    // How much more a border plane counts than a triangle plane of the same size
+    static constexpr float BORDER_WEIGHT = 10.0f;
+
+    // Symmetric 4x4 matrix, along with the total weight so the error comes out as a mean squared distance
+    struct Quadric {
+        double a00, a01, a02, a03, a11, a12, a13, a22, a23, a33;
+        double weight;
+
+        Quadric() : a00(0), a01(0), a02(0), a03(0), a11(0), a12(0), a13(0), a22(0), a23(0), a33(0), weight(0) {
+        }
+
+        // The plane n.p + d = 0, with n normalized
+        void addPlane(const glm::vec3 &normal, float d, float planeWeight) {
+            double a = normal.x, b = normal.y, c = normal.z;
+            a00 += planeWeight * a * a; a01 += planeWeight * a * b; a02 += planeWeight * a * c; a03 += planeWeight * a * d;
+            a11 += planeWeight * b * b; a12 += planeWeight * b * c; a13 += planeWeight * b * d;
+            a22 += planeWeight * c * c; a23 += planeWeight * c * d;
+            a33 += planeWeight * (double) d * d;
+            weight += planeWeight;
+        }
+
+        void add(const Quadric &other) {
+            a00 += other.a00; a01 += other.a01; a02 += other.a02; a03 += other.a03;
+            a11 += other.a11; a12 += other.a12; a13 += other.a13;
+            a22 += other.a22; a23 += other.a23;
+            a33 += other.a33;
+            weight += other.weight;
+        }
+
+        double error(const glm::vec3 &p) const {
+            double x = p.x, y = p.y, z = p.z;
+            double result = a00 * x * x + 2 * a01 * x * y + 2 * a02 * x * z + 2 * a03 * x +
+                            a11 * y * y + 2 * a12 * y * z + 2 * a13 * y +
+                            a22 * z * z + 2 * a23 * z + a33;
+            return weight > 0 ? std::fabs(result) / weight : 0.0;
+        }
+    };
+
+    struct Collapse {
+        float cost;
+        uint32_t from, to;
+
+        bool operator<(const Collapse &other) const {
+            return cost < other.cost;
+        }
+    };
+
+    std::vector<glm::vec3> positions;
+
+    void computeQuadrics(const std::vector<uint32_t> &indices, std::vector<Quadric> &quadrics) const {
+        std::vector<uint64_t> edges;
+        for (size_t i = 0; i < indices.size(); i += 3) {
+            const glm::vec3 &p0 = positions[indices[i]];
+            glm::vec3 normal = glm::cross(positions[indices[i + 1]] - p0, positions[indices[i + 2]] - p0);
+            float doubleArea = glm::length(normal);
+            if (doubleArea <= 0.0f) {
+                continue;
+            }
+            normal = normal / doubleArea;
+            for (int k = 0; k < 3; k++) {
+                quadrics[indices[i + k]].addPlane(normal, -glm::dot(normal, p0), doubleArea * 0.5f);
+                edges.push_back(edgeKey(indices[i + k], indices[i + (k + 1) % 3]));
+            }
+        }
+
+        // Edges that only show up once are on a border
+        std::sort(edges.begin(), edges.end());
+        for (size_t i = 0; i < indices.size(); i += 3) {
+            const glm::vec3 &p0 = positions[indices[i]];
+            glm::vec3 faceNormal = glm::cross(positions[indices[i + 1]] - p0, positions[indices[i + 2]] - p0);
+            if (glm::length(faceNormal) <= 0.0f) {
+                continue;
+            }
+            for (int k = 0; k < 3; k++) {
+                uint32_t a = indices[i + k], b = indices[i + (k + 1) % 3];
+                std::pair<std::vector<uint64_t>::iterator, std::vector<uint64_t>::iterator> range =
+                    std::equal_range(edges.begin(), edges.end(), edgeKey(a, b));
+                if (range.second - range.first != 1) {
+                    continue;
+                }
+                glm::vec3 edge = positions[b] - positions[a];
+                float length = glm::length(edge);
+                if (length <= 0.0f) {
+                    continue;
+                }
+                glm::vec3 borderNormal = glm::normalize(glm::cross(edge, faceNormal));
+                float d = -glm::dot(borderNormal, positions[a]);
+                quadrics[a].addPlane(borderNormal, d, length * length * BORDER_WEIGHT);
+                quadrics[b].addPlane(borderNormal, d, length * length * BORDER_WEIGHT);
+            }
+        }
+    }
+
+    void findCollapses(const std::vector<uint32_t> &indices, const std::vector<Quadric> &quadrics,
+                       std::vector<Collapse> &collapses) const {
+        std::vector<uint64_t> edges;
+        edges.reserve(indices.size());
+        for (size_t i = 0; i < indices.size(); i += 3) {
+            for (int k = 0; k < 3; k++) {
+                edges.push_back(edgeKey(indices[i + k], indices[i + (k + 1) % 3]));
+            }
+        }
+        std::sort(edges.begin(), edges.end());
+        edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+        collapses.reserve(edges.size());
+        for (size_t i = 0; i < edges.size(); i++) {
+            uint32_t a = (uint32_t) (edges[i] >> 32), b = (uint32_t) edges[i];
+            Quadric combined = quadrics[a];
+            combined.add(quadrics[b]);
+
+            // Collapsing in whichever direction moves the surface the least
+            Collapse collapse;
+            float toB = (float) combined.error(positions[b]);
+            float toA = (float) combined.error(positions[a]);
+            collapse.cost = toB <= toA ? toB : toA;
+            collapse.from = toB <= toA ? a : b;
+            collapse.to = toB <= toA ? b : a;
+            collapses.push_back(collapse);
+        }
+    }
+
+    // The triangles around each vertex, stored as one list with an offset per vertex
+    void buildAdjacency(const std::vector<uint32_t> &indices, std::vector<uint32_t> &offsets,
+                        std::vector<uint32_t> &adjacency) const {
+        offsets.assign(positions.size() + 1, 0);
+        for (size_t i = 0; i < indices.size(); i++) {
+            offsets[indices[i] + 1]++;
+        }
+        for (size_t i = 0; i < positions.size(); i++) {
+            offsets[i + 1] += offsets[i];
+        }
+        adjacency.resize(indices.size());
+        std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < indices.size(); i++) {
+            adjacency[fill[indices[i]]++] = (uint32_t) (i / 3);
+        }
+    }
+
+    // Whether moving from onto to would turn any of the surviving triangles around from upside down
+    bool flipsTriangles(const std::vector<uint32_t> &indices, const std::vector<uint32_t> &offsets,
+                        const std::vector<uint32_t> &adjacency, uint32_t from, uint32_t to) const {
+        for (uint32_t a = offsets[from]; a < offsets[from + 1]; a++) {
+            const uint32_t *triangle = &indices[adjacency[a] * 3];
+            if (triangle[0] == to || triangle[1] == to || triangle[2] == to) {
+                continue;
+            }
+            glm::vec3 before[3], after[3];
+            for (int k = 0; k < 3; k++) {
+                before[k] = positions[triangle[k]];
+                after[k] = triangle[k] == from ? positions[to] : before[k];
+            }
+            glm::vec3 oldNormal = glm::cross(before[1] - before[0], before[2] - before[0]);
+            glm::vec3 newNormal = glm::cross(after[1] - after[0], after[2] - after[0]);
+            if (glm::dot(oldNormal, newNormal) <= 0.0f) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static uint64_t edgeKey(uint32_t a, uint32_t b) {
+        return a < b ? ((uint64_t) a << 32) | b : ((uint64_t) b << 32) | a;
+    }
+};
+
+#endif
@@ -2,22 +2,121 @@
 #define MYSHADER_H
 
 #include <glad/glad.h>
+#include <cstring>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+/*
+ A vertex and fragment shader program that can be rebuilt from its files while it's in use.
+ reload() starts compiling the new sources and update() swaps the new program in once it has
+ linked, so the old one keeps drawing in the meantime, and keeps drawing for good if the new
+ sources don't compile. With KHR_parallel_shader_compile the driver compiles on its own
+ threads and update() only swaps once it's done, so saving a shader doesn't stall a frame.
+ */
 class Shader {
     
 public:
-    // The ID of our shader program
+    // The ID of our shader program, which changes whenever a reload is swapped in
     unsigned int ID;
     
     // The default constructor reads and builds the shader program
-    Shader(const char* vertexPath, const char* fragmentPath) {
-        // Retrieving the vertex/fragment source code from the file path
+    Shader(const char* vertexPath, const char* fragmentPath) : ID(0), vertexPath(vertexPath), fragmentPath(fragmentPath) {
+        parallelCompile = hasExtension("GL_KHR_parallel_shader_compile") || hasExtension("GL_ARB_parallel_shader_compile");
+        
+        // Building the first program has to finish right away, there's nothing to draw with until then
+        std::string vertexCode;
+        std::string fragmentCode;
+        readSources(vertexCode, fragmentCode);
+        startBuild(vertexCode, fragmentCode);
+        finishBuild();
+        ID = pending.program;
+        pending = Build();
+    }
+    
+    ~Shader() {
+        discardPending();
+        glDeleteProgram(ID);
+    }
+    
+    Shader(const Shader&) = delete;
+    Shader& operator=(const Shader&) = delete;
+    
+    // Starts rebuilding the program from its files, replacing a rebuild that's still in progress
+    void reload() {
         std::string vertexCode;
         std::string fragmentCode;
+        if (!readSources(vertexCode, fragmentCode)) {
+            return;
+        }
+        discardPending();
+        startBuild(vertexCode, fragmentCode);
+    }
+    
+    // Swaps in the program from the last reload once it has linked, returns true if ID changed
+    bool update() {
+        if (!pending.program) {
+            return false;
+        }
+        if (parallelCompile) {
+            int completed = 0;
+            glGetProgramiv(pending.program, GL_COMPLETION_STATUS_KHR, &completed);
+            if (!completed) {
+                return false;
+            }
+        }
+        if (!finishBuild()) {
+            std::cout << "ERROR::SHADER::RELOAD_FAILED, keeping the previous program" << std::endl;
+            discardPending();
+            return false;
+        }
+        // GL holds on to the old program until it's no longer in use
+        glDeleteProgram(ID);
+        ID = pending.program;
+        pending = Build();
+        return true;
+    }
+    
+    // Activate the shader program
+    void use() {
+        glUseProgram(ID);
+    }
+    // Additional utility functions
+    void setBool(const std::string &name, bool value) const {
+        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+    }
+
+    void setInt(const std::string &name, int value) const {
+        glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+    }
+
+    void setFloat(const std::string &name, float value) const {
+        glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+    }
+    void setMat4(const std::string &name, glm::mat4 value) const {
+        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, glm::value_ptr(value));
+    }
+    
+private:
+    // A program that's being compiled and linked, the shaders are kept around for their logs
+    struct Build {
+        unsigned int vertex, fragment, program;
+        Build() : vertex(0), fragment(0), program(0) {
+        }
+    };
+    
+    std::string vertexPath;
+    std::string fragmentPath;
+    Build pending;
+    bool parallelCompile;
+    
+    // Retrieving the vertex/fragment source code from the file path, returns false if either couldn't be read
+    bool readSources(std::string &vertexCode, std::string &fragmentCode) {
         std::ifstream vertexShaderFile;
         std::ifstream fragmentShaderFile;
         
@@ -41,55 +140,61 @@ public:
             fragmentCode = fragmentShaderStream.str();
         } catch (std::ifstream::failure e) {
             std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ" << std::endl;
+            return false;
         }
-        
+        return true;
+    }
+    
+    // Queues up compiling and linking without asking for any results, which is what lets the driver do it in the background
+    void startBuild(const std::string &vertexCode, const std::string &fragmentCode) {
         const char* vShaderCode = vertexCode.c_str();
         const char* fShaderCode = fragmentCode.c_str();
         
-        // Compiling the shaders
-        unsigned int vertex, fragment;
-        
-        vertex = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertex, 1, &vShaderCode, NULL);
-        glCompileShader(vertex);
-        checkCompileErrors(vertex, "VERTEX");
+        pending.vertex = glCreateShader(GL_VERTEX_SHADER);
+        glShaderSource(pending.vertex, 1, &vShaderCode, NULL);
+        glCompileShader(pending.vertex);
         // fragment shader
-        fragment = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragment, 1, &fShaderCode, NULL);
-        glCompileShader(fragment);
-        checkCompileErrors(fragment, "FRAGMENT");
+        pending.fragment = glCreateShader(GL_FRAGMENT_SHADER);
+        glShaderSource(pending.fragment, 1, &fShaderCode, NULL);
+        glCompileShader(pending.fragment);
         // shader program
-        ID = glCreateProgram();
-        glAttachShader(ID, vertex);
-        glAttachShader(ID, fragment);
-        glLinkProgram(ID);
-        checkCompileErrors(ID, "PROGRAM");
-        // delete the shaders as they're linked into our program now and no longer necessary
-        glDeleteShader(vertex);
-        glDeleteShader(fragment);
+        pending.program = glCreateProgram();
+        glAttachShader(pending.program, pending.vertex);
+        glAttachShader(pending.program, pending.fragment);
+        glLinkProgram(pending.program);
     }
-    // Activate the shader program
-    void use() {
-        glUseProgram(ID);
-    }
-    // Additional utility functions
-    void setBool(const std::string &name, bool value) const {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
-    }
-
-    void setInt(const std::string &name, int value) const {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+    
+    // Reports the errors of the pending build and deletes its shaders, returns true if the program linked
+    bool finishBuild() {
+        bool compiled = checkCompileErrors(pending.vertex, "VERTEX");
+        compiled = checkCompileErrors(pending.fragment, "FRAGMENT") && compiled;
+        bool linked = compiled && checkCompileErrors(pending.program, "PROGRAM");
+        // delete the shaders as they're linked into our program now and no longer necessary
+        glDeleteShader(pending.vertex);
+        glDeleteShader(pending.fragment);
+        pending.vertex = pending.fragment = 0;
+        return linked;
     }
-
-    void setFloat(const std::string &name, float value) const {
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+    
+    void discardPending() {
+        glDeleteShader(pending.vertex);
+        glDeleteShader(pending.fragment);
+        glDeleteProgram(pending.program);
+        pending = Build();
     }
-    void setMat4(const std::string &name, glm::mat4 value) const {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, glm::value_ptr(value));
+    
+    static bool hasExtension(const char* name) {
+        int count = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        for (int i = 0; i < count; i++) {
+            if (strcmp((const char*) glGetStringi(GL_EXTENSIONS, i), name) == 0) {
+                return true;
+            }
+        }
+        return false;
     }
     
-private:
-    void checkCompileErrors(unsigned int shader, std::string type) {
+    bool checkCompileErrors(unsigned int shader, std::string type) {
         int success;
         char infoLog[1024];
         if (type != "PROGRAM") {
@@ -106,6 +211,7 @@ private:
                 std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
             }
         }
+        return success != 0;
     }
     
 };
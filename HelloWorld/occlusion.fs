@@ -0,0 +1,8 @@
+#version 330 core
+out vec4 FragColor;
+
+// Only the depth test matters for the occlusion queries, color writes are masked off
+void main()
+{
+    FragColor = vec4(1.0);
+}
@@ -0,0 +1,14 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+
+uniform mat4 viewProjection;
+
+// The world-space bounding box the unit cube gets stretched over
+uniform vec3 boxMinimum;
+uniform vec3 boxMaximum;
+
+void main()
+{
+    vec3 worldPosition = mix(boxMinimum, boxMaximum, aPos + 0.5);
+    gl_Position = viewProjection * vec4(worldPosition, 1.0);
+}
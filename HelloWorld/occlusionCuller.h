@@ -0,0 +1,159 @@
+#ifndef OCCLUSIONCULLER_H
+#define OCCLUSIONCULLER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "myShader.h"
+#include "bvh.h"
+
+#include <cstdint>
+#include <vector>
+
+/*
+ Hardware occlusion culling. After the scene has been drawn, the bounding box of every
+ object in the frustum is rendered against the depth buffer with color and depth writes
+ turned off, each one inside its own GL_ANY_SAMPLES_PASSED query. If no sample of the box
+ passed the depth test, the object was hidden behind whatever got drawn in front of it.
+
+ Waiting on a query right after issuing it would stall until the GPU catches up, so the
+ results are only looked at during the following frame:
+
+    - If the result has arrived and says zero samples, the object is skipped on the CPU.
+    - If the result has arrived and says visible, the object is drawn like normal.
+    - If the result is still in flight, the object is drawn inside glBeginConditionalRender()
+      with GL_QUERY_NO_WAIT, so the GPU throws the draw away itself if the box turns out to be
+      hidden, and draws it anyway if it doesn't know yet.
+
+ Being a frame late means an object that comes out from behind something shows up one frame
+ late, which isn't noticeable at interactive frame rates.
+ */
+class OcclusionCuller {
+
+public:
+    // What we know about an object from the query issued for it during the previous frame
+    enum Visibility {
+        VISIBILITY_UNKNOWN,     // No query was issued for it last frame
+        VISIBILITY_PENDING,     // The query hasn't finished yet
+        VISIBILITY_VISIBLE,
+        VISIBILITY_OCCLUDED
+    };
+
+    // How far the query boxes reach past the objects, in world units
+    static constexpr float BOX_MARGIN = 0.01f;
+
+    OcclusionCuller(const char* vertexPath, const char* fragmentPath) : boxShader(vertexPath, fragmentPath) {
+    }
+
+    ~OcclusionCuller() {
+        if (!queries.empty()) {
+            glDeleteQueries((GLsizei) queries.size(), &queries[0]);
+        }
+    }
+
+    OcclusionCuller(const OcclusionCuller&) = delete;
+    OcclusionCuller& operator=(const OcclusionCuller&) = delete;
+
+    // Makes sure there is a query for each of the given number of objects
+    void resize(size_t count) {
+        size_t previous = queries.size();
+        if (count <= previous) {
+            return;
+        }
+        queries.resize(count);
+        glGenQueries((GLsizei) (count - previous), &queries[previous]);
+        issued.resize(count, 0);
+        visibility.resize(count, VISIBILITY_UNKNOWN);
+    }
+
+    /*
+     Picks up the results of the queries issued during the previous frame. This never waits
+     on the GPU, queries that haven't finished are left as VISIBILITY_PENDING.
+     */
+    void collectResults() {
+        for (size_t i = 0; i < queries.size(); i++) {
+            if (!issued[i]) {
+                visibility[i] = VISIBILITY_UNKNOWN;
+                continue;
+            }
+            issued[i] = 0;
+
+            GLuint available = 0;
+            glGetQueryObjectuiv(queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available) {
+                visibility[i] = VISIBILITY_PENDING;
+                continue;
+            }
+            GLuint samplesPassed = 0;
+            glGetQueryObjectuiv(queries[i], GL_QUERY_RESULT, &samplesPassed);
+            visibility[i] = samplesPassed ? VISIBILITY_VISIBLE : VISIBILITY_OCCLUDED;
+        }
+    }
+
+    Visibility visibilityOf(size_t object) const {
+        return visibility[object];
+    }
+
+    // The query to hand to glBeginConditionalRender() for an object that is still pending
+    unsigned int query(size_t object) const {
+        return queries[object];
+    }
+
+    /*
+     Renders the bounding box of every object flagged in candidates inside its query. This
+     should come after the scene has been drawn so that the depth buffer holds the occluders.
+     Objects whose box contains the camera are never tested, since the near plane would clip
+     their box away and make them look hidden.
+
+     Each box is grown by BOX_MARGIN and passes on equal depth, since its faces would otherwise
+     land right on the faces its own object just wrote to the depth buffer. Those go through a
+     different transform, so the box would z-fight with its object and flicker between hidden
+     and visible.
+     */
+    void issueQueries(const std::vector<AABB> &boxes, const std::vector<uint8_t> &candidates,
+                      const glm::mat4 &viewProjection, const glm::vec3 &cameraPosition, unsigned int boxVAO) {
+        boxShader.use();
+        boxShader.setMat4("viewProjection", viewProjection);
+        GLint minimumLocation = glGetUniformLocation(boxShader.ID, "boxMinimum");
+        GLint maximumLocation = glGetUniformLocation(boxShader.ID, "boxMaximum");
+
+        // The boxes only need to be tested against the depth buffer, not drawn into anything
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glDepthMask(GL_FALSE);
+        glDepthFunc(GL_LEQUAL);
+        glBindVertexArray(boxVAO);
+
+        for (size_t i = 0; i < boxes.size(); i++) {
+            glm::vec3 minimum = boxes[i].minimum - glm::vec3(BOX_MARGIN);
+            glm::vec3 maximum = boxes[i].maximum + glm::vec3(BOX_MARGIN);
+            if (!candidates[i] || contains(AABB(minimum, maximum), cameraPosition)) {
+                continue;
+            }
+            glUniform3fv(minimumLocation, 1, glm::value_ptr(minimum));
+            glUniform3fv(maximumLocation, 1, glm::value_ptr(maximum));
+            glBeginQuery(GL_ANY_SAMPLES_PASSED, queries[i]);
+            glDrawArrays(GL_TRIANGLES, 0, 36);
+            glEndQuery(GL_ANY_SAMPLES_PASSED);
+            issued[i] = 1;
+        }
+
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    }
+
+private:
+    Shader boxShader;
+    std::vector<unsigned int> queries;
+    std::vector<uint8_t> issued;        // A query was issued for the object this frame
+    std::vector<Visibility> visibility;
+
+    static bool contains(const AABB &box, const glm::vec3 &point) {
+        return point.x >= box.minimum.x && point.x <= box.maximum.x &&
+               point.y >= box.minimum.y && point.y <= box.maximum.y &&
+               point.z >= box.minimum.z && point.z <= box.maximum.z;
+    }
+};
+
+#endif
@@ -0,0 +1,310 @@
+#ifndef RENDERQUEUE_H
+#define RENDERQUEUE_H
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+/*
+ Layout of the 64-bit sort key, from the most significant bit down:
+
+    | pass (4) | program (12) | texture set (12) | VAO (12) | depth (24) |
+
+ Sorting the keys in ascending order groups draws by pass first, then by the
+ most expensive state change (the program), then textures and finally the VAO.
+ Within the same state, draws are ordered front-to-back so that opaque objects
+ get the most out of early depth rejection.
+ */
+const int SORTKEY_DEPTH_BITS = 24;
+const int SORTKEY_VAO_SHIFT = 24;
+const int SORTKEY_TEXTURE_SHIFT = 36;
+const int SORTKEY_PROGRAM_SHIFT = 48;
+const int SORTKEY_PASS_SHIFT = 60;
+const uint64_t SORTKEY_FIELD_MASK = 0xFFF;
+
+// The passes are submitted in this order. Culled draws sort to the very end and are never submitted
+enum RenderPass {
+    PASS_OPAQUE = 0,
+    PASS_TRANSPARENT = 1,
+    PASS_CULLED = 15
+};
+
+// A single draw that has been recorded into the render queue
+struct DrawCommand {
+    unsigned int program;
+    unsigned int textureSet;    // Index returned by RenderQueue::textureSet()
+    unsigned int VAO;
+    bool indexed;               // Whether first and count refer to the VAO's element buffer instead of its vertices
+    GLint first;
+    GLsizei count;
+    unsigned int instance;      // Index of the object's model matrix in the instance buffer
+    unsigned int query;         // Occlusion query the draw is conditional on, or 0 to always draw
+};
+
+// Builds a sort key for a draw. The depth is the view-space distance of the object
+inline uint64_t makeSortKey(RenderPass pass, unsigned int programSlot, unsigned int textureSet, unsigned int vaoSlot,
+                            float depth, float nearPlane, float farPlane) {
+    // Quantizing the depth into 24 bits, nearest objects get the smallest value
+    float normalized = (depth - nearPlane) / (farPlane - nearPlane);
+    if (normalized < 0.0f) {
+        normalized = 0.0f;
+    } else if (normalized > 1.0f) {
+        normalized = 1.0f;
+    }
+    uint64_t depthBits = (uint64_t) (normalized * (float) ((1 << SORTKEY_DEPTH_BITS) - 1));
+
+    return ((uint64_t) pass << SORTKEY_PASS_SHIFT) |
+           (((uint64_t) programSlot & SORTKEY_FIELD_MASK) << SORTKEY_PROGRAM_SHIFT) |
+           (((uint64_t) textureSet & SORTKEY_FIELD_MASK) << SORTKEY_TEXTURE_SHIFT) |
+           (((uint64_t) vaoSlot & SORTKEY_FIELD_MASK) << SORTKEY_VAO_SHIFT) |
+           depthBits;
+}
+
+class RenderQueue {
+
+public:
+    // Number of textures that make up a texture set, one per texture unit
+    static const int TEXTURES_PER_SET = 2;
+
+    /*
+     Returns the index of the given texture combination, registering it if we haven't seen it before.
+     The target is GL_TEXTURE_2D_ARRAY for sets made of texture arrays
+     */
+    unsigned int textureSet(unsigned int texture0, unsigned int texture1, GLenum target = GL_TEXTURE_2D) {
+        for (unsigned int i = 0; i < textureSets.size(); i++) {
+            if (textureSets[i].textures[0] == texture0 && textureSets[i].textures[1] == texture1 &&
+                textureSets[i].target == target) {
+                return i;
+            }
+        }
+        TextureSet set;
+        set.target = target;
+        set.textures[0] = texture0;
+        set.textures[1] = texture1;
+        textureSets.push_back(set);
+        return (unsigned int) textureSets.size() - 1;
+    }
+
+    // The GL object names can be arbitrarily large, so the key stores a small dense slot for them instead
+    unsigned int programSlot(unsigned int program) {
+        return slotFor(programs, program);
+    }
+    unsigned int vaoSlot(unsigned int VAO) {
+        return slotFor(vaos, VAO);
+    }
+
+    // Hands a program's slot over to the program replacing it, so reloading a shader doesn't use up slots
+    void replaceProgram(unsigned int oldProgram, unsigned int newProgram) {
+        for (unsigned int i = 0; i < programs.size(); i++) {
+            if (programs[i] == oldProgram) {
+                programs[i] = newProgram;
+                return;
+            }
+        }
+        programs.push_back(newProgram);
+    }
+
+    // Removes all of the recorded draws, this should be called at the start of every frame
+    void clear() {
+        keys.clear();
+        commands.clear();
+    }
+
+    // Records a draw along with its sort key
+    void push(uint64_t key, const DrawCommand &command) {
+        keys.push_back(key);
+        commands.push_back(command);
+    }
+
+    size_t size() const {
+        return commands.size();
+    }
+
+    /*
+     Makes room for count draws that will be filled in with record(). This lets
+     several threads record into their own segment of the queue at once, as long
+     as every index is only written by one of them.
+     */
+    void resize(size_t count) {
+        keys.resize(count);
+        commands.resize(count);
+    }
+
+    void record(size_t index, uint64_t key, const DrawCommand &command) {
+        keys[index] = key;
+        commands[index] = command;
+    }
+
+    // Marks a recorded slot as not visible so that it is skipped on submission
+    void recordCulled(size_t index) {
+        keys[index] = (uint64_t) PASS_CULLED << SORTKEY_PASS_SHIFT;
+    }
+
+    // Sorts the recorded draws by their keys with an LSD radix sort, one byte per pass
+    void sort() {
+        size_t count = keys.size();
+        order.resize(count);
+        scratchKeys.resize(count);
+        scratchOrder.resize(count);
+        for (size_t i = 0; i < count; i++) {
+            order[i] = (uint32_t) i;
+        }
+        if (count < 2) {
+            return;
+        }
+
+        // Building the histograms for all 8 digits in a single pass over the keys
+        uint32_t histograms[8][256];
+        memset(histograms, 0, sizeof(histograms));
+        for (size_t i = 0; i < count; i++) {
+            uint64_t key = keys[i];
+            for (int digit = 0; digit < 8; digit++) {
+                histograms[digit][(key >> (digit * 8)) & 0xFF]++;
+            }
+        }
+
+        uint64_t *sourceKeys = keys.data();
+        uint32_t *sourceOrder = order.data();
+        uint64_t *destinationKeys = scratchKeys.data();
+        uint32_t *destinationOrder = scratchOrder.data();
+
+        for (int digit = 0; digit < 8; digit++) {
+            uint32_t *histogram = histograms[digit];
+            int shift = digit * 8;
+
+            // If every key has the same value for this digit then the pass wouldn't move anything
+            if (histogram[(sourceKeys[0] >> shift) & 0xFF] == count) {
+                continue;
+            }
+
+            // Turning the histogram into starting offsets
+            uint32_t offset = 0;
+            for (int bucket = 0; bucket < 256; bucket++) {
+                uint32_t bucketSize = histogram[bucket];
+                histogram[bucket] = offset;
+                offset += bucketSize;
+            }
+
+            for (size_t i = 0; i < count; i++) {
+                uint64_t key = sourceKeys[i];
+                uint32_t destination = histogram[(key >> shift) & 0xFF]++;
+                destinationKeys[destination] = key;
+                destinationOrder[destination] = sourceOrder[i];
+            }
+
+            std::swap(sourceKeys, destinationKeys);
+            std::swap(sourceOrder, destinationOrder);
+        }
+
+        // Making sure the sorted result ends up in our own arrays
+        if (sourceKeys != keys.data()) {
+            keys.swap(scratchKeys);
+            order.swap(scratchOrder);
+        }
+    }
+
+    /*
+     Issues the draws in sorted order, only touching GL state when it actually changes.
+     Consecutive draws with the same state whose instances follow one after another in
+     the instance buffer are merged into a single instanced draw. Draws that depend on an
+     occlusion query are always issued on their own.
+     */
+    void submit() {
+        unsigned int currentProgram = 0;
+        unsigned int currentTextureSet = (unsigned int) -1;
+        unsigned int currentVAO = 0;
+        GLint modelIndexLocation = -1;
+
+        size_t i = 0;
+        while (i < order.size()) {
+            // Everything after the first culled draw is culled as well
+            if ((keys[i] >> SORTKEY_PASS_SHIFT) == PASS_CULLED) {
+                break;
+            }
+            const DrawCommand &command = commands[order[i]];
+
+            if (command.program != currentProgram) {
+                glUseProgram(command.program);
+                modelIndexLocation = glGetUniformLocation(command.program, "modelIndex");
+                currentProgram = command.program;
+            }
+            if (command.textureSet != currentTextureSet) {
+                for (int unit = 0; unit < TEXTURES_PER_SET; unit++) {
+                    glActiveTexture(GL_TEXTURE0 + unit);
+                    glBindTexture(textureSets[command.textureSet].target, textureSets[command.textureSet].textures[unit]);
+                }
+                currentTextureSet = command.textureSet;
+            }
+            if (command.VAO != currentVAO) {
+                glBindVertexArray(command.VAO);
+                currentVAO = command.VAO;
+            }
+
+            // Extending the run for as long as the next draw can share this one's draw call
+            GLsizei instanceCount = 1;
+            while (i + instanceCount < order.size()) {
+                uint64_t nextKey = keys[i + instanceCount];
+                const DrawCommand &next = commands[order[i + instanceCount]];
+                if ((nextKey >> SORTKEY_PASS_SHIFT) == PASS_CULLED || next.program != command.program ||
+                    next.textureSet != command.textureSet || next.VAO != command.VAO || next.indexed != command.indexed || next.first != command.first ||
+                    next.count != command.count || next.instance != command.instance + (unsigned int) instanceCount ||
+                    command.query || next.query) {
+                    break;
+                }
+                instanceCount++;
+            }
+
+            glUniform1i(modelIndexLocation, (GLint) command.instance);
+            if (command.query) {
+                // Letting the GPU drop the draw if the query found the object hidden, without waiting for it
+                glBeginConditionalRender(command.query, GL_QUERY_NO_WAIT);
+                draw(command, instanceCount);
+                glEndConditionalRender();
+            } else {
+                draw(command, instanceCount);
+            }
+            i += instanceCount;
+        }
+    }
+
+private:
+    struct TextureSet {
+        GLenum target;
+        unsigned int textures[TEXTURES_PER_SET];
+    };
+
+    std::vector<TextureSet> textureSets;
+    std::vector<unsigned int> programs;
+    std::vector<unsigned int> vaos;
+
+    // The keys and commands are stored separately so the sort only has to move 12 bytes per draw
+    std::vector<uint64_t> keys;
+    std::vector<DrawCommand> commands;
+    std::vector<uint32_t> order;
+    std::vector<uint64_t> scratchKeys;
+    std::vector<uint32_t> scratchOrder;
+
+    static void draw(const DrawCommand &command, GLsizei instanceCount) {
+        if (command.indexed) {
+            glDrawElementsInstanced(GL_TRIANGLES, command.count, GL_UNSIGNED_INT,
+                                    (void*) (command.first * sizeof(unsigned int)), instanceCount);
+        } else {
+            glDrawArraysInstanced(GL_TRIANGLES, command.first, command.count, instanceCount);
+        }
+    }
+
+    unsigned int slotFor(std::vector<unsigned int> &names, unsigned int name) {
+        for (unsigned int i = 0; i < names.size(); i++) {
+            if (names[i] == name) {
+                return i;
+            }
+        }
+        names.push_back(name);
+        return (unsigned int) names.size() - 1;
+    }
+};
+
+#endif
@@ -0,0 +1,181 @@
+#ifndef SCENEGRAPH_H
+#define SCENEGRAPH_H
+
+#include <glm/glm.hpp>
+
+#include "transformStore.h"
+#include "jobSystem.h"
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/*
+ A hierarchy of objects stored as flat arrays instead of a tree of pointers. Every
+ node only knows the index of its parent, and a parent is always added before its
+ children, so walking the arrays front to back visits parents first. That lets us
+ propagate world matrices (world = parent's world * local) in a single linear pass.
+
+ The local transforms live in a TransformStore, which rebuilds only the ones that
+ changed. A node's world matrix is then rebuilt if its local matrix changed or its
+ parent's world matrix did, which is how moving a node drags its whole subtree along.
+
+ Nodes under different roots don't depend on each other, so each root keeps the list
+ of nodes in its subtree (in ascending order) and the subtrees are updated in parallel.
+ */
+class SceneGraph {
+
+public:
+    static const uint32_t NO_PARENT = 0xFFFFFFFF;
+
+    // The local transform of every node, relative to its parent
+    TransformStore locals;
+
+    // Adds a node under the given parent (or NO_PARENT for a root) and returns its index
+    uint32_t addNode(uint32_t parent, const glm::vec3 &position, const glm::vec3 &axis, float angle,
+                     const glm::vec3 &scale = glm::vec3(1.0f)) {
+        uint32_t index = (uint32_t) locals.add(position, axis, angle, scale);
+        parents.push_back(parent);
+        world.push_back(glm::mat4(1.0f));
+        localVersions.push_back(0);
+        worldVersions.push_back(0);
+        worldChanged.push_back(1);
+        pendingUpload.push_back(0);
+
+        // Keeping track of which root's subtree the node belongs to
+        if (parent == NO_PARENT) {
+            rootOf.push_back((uint32_t) subtrees.size());
+            subtrees.push_back(std::vector<uint32_t>());
+        } else {
+            rootOf.push_back(rootOf[parent]);
+        }
+        subtrees[rootOf[index]].push_back(index);
+        return index;
+    }
+
+    size_t size() const {
+        return world.size();
+    }
+
+    uint32_t parent(uint32_t node) const {
+        return parents[node];
+    }
+
+    const glm::mat4& model(size_t node) const {
+        return world[node];
+    }
+
+    // Goes up by one every time the node's world matrix is rebuilt
+    uint32_t worldVersion(size_t node) const {
+        return worldVersions[node];
+    }
+
+    // Start of the contiguous world matrix buffer, 16 floats per node in column-major order
+    const float* modelData() const {
+        return world.empty() ? NULL : &world[0][0][0];
+    }
+
+    /*
+     Rebuilds the local matrices that changed and then the world matrices that depend on
+     them. Both steps are split across the job system.
+     */
+    void update(JobSystem &jobSystem) {
+        jobSystem.parallelFor(locals.size(), LOCAL_BATCH_SIZE, [this](size_t begin, size_t end) {
+            locals.computeModelMatrices(begin, end);
+        });
+        jobSystem.parallelFor(subtrees.size(), SUBTREE_BATCH_SIZE, [this](size_t begin, size_t end) {
+            for (size_t subtree = begin; subtree < end; subtree++) {
+                updateSubtree(subtrees[subtree]);
+            }
+        });
+    }
+
+    // Same as TransformStore::takeChangedRanges(), but for the world matrices
+    void takeChangedRanges(std::vector<std::pair<size_t, size_t>> &ranges, size_t mergeGap = 4) {
+        ranges.clear();
+        size_t count = pendingUpload.size();
+        size_t i = 0;
+        while (i < count) {
+            if (!pendingUpload[i]) {
+                i++;
+                continue;
+            }
+            size_t begin = i;
+            size_t end = i + 1;
+            pendingUpload[i] = 0;
+            for (size_t j = end; j < count && j <= end + mergeGap; j++) {
+                if (pendingUpload[j]) {
+                    pendingUpload[j] = 0;
+                    end = j + 1;
+                }
+            }
+            ranges.push_back(std::make_pair(begin, end));
+            i = end;
+        }
+    }
+
+private:
+    // Below these many nodes or subtrees, splitting the work up costs more than it saves
+    static const size_t LOCAL_BATCH_SIZE = 1024;
+    static const size_t SUBTREE_BATCH_SIZE = 64;
+
+    std::vector<uint32_t> parents;
+    std::vector<uint32_t> rootOf;                   // Index into subtrees
+    std::vector<std::vector<uint32_t>> subtrees;    // The nodes under each root, in ascending order
+    std::vector<glm::mat4> world;
+    std::vector<uint32_t> localVersions;            // Version of the local matrix the world matrix was built from
+    std::vector<uint32_t> worldVersions;
+    std::vector<uint8_t> worldChanged;              // The world matrix was rebuilt during the current update
+    std::vector<uint8_t> pendingUpload;             // The world matrix was rebuilt since the last takeChangedRanges()
+
+    void updateSubtree(const std::vector<uint32_t> &nodes) {
+        for (size_t n = 0; n < nodes.size(); n++) {
+            uint32_t node = nodes[n];
+            uint32_t parent = parents[node];
+            bool localChanged = locals.version(node) != localVersions[node];
+            bool parentChanged = parent != NO_PARENT && worldChanged[parent];
+
+            // Parents always come first, so worldChanged of the parent is already up to date for this update
+            if (!localChanged && !parentChanged) {
+                worldChanged[node] = 0;
+                continue;
+            }
+            if (parent == NO_PARENT) {
+                world[node] = locals.model(node);
+            } else {
+                multiplyAffine(world[parent], locals.model(node), world[node]);
+            }
+            localVersions[node] = locals.version(node);
+            worldVersions[node]++;
+            worldChanged[node] = 1;
+            pendingUpload[node] = 1;
+        }
+    }
+
+    // result = a * b, where both are affine so the bottom row of b is always (0, 0, 0, 1)
+    static void multiplyAffine(const glm::mat4 &a, const glm::mat4 &b, glm::mat4 &result) {
+#ifdef TRANSFORMSTORE_SSE2
+        __m128 a0 = _mm_loadu_ps(&a[0][0]);
+        __m128 a1 = _mm_loadu_ps(&a[1][0]);
+        __m128 a2 = _mm_loadu_ps(&a[2][0]);
+        __m128 a3 = _mm_loadu_ps(&a[3][0]);
+        for (int column = 0; column < 3; column++) {
+            __m128 c = _mm_mul_ps(a0, _mm_set1_ps(b[column][0]));
+            c = _mm_add_ps(c, _mm_mul_ps(a1, _mm_set1_ps(b[column][1])));
+            c = _mm_add_ps(c, _mm_mul_ps(a2, _mm_set1_ps(b[column][2])));
+            _mm_storeu_ps(&result[column][0], c);
+        }
+        __m128 t = _mm_mul_ps(a0, _mm_set1_ps(b[3][0]));
+        t = _mm_add_ps(t, _mm_mul_ps(a1, _mm_set1_ps(b[3][1])));
+        t = _mm_add_ps(t, _mm_mul_ps(a2, _mm_set1_ps(b[3][2])));
+        _mm_storeu_ps(&result[3][0], _mm_add_ps(t, a3));
+#else
+        for (int column = 0; column < 3; column++) {
+            result[column] = a[0] * b[column][0] + a[1] * b[column][1] + a[2] * b[column][2];
+        }
+        result[3] = a[0] * b[3][0] + a[1] * b[3][1] + a[2] * b[3][2] + a[3];
+#endif
+    }
+};
+
+#endif
@@ -2,12 +2,15 @@
 out vec4 FragColor;
 
 in vec2 TextureCoordinate;
+flat in ivec2 TextureLayers;
 
-uniform sampler2D texture1;
-uniform sampler2D texture2;
+// Both textures come from texture arrays, the vertex shader passes along which layer of each to use
+uniform sampler2DArray texture1;
+uniform sampler2DArray texture2;
 uniform float mixSetting;
 
 void main()
 {
-    FragColor = mix(texture(texture1, TextureCoordinate), texture(texture2, TextureCoordinate), mixSetting);
+    FragColor = mix(texture(texture1, vec3(TextureCoordinate, TextureLayers.x)),
+                    texture(texture2, vec3(TextureCoordinate, TextureLayers.y)), mixSetting);
 }
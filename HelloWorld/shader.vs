@@ -3,14 +3,27 @@ layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec2 aTextureCoordinate;
 
 out vec2 TextureCoordinate;
+flat out ivec2 TextureLayers;
 
 uniform mat4 transform;
-uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
+// Every object's model matrix lives in the instance buffer, four texels per matrix
+uniform samplerBuffer modelMatrices;
+uniform int modelIndex;
+
+// The layer of each texture array the object samples from, indexed the same way as the model matrices
+uniform isamplerBuffer textureLayers;
+
 void main()
 {
+    int base = (modelIndex + gl_InstanceID) * 4;
+    mat4 model = mat4(texelFetch(modelMatrices, base),
+                      texelFetch(modelMatrices, base + 1),
+                      texelFetch(modelMatrices, base + 2),
+                      texelFetch(modelMatrices, base + 3));
     gl_Position = projection* view * model * vec4(aPos, 1.0);
     TextureCoordinate = aTextureCoordinate;
+    TextureLayers = texelFetch(textureLayers, modelIndex + gl_InstanceID).xy;
 }
@@ -0,0 +1,313 @@
+#ifndef SOFTWAREOCCLUSION_H
+#define SOFTWAREOCCLUSION_H
+
+#include <glm/glm.hpp>
+
+#include "jobSystem.h"
+#include "bvh.h"
+
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SOFTWAREOCCLUSION_SSE2
+#include <emmintrin.h>
+#endif
+
+// A mesh that hides whatever is behind it, drawn as a plain list of triangles
+struct Occluder {
+    const float *positions;     // x, y, z of the first vertex
+    size_t stride;              // Number of floats from one vertex to the next
+    size_t vertexCount;         // A multiple of three
+    glm::mat4 model;
+};
+
+/*
+ Occlusion culling done entirely on the CPU. A handful of occluder meshes are rasterized
+ into a small depth buffer, and every object's bounding box is then tested against it
+ before the draws are recorded. Unlike the GPU queries there is no latency, the result is
+ ready in the same frame, and nothing here needs a GPU at all.
+
+ The depth buffer is split into bands of BLOCK_SIZE rows. Every band is rasterized by a
+ single job, so the jobs never write to the same pixels. Each band also builds its row of
+ the hierarchical depth buffer: for every BLOCK_SIZE x BLOCK_SIZE block, the farthest depth
+ written into it. A box is hidden if its nearest point is behind the farthest depth of every
+ block it covers, which lets us test a box by looking at a few blocks instead of every pixel.
+
+ Depths are window-space z in [0, 1]. Triangles that cross the near plane are skipped rather
+ than clipped, which only means they hide less than they could.
+ */
+class SoftwareOcclusion {
+
+public:
+    // Pixels along each side of a hierarchical depth block, and the height of a band
+    static const int BLOCK_SIZE = 8;
+
+    // The width is rounded up to a multiple of BLOCK_SIZE, which also keeps every row a multiple of four pixels
+    SoftwareOcclusion(int width, int height) :
+        width(roundUp(width)), height(roundUp(height)),
+        blocksX(this->width / BLOCK_SIZE), blocksY(this->height / BLOCK_SIZE),
+        depth(this->width * this->height), blockDepth(blocksX * blocksY) {
+    }
+
+    /*
+     Rasterizes the occluders into the depth buffer. The occluders are transformed and set up
+     in parallel first, then the bands are rasterized in parallel.
+     */
+    void render(JobSystem &jobSystem, const std::vector<Occluder> &occluders, const glm::mat4 &viewProjection) {
+        // Every occluder writes its triangles into its own range of the triangle list
+        firstTriangle.resize(occluders.size() + 1);
+        firstTriangle[0] = 0;
+        for (size_t i = 0; i < occluders.size(); i++) {
+            firstTriangle[i + 1] = firstTriangle[i] + occluders[i].vertexCount / 3;
+        }
+        triangles.resize(firstTriangle.back());
+
+        jobSystem.parallelFor(occluders.size(), OCCLUDER_BATCH_SIZE, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                setupOccluder(occluders[i], viewProjection, &triangles[firstTriangle[i]]);
+            }
+        });
+        jobSystem.parallelFor(blocksY, 1, [this](size_t begin, size_t end) {
+            for (size_t band = begin; band < end; band++) {
+                rasterizeBand((int) band);
+            }
+        });
+    }
+
+    // Returns false if the box is certainly hidden behind the occluders
+    bool isVisible(const AABB &box, const glm::mat4 &viewProjection) const {
+        float minimumX = FLT_MAX, minimumY = FLT_MAX, minimumZ = FLT_MAX;
+        float maximumX = -FLT_MAX, maximumY = -FLT_MAX;
+        for (int corner = 0; corner < 8; corner++) {
+            glm::vec3 point((corner & 1) ? box.maximum.x : box.minimum.x,
+                            (corner & 2) ? box.maximum.y : box.minimum.y,
+                            (corner & 4) ? box.maximum.z : box.minimum.z);
+            glm::vec4 clip = viewProjection * glm::vec4(point, 1.0f);
+
+            // Part of the box is behind the camera, so we can't tell what it covers on the screen
+            if (clip.w <= NEAR_W) {
+                return true;
+            }
+            glm::vec3 window = toWindow(clip);
+            minimumX = std::fmin(minimumX, window.x);
+            maximumX = std::fmax(maximumX, window.x);
+            minimumY = std::fmin(minimumY, window.y);
+            maximumY = std::fmax(maximumY, window.y);
+            minimumZ = std::fmin(minimumZ, window.z);
+        }
+
+        // Boxes that are off the screen are the frustum culler's business
+        if (maximumX < 0.0f || maximumY < 0.0f || minimumX >= (float) width || minimumY >= (float) height) {
+            return true;
+        }
+
+        // Clamping to the buffer before converting, since a box close to the near plane can reach past what an int holds
+        int firstBlockX = (int) std::floor(std::fmax(minimumX, 0.0f)) / BLOCK_SIZE;
+        int lastBlockX = (int) std::floor(std::fmin(maximumX, (float) (width - 1))) / BLOCK_SIZE;
+        int firstBlockY = (int) std::floor(std::fmax(minimumY, 0.0f)) / BLOCK_SIZE;
+        int lastBlockY = (int) std::floor(std::fmin(maximumY, (float) (height - 1))) / BLOCK_SIZE;
+
+        for (int y = firstBlockY; y <= lastBlockY; y++) {
+            for (int x = firstBlockX; x <= lastBlockX; x++) {
+                if (minimumZ < blockDepth[y * blocksX + x]) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    int bufferWidth() const {
+        return width;
+    }
+
+    int bufferHeight() const {
+        return height;
+    }
+
+    // The full resolution depth buffer, row by row from the bottom of the screen
+    const float* depthData() const {
+        return &depth[0];
+    }
+
+private:
+    static const size_t OCCLUDER_BATCH_SIZE = 16;
+
+    // Vertices closer to the camera than this (in clip space w) count as crossing the near plane
+    static constexpr float NEAR_W = 1e-5f;
+
+    /*
+     A triangle that is ready to be rasterized. Each edge function is a * x + b * y + c and is
+     positive on the inside of the triangle, and the depth is interpolated with the same form.
+     */
+    struct ScreenTriangle {
+        int minimumX, maximumX, minimumY, maximumY;     // Pixel bounds, inclusive; minimumX > maximumX if it is skipped
+        float edgeA[3], edgeB[3], edgeC[3];
+        float depthA, depthB, depthC;
+    };
+
+    int width, height;
+    int blocksX, blocksY;
+    std::vector<float> depth;
+    std::vector<float> blockDepth;      // Farthest depth in each block
+    std::vector<ScreenTriangle> triangles;
+    std::vector<size_t> firstTriangle;  // Index of each occluder's first triangle
+
+    static int roundUp(int size) {
+        return (size + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+    }
+
+    glm::vec3 toWindow(const glm::vec4 &clip) const {
+        float inverseW = 1.0f / clip.w;
+        return glm::vec3((clip.x * inverseW * 0.5f + 0.5f) * width,
+                         (clip.y * inverseW * 0.5f + 0.5f) * height,
+                         clip.z * inverseW * 0.5f + 0.5f);
+    }
+
+    void setupOccluder(const Occluder &occluder, const glm::mat4 &viewProjection, ScreenTriangle *output) const {
+        glm::mat4 transform = viewProjection * occluder.model;
+        for (size_t t = 0; t < occluder.vertexCount / 3; t++) {
+            ScreenTriangle &triangle = output[t];
+            triangle.minimumX = 1;
+            triangle.maximumX = 0;
+
+            glm::vec3 window[3];
+            bool crossesNear = false;
+            for (int v = 0; v < 3; v++) {
+                const float *position = occluder.positions + (t * 3 + v) * occluder.stride;
+                glm::vec4 clip = transform * glm::vec4(position[0], position[1], position[2], 1.0f);
+                if (clip.w <= NEAR_W || clip.z < -clip.w) {
+                    crossesNear = true;
+                    break;
+                }
+                window[v] = toWindow(clip);
+            }
+            if (crossesNear) {
+                continue;
+            }
+
+            // Edge functions for the edges opposite each vertex
+            for (int e = 0; e < 3; e++) {
+                const glm::vec3 &a = window[(e + 1) % 3];
+                const glm::vec3 &b = window[(e + 2) % 3];
+                triangle.edgeA[e] = a.y - b.y;
+                triangle.edgeB[e] = b.x - a.x;
+                triangle.edgeC[e] = a.x * b.y - a.y * b.x;
+            }
+            float area = triangle.edgeA[0] * window[0].x + triangle.edgeB[0] * window[0].y + triangle.edgeC[0];
+            if (std::fabs(area) < 1e-8f) {
+                continue;
+            }
+
+            // Depth is affine in window space: z = sum over vertices of z * edge(opposite) / area
+            float inverseArea = 1.0f / area;
+            triangle.depthA = (triangle.edgeA[0] * window[0].z + triangle.edgeA[1] * window[1].z + triangle.edgeA[2] * window[2].z) * inverseArea;
+            triangle.depthB = (triangle.edgeB[0] * window[0].z + triangle.edgeB[1] * window[1].z + triangle.edgeB[2] * window[2].z) * inverseArea;
+            triangle.depthC = (triangle.edgeC[0] * window[0].z + triangle.edgeC[1] * window[1].z + triangle.edgeC[2] * window[2].z) * inverseArea;
+
+            // Flipping the edges of clockwise triangles so that the inside is always positive
+            if (area < 0.0f) {
+                for (int e = 0; e < 3; e++) {
+                    triangle.edgeA[e] = -triangle.edgeA[e];
+                    triangle.edgeB[e] = -triangle.edgeB[e];
+                    triangle.edgeC[e] = -triangle.edgeC[e];
+                }
+            }
+
+            float minimumX = std::fmin(window[0].x, std::fmin(window[1].x, window[2].x));
+            float maximumX = std::fmax(window[0].x, std::fmax(window[1].x, window[2].x));
+            float minimumY = std::fmin(window[0].y, std::fmin(window[1].y, window[2].y));
+            float maximumY = std::fmax(window[0].y, std::fmax(window[1].y, window[2].y));
+            if (maximumX < 0.0f || maximumY < 0.0f || minimumX >= width || minimumY >= height) {
+                continue;
+            }
+            triangle.minimumX = minimumX < 0.0f ? 0 : (int) minimumX;
+            triangle.maximumX = maximumX >= width ? width - 1 : (int) maximumX;
+            triangle.minimumY = minimumY < 0.0f ? 0 : (int) minimumY;
+            triangle.maximumY = maximumY >= height ? height - 1 : (int) maximumY;
+        }
+    }
+
+    void rasterizeBand(int band) {
+        int firstRow = band * BLOCK_SIZE;
+        int lastRow = firstRow + BLOCK_SIZE - 1;
+        std::fill(depth.begin() + firstRow * width, depth.begin() + (lastRow + 1) * width, 1.0f);
+
+        for (size_t t = 0; t < triangles.size(); t++) {
+            const ScreenTriangle &triangle = triangles[t];
+            if (triangle.minimumX > triangle.maximumX || triangle.maximumY < firstRow || triangle.minimumY > lastRow) {
+                continue;
+            }
+            int rowBegin = triangle.minimumY > firstRow ? triangle.minimumY : firstRow;
+            int rowEnd = triangle.maximumY < lastRow ? triangle.maximumY : lastRow;
+            for (int y = rowBegin; y <= rowEnd; y++) {
+                rasterizeRow(triangle, y);
+            }
+        }
+
+        // Building this band's row of the hierarchical depth buffer
+        for (int blockX = 0; blockX < blocksX; blockX++) {
+            float farthest = 0.0f;
+            for (int y = firstRow; y <= lastRow; y++) {
+                const float *row = &depth[y * width + blockX * BLOCK_SIZE];
+                for (int x = 0; x < BLOCK_SIZE; x++) {
+                    farthest = std::fmax(farthest, row[x]);
+                }
+            }
+            blockDepth[band * blocksX + blockX] = farthest;
+        }
+    }
+
+    // Writes the nearest depth of the triangle into every covered pixel of row y, sampling at pixel centers
+    void rasterizeRow(const ScreenTriangle &triangle, int y) {
+        float centerY = y + 0.5f;
+        float *row = &depth[y * width];
+        int x = triangle.minimumX & ~3;
+
+#ifdef SOFTWAREOCCLUSION_SSE2
+        // Four pixels at a time: evaluating the edges and depth for x, x+1, x+2, x+3
+        __m128 centerX = _mm_add_ps(_mm_set1_ps((float) x), _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f));
+        __m128 edge[3], edgeStep[3];
+        for (int e = 0; e < 3; e++) {
+            edge[e] = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(triangle.edgeA[e]), centerX),
+                                 _mm_set1_ps(triangle.edgeB[e] * centerY + triangle.edgeC[e]));
+            edgeStep[e] = _mm_set1_ps(triangle.edgeA[e] * 4.0f);
+        }
+        __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(triangle.depthA), centerX),
+                              _mm_set1_ps(triangle.depthB * centerY + triangle.depthC));
+        __m128 zStep = _mm_set1_ps(triangle.depthA * 4.0f);
+        __m128 zero = _mm_setzero_ps();
+
+        for (; x <= triangle.maximumX; x += 4) {
+            __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(edge[0], zero), _mm_cmpge_ps(edge[1], zero)),
+                                       _mm_cmpge_ps(edge[2], zero));
+            if (_mm_movemask_ps(inside)) {
+                __m128 current = _mm_loadu_ps(row + x);
+                __m128 write = _mm_and_ps(inside, _mm_cmplt_ps(z, current));
+                _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(write, z), _mm_andnot_ps(write, current)));
+            }
+            for (int e = 0; e < 3; e++) {
+                edge[e] = _mm_add_ps(edge[e], edgeStep[e]);
+            }
+            z = _mm_add_ps(z, zStep);
+        }
+#else
+        for (; x <= triangle.maximumX; x++) {
+            float centerX = x + 0.5f;
+            bool inside = true;
+            for (int e = 0; e < 3; e++) {
+                inside = inside && triangle.edgeA[e] * centerX + triangle.edgeB[e] * centerY + triangle.edgeC[e] >= 0.0f;
+            }
+            float z = triangle.depthA * centerX + triangle.depthB * centerY + triangle.depthC;
+            if (inside && z < row[x]) {
+                row[x] = z;
+            }
+        }
+#endif
+    }
+};
+
+#endif
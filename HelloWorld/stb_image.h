@@ -14,6 +14,8 @@
 
    You can #define STBI_ASSERT(x) before the #include to avoid using assert.h.
    And #define STBI_MALLOC, STBI_REALLOC, and STBI_FREE to avoid using malloc,realloc,free
+   And #define STBI_NO_SCRATCH_ARENA to make decoders allocate their temporary buffers
+   with STBI_MALLOC too, instead of carving them out of a per-thread arena
 
 
    QUICK NOTES:
@@ -225,6 +227,16 @@ RECENT REVISION HISTORY:
 // (at least this is true for iOS and Android). Therefore, the NEON support is
 // toggled by a build flag: define STBI_NEON to get NEON loops.
 //
+// Converting between channel counts (e.g. RGB to RGBA when you ask for 4
+// components) also has SIMD loops, using SSSE3 shuffles on x86 and NEON's
+// interleaved loads and stores on ARM. SSSE3 is checked for at run-time, and
+// GCC/Clang build those loops with a target attribute so no extra compiler
+// flags are needed. Define STBI_NO_SSSE3 if your compiler can't handle that.
+//
+// The HDR loader decodes RGBE with SSE2 or NEON, and the half-float interface
+// converts with F16C when the CPU has it (checked at run-time the same way,
+// define STBI_NO_F16C to leave it out) or NEON on 64-bit ARM.
+//
 // If for some reason you do not want to use any of SIMD code, or if
 // you have issues compiling it, you can disable it entirely by
 // defining STBI_NO_SIMD.
@@ -382,6 +394,15 @@ STBIDEF stbi_uc *stbi_load_from_file  (FILE *f, int *x, int *y, int *channels_in
 STBIDEF stbi_uc *stbi_load_gif_from_memory(stbi_uc const *buffer, int len, int **delays, int *x, int *y, int *z, int *comp, int req_comp);
 #endif
 
+// load an image at 1/scale of its size, scale being 1, 2, 4 or 8. JPEGs are decoded straight
+// to the smaller size with a reduced IDCT, which is several times faster than decoding them in
+// full; the size is rounded up, so a 100x100 JPEG at scale 8 comes out 13x13. every other
+// format is loaded at full size, so check *x and *y
+STBIDEF stbi_uc *stbi_load_scaled_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels, int scale);
+#ifndef STBI_NO_STDIO
+STBIDEF stbi_uc *stbi_load_scaled            (char const *filename, int *x, int *y, int *channels_in_file, int desired_channels, int scale);
+#endif
+
 #ifdef STBI_WINDOWS_UTF8
 STBIDEF int stbi_convert_wchar_to_utf8(char *buffer, size_t bufferlen, const wchar_t* input);
 #endif
@@ -413,6 +434,27 @@ STBIDEF stbi_us *stbi_load_from_file_16(FILE *f, int *x, int *y, int *channels_i
    #endif
 #endif
 
+////////////////////////////////////
+//
+// half-float interface
+//
+// same as the float interface, but every channel is stored as an IEEE half float,
+// so the result can go straight to GL_RGB16F/GL_RGBA16F with GL_HALF_FLOAT at half
+// the size of the floats
+//
+#ifndef STBI_NO_LINEAR
+   STBIDEF stbi_us *stbi_load_half_from_memory   (stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels);
+   STBIDEF stbi_us *stbi_load_half_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *channels_in_file, int desired_channels);
+
+   #ifndef STBI_NO_STDIO
+   STBIDEF stbi_us *stbi_load_half          (char const *filename, int *x, int *y, int *channels_in_file, int desired_channels);
+   STBIDEF stbi_us *stbi_load_half_from_file(FILE *f, int *x, int *y, int *channels_in_file, int desired_channels);
+   #endif
+
+   // the conversion on its own, for floats you have computed yourself (e.g. mip levels)
+   STBIDEF void     stbi_float_to_half(stbi_us *output, float const *input, int count);
+#endif
+
 #ifndef STBI_NO_HDR
    STBIDEF void   stbi_hdr_to_ldr_gamma(float gamma);
    STBIDEF void   stbi_hdr_to_ldr_scale(float scale);
@@ -433,12 +475,18 @@ STBIDEF int      stbi_is_hdr_from_file(FILE *f);
 
 
 // get a VERY brief reason for failure
-// NOT THREADSAFE
+// the reason is kept per thread where the compiler supports thread locals (see
+// STBI_THREAD_LOCAL), so one thread's failure doesn't overwrite another's
 STBIDEF const char *stbi_failure_reason  (void);
 
 // free the loaded image -- this is just free()
 STBIDEF void     stbi_image_free      (void *retval_from_stbi_load);
 
+// decoders take their temporary buffers from a per-thread arena that is kept between
+// decodes (see STBI_NO_SCRATCH_ARENA); this frees the calling thread's arena, e.g. before
+// a worker thread that decoded images exits
+STBIDEF void     stbi_scratch_release (void);
+
 // get image dimensions & components without fully decoding
 STBIDEF int      stbi_info_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp);
 STBIDEF int      stbi_info_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *comp);
@@ -452,6 +500,20 @@ STBIDEF int      stbi_is_16_bit          (char const *filename);
 STBIDEF int      stbi_is_16_bit_from_file(FILE *f);
 #endif
 
+// everything stbi_info, stbi_is_16_bit and stbi_is_hdr report, plus whether a JPEG is
+// progressive, from one pass over the header. the formats are tried in the same order as
+// stbi_info, but JPEG and PNG headers are only parsed once instead of once per question
+typedef struct
+{
+   int x, y;
+   int channels;           // as stbi_info reports them
+   int bits_per_channel;   // 8, 16, or 32 for HDR images, which load as floats
+   int is_hdr;
+   int is_progressive;     // a progressive JPEG, which takes several passes over the file to decode
+} stbi_header;
+
+STBIDEF int      stbi_header_from_memory (stbi_uc const *buffer, int len, stbi_header *header);
+
 
 
 // for image formats that explicitly notate that they have premultiplied alpha,
@@ -466,6 +528,78 @@ STBIDEF void stbi_convert_iphone_png_to_rgb(int flag_true_if_should_convert);
 // flip the image vertically, so the first pixel in the output array is the bottom left
 STBIDEF void stbi_set_flip_vertically_on_load(int flag_true_if_should_flip);
 
+// the three settings above are global and NOT THREADSAFE: changing them while another
+// thread is loading is a data race, and every thread has to agree on them. to load with
+// different settings on several threads at once, pass them along with each load instead.
+// zero-initialize the options (or call stbi_load_options_default) and set what you need.
+// the options are only read, so one set can be shared by every thread. failures are
+// reported through stbi_failure_reason, which is per thread wherever thread locals exist
+
+typedef struct
+{
+   int flip_vertically;          // as stbi_set_flip_vertically_on_load
+   int unpremultiply;            // as stbi_set_unpremultiply_on_load
+   int convert_iphone_png;       // as stbi_convert_iphone_png_to_rgb
+   int scale;                    // 0 or 1 for full size, 2, 4 or 8 as in stbi_load_scaled (8-bit loads only)
+} stbi_load_options;
+
+STBIDEF void     stbi_load_options_default          (stbi_load_options *options);
+STBIDEF stbi_uc *stbi_load_from_memory_with_options(stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels, stbi_load_options const *options);
+#ifndef STBI_NO_STDIO
+STBIDEF stbi_uc *stbi_load_with_options            (char const *filename, int *x, int *y, int *channels_in_file, int desired_channels, stbi_load_options const *options);
+#endif
+STBIDEF stbi_us *stbi_load_16_from_memory_with_options(stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels, stbi_load_options const *options);
+#ifndef STBI_NO_LINEAR
+STBIDEF float   *stbi_loadf_from_memory_with_options  (stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels, stbi_load_options const *options);
+#endif
+
+// PROGRESSIVE JPEG - incremental decoding, one scan at a time
+//
+// A progressive JPEG stores the whole image several times over at increasing quality, so
+// a usable (if blurry) image is available long before all of the file has been decoded.
+// Open the file with stbi_progressive_jpeg_open(), which keeps pointing at the buffer (so
+// it has to outlive the decoder), then call stbi_progressive_jpeg_next_scan() until it
+// returns 0. After any scan, stbi_progressive_jpeg_image() returns the image as decoded
+// so far, in the same format stbi_load_from_memory() would return it; the last one is
+// identical to what stbi_load_from_memory() gives. Once stbi_progressive_jpeg_dc_complete()
+// returns 1 every 8x8 block has its average colour, which is all a copy at 1/8 of the size
+// or smaller needs. Baseline JPEGs work as well, they simply finish in one scan per
+// component.
+
+typedef struct stbi__progressive_jpeg stbi_progressive_jpeg;
+
+STBIDEF stbi_progressive_jpeg *stbi_progressive_jpeg_open      (stbi_uc const *buffer, int len);
+STBIDEF stbi_progressive_jpeg *stbi_progressive_jpeg_open_with_options(stbi_uc const *buffer, int len, stbi_load_options const *options);
+STBIDEF int                    stbi_progressive_jpeg_next_scan (stbi_progressive_jpeg *p);
+STBIDEF int                    stbi_progressive_jpeg_dc_complete(stbi_progressive_jpeg *p);
+STBIDEF int                    stbi_progressive_jpeg_done      (stbi_progressive_jpeg *p);
+STBIDEF int                    stbi_progressive_jpeg_is_progressive(stbi_progressive_jpeg *p);
+STBIDEF stbi_uc               *stbi_progressive_jpeg_image     (stbi_progressive_jpeg *p, int *x, int *y, int *channels_in_file, int desired_channels);
+STBIDEF void                   stbi_progressive_jpeg_close     (stbi_progressive_jpeg *p);
+
+// ANIMATED GIF - one frame at a time
+//
+// stbi_load_gif_from_memory() returns every frame of an animation in one allocation, which
+// for a long animation can be hundreds of MB. stbi_gif_frames_open() instead decodes the
+// frames on demand: every call to stbi_gif_frames_next() returns the next frame, composited
+// the same way stbi_load_gif_from_memory() does it, in a buffer that is reused for every
+// frame (so copy or upload it before the next call). It returns NULL after the last frame,
+// or early if the rest of the file is corrupt. Like the progressive JPEG decoder, it keeps
+// pointing at the buffer, which has to outlive it.
+//
+// Opening skims the file once without decoding anything, so the number of frames and all of
+// their delays (in milliseconds) are known before the first frame is decoded.
+
+typedef struct stbi__gif_frames stbi_gif_frames;
+
+#ifndef STBI_NO_GIF
+STBIDEF stbi_gif_frames *stbi_gif_frames_open     (stbi_uc const *buffer, int len, int *x, int *y, int *frame_count);
+STBIDEF stbi_gif_frames *stbi_gif_frames_open_with_options(stbi_uc const *buffer, int len, int *x, int *y, int *frame_count, stbi_load_options const *options);
+STBIDEF int const       *stbi_gif_frames_delays   (stbi_gif_frames *f);
+STBIDEF stbi_uc         *stbi_gif_frames_next     (stbi_gif_frames *f, int *delay, int desired_channels);
+STBIDEF void             stbi_gif_frames_close    (stbi_gif_frames *f);
+#endif
+
 // ZLIB client - used by PNG, available for other purposes
 
 STBIDEF char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int initial_size, int *outlen);
@@ -675,7 +809,7 @@ static int stbi__cpuid3(void)
 
 #define STBI_SIMD_ALIGN(type, name) __declspec(align(16)) type name
 
-#if !defined(STBI_NO_JPEG) && defined(STBI_SSE2)
+#if (!defined(STBI_NO_JPEG) || !defined(STBI_NO_HDR)) && defined(STBI_SSE2)
 static int stbi__sse2_available(void)
 {
    int info3 = stbi__cpuid3();
@@ -686,7 +820,7 @@ static int stbi__sse2_available(void)
 #else // assume GCC-style if not VC++
 #define STBI_SIMD_ALIGN(type, name) type name __attribute__((aligned(16)))
 
-#if !defined(STBI_NO_JPEG) && defined(STBI_SSE2)
+#if (!defined(STBI_NO_JPEG) || !defined(STBI_NO_HDR)) && defined(STBI_SSE2)
 static int stbi__sse2_available(void)
 {
    // If we're even attempting to compile this on GCC/Clang, that means
@@ -699,6 +833,61 @@ static int stbi__sse2_available(void)
 #endif
 #endif
 
+// SSSE3 for the channel conversion loops. Unlike SSE2 it isn't part of every
+// x64 CPU, so it's always checked for at run-time
+#if defined(STBI_SSE2) && !defined(STBI_NO_SSSE3) && (defined(__GNUC__) || defined(__clang__) || (defined(_MSC_VER) && _MSC_VER >= 1400))
+#define STBI__SSSE3
+#include <tmmintrin.h>
+
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(__SSSE3__)
+#define STBI__SSSE3_TARGET __attribute__((target("ssse3")))
+#else
+#define STBI__SSSE3_TARGET
+#endif
+
+static int stbi__ssse3_available(void)
+{
+#if defined(__SSSE3__)
+   return 1;
+#elif defined(_MSC_VER)
+   int info[4];
+   __cpuid(info,1);
+   return ((info[2] >> 9) & 1) != 0;
+#else
+   return __builtin_cpu_supports("ssse3") != 0;
+#endif
+}
+#endif
+
+// F16C for converting floats to half floats. its instructions are VEX encoded, so
+// besides the CPU having it the OS has to save the AVX registers
+#if defined(STBI_SSE2) && !defined(STBI_NO_F16C) && !defined(STBI_NO_LINEAR) && (defined(__GNUC__) || defined(__clang__) || (defined(_MSC_VER) && _MSC_VER >= 1600))
+#define STBI__F16C
+#include <immintrin.h>
+
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(__F16C__)
+#include <cpuid.h>
+#define STBI__F16C_TARGET __attribute__((target("avx,f16c")))
+#else
+#define STBI__F16C_TARGET
+#endif
+
+static int stbi__f16c_available(void)
+{
+#if defined(__F16C__)
+   return 1;
+#elif defined(_MSC_VER)
+   int info[4];
+   __cpuid(info,1);
+   // OSXSAVE, AVX and F16C
+   return (info[2] & 0x38000000) == 0x38000000 && (_xgetbv(0) & 6) == 6;
+#else
+   unsigned int eax, ebx, ecx, edx;
+   return __builtin_cpu_supports("avx") && __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & (1u << 29)) != 0;
+#endif
+}
+#endif
+
 // ARM NEON
 #if defined(STBI_NO_SIMD) && defined(STBI_NEON)
 #undef STBI_NEON
@@ -714,6 +903,20 @@ static int stbi__sse2_available(void)
 #define STBI_SIMD_ALIGN(type, name) type name
 #endif
 
+#ifndef STBI_THREAD_LOCAL
+   #if defined(__cplusplus) && __cplusplus >= 201103L
+      #define STBI_THREAD_LOCAL       thread_local
+   #elif defined(__GNUC__) && __GNUC__ < 5
+      #define STBI_THREAD_LOCAL       __thread
+   #elif defined(_MSC_VER)
+      #define STBI_THREAD_LOCAL       __declspec(thread)
+   #elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_THREADS__)
+      #define STBI_THREAD_LOCAL       _Thread_local
+   #elif defined(__GNUC__)
+      #define STBI_THREAD_LOCAL       __thread
+   #endif
+#endif
+
 ///////////////////////////////////////////////
 //
 //  stbi__context struct and start_xxx functions
@@ -734,8 +937,15 @@ typedef struct
 
    stbi_uc *img_buffer, *img_buffer_end;
    stbi_uc *img_buffer_original, *img_buffer_original_end;
+
+   // settings for this load, taken from the globals unless stbi_load_options says otherwise
+   int flip_vertically;
+   int unpremultiply;
+   int de_iphone;
 } stbi__context;
 
+static void stbi__start_options(stbi__context *s);
+
 
 static void stbi__refill_buffer(stbi__context *s);
 
@@ -746,6 +956,7 @@ static void stbi__start_mem(stbi__context *s, stbi_uc const *buffer, int len)
    s->read_from_callbacks = 0;
    s->img_buffer = s->img_buffer_original = (stbi_uc *) buffer;
    s->img_buffer_end = s->img_buffer_original_end = (stbi_uc *) buffer+len;
+   stbi__start_options(s);
 }
 
 // initialize a callback-based context
@@ -758,6 +969,7 @@ static void stbi__start_callbacks(stbi__context *s, stbi_io_callbacks *c, void *
    s->img_buffer_original = s->buffer_start;
    stbi__refill_buffer(s);
    s->img_buffer_original_end = s->img_buffer_end;
+   stbi__start_options(s);
 }
 
 #ifndef STBI_NO_STDIO
@@ -813,12 +1025,14 @@ typedef struct
    int bits_per_channel;
    int num_channels;
    int channel_order;
+   int flipped;   // the loader already wrote the rows bottom-up, as s->flip_vertically asked
 } stbi__result_info;
 
 #ifndef STBI_NO_JPEG
 static int      stbi__jpeg_test(stbi__context *s);
 static void    *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri);
 static int      stbi__jpeg_info(stbi__context *s, int *x, int *y, int *comp);
+static stbi_uc *stbi__jpeg_load_scaled(stbi__context *s, int *x, int *y, int *comp, int req_comp, int scale_shift);
 #endif
 
 #ifndef STBI_NO_PNG
@@ -872,8 +1086,12 @@ static void    *stbi__pnm_load(stbi__context *s, int *x, int *y, int *comp, int
 static int      stbi__pnm_info(stbi__context *s, int *x, int *y, int *comp);
 #endif
 
+#ifdef STBI_THREAD_LOCAL
+static STBI_THREAD_LOCAL const char *stbi__g_failure_reason;
+#else
 // this is not threadsafe
 static const char *stbi__g_failure_reason;
+#endif
 
 STBIDEF const char *stbi_failure_reason(void)
 {
@@ -891,6 +1109,175 @@ static void *stbi__malloc(size_t size)
     return STBI_MALLOC(size);
 }
 
+// scratch memory: buffers a decoder only needs while it runs (JPEG component planes and the
+// JPEG decoder itself, the PNG zlib stream and what it inflates to, HDR scanlines) come from
+// a per-thread arena instead of STBI_MALLOC. allocating bumps a pointer, freeing the most
+// recent allocation gives its space back, and once everything has been freed -- which is at
+// the end of every decode -- the arena starts over from the beginning of its block. if a
+// decode didn't fit, the next one starts with a block big enough for it, so after the first
+// image a thread decodes, images of the same size or smaller do no scratch mallocs at all.
+//
+// images handed back to the caller still come from STBI_MALLOC, since they're freed with
+// stbi_image_free long after the decode, and so do the buffers of stbi_progressive_jpeg and
+// stbi_gif_frames, which live across calls and possibly threads. without thread locals the
+// arena would be shared between threads, so there scratch memory is plain STBI_MALLOC.
+#if defined(STBI_THREAD_LOCAL) && !defined(STBI_NO_SCRATCH_ARENA)
+#define STBI__SCRATCH_ARENA
+
+#ifndef STBI_SCRATCH_KEEP
+#define STBI_SCRATCH_KEEP   (64 << 20)  // arenas that grew past this are freed between decodes
+#endif
+#define STBI__SCRATCH_ALIGN 16          // every allocation starts this far past a header holding its size
+#define STBI__SCRATCH_MIN   (256 << 10)
+
+typedef struct stbi__scratch_block
+{
+   struct stbi__scratch_block *prev;   // full blocks that may still hold live allocations
+   size_t size;
+} stbi__scratch_block;
+
+typedef struct
+{
+   stbi__scratch_block *block;   // the block allocations are carved from
+   size_t used;                  // offset of its first free byte
+   size_t last;                  // offset of the most recent allocation, 0 once that's been freed
+   size_t in_use, peak;          // bytes taken from all blocks now, and the most at any point
+   size_t next_size;             // size of the next block, when the last decode didn't fit
+   int live;                     // allocations not freed yet
+} stbi__scratch_arena;
+
+static STBI_THREAD_LOCAL stbi__scratch_arena stbi__g_scratch;
+
+#define stbi__scratch_round(n)   (((n) + STBI__SCRATCH_ALIGN-1) & ~(size_t) (STBI__SCRATCH_ALIGN-1))
+#define stbi__scratch_start      stbi__scratch_round(sizeof(stbi__scratch_block))
+
+static void stbi__scratch_free_blocks(stbi__scratch_arena *a)
+{
+   while (a->block) {
+      stbi__scratch_block *prev = a->block->prev;
+      STBI_FREE(a->block);
+      a->block = prev;
+   }
+   a->used = a->last = 0;
+}
+
+static int stbi__scratch_grow(stbi__scratch_arena *a, size_t need)
+{
+   // sized to hold everything the decode has taken so far, so the next one fits in one block
+   size_t size = a->in_use + need;
+   stbi__scratch_block *b;
+   if (size < a->next_size) size = a->next_size;
+   if (size < STBI__SCRATCH_MIN) size = STBI__SCRATCH_MIN;
+   size += stbi__scratch_start;
+   b = (stbi__scratch_block *) STBI_MALLOC(size);
+   if (b == NULL) return 0;
+   b->prev = a->block;
+   b->size = size;
+   a->block = b;
+   a->used = stbi__scratch_start;
+   a->last = 0;
+   a->next_size = 0;
+   return 1;
+}
+
+static void *stbi__scratch_alloc(size_t size)
+{
+   stbi__scratch_arena *a = &stbi__g_scratch;
+   size_t need = STBI__SCRATCH_ALIGN + stbi__scratch_round(size);
+   stbi_uc *p;
+   if (size > INT_MAX) return NULL;
+   if (a->block == NULL || a->used + need > a->block->size)
+      if (!stbi__scratch_grow(a, need)) return NULL;
+   p = (stbi_uc *) a->block + a->used;
+   *(size_t *) p = size;
+   a->last = a->used + STBI__SCRATCH_ALIGN;
+   a->used += need;
+   a->in_use += need;
+   if (a->in_use > a->peak) a->peak = a->in_use;
+   ++a->live;
+   return p + STBI__SCRATCH_ALIGN;
+}
+
+static int stbi__scratch_is_last(stbi__scratch_arena *a, void *p)
+{
+   return a->last && (stbi_uc *) p == (stbi_uc *) a->block + a->last;
+}
+
+static void stbi__scratch_free(void *p)
+{
+   stbi__scratch_arena *a = &stbi__g_scratch;
+   if (p == NULL) return;
+   if (stbi__scratch_is_last(a, p)) {
+      a->in_use -= a->used - (a->last - STBI__SCRATCH_ALIGN);
+      a->used = a->last - STBI__SCRATCH_ALIGN;
+      a->last = 0;
+   }
+   if (--a->live == 0) {
+      // the decode is over. spilling into more than one block means the next decode should
+      // get a single block of the size this one peaked at, and huge ones aren't kept around
+      if (a->block->prev || a->block->size > STBI_SCRATCH_KEEP) {
+         stbi__scratch_free_blocks(a);
+         a->next_size = a->peak <= STBI_SCRATCH_KEEP ? a->peak : 0;
+      }
+      a->used = stbi__scratch_start;
+      a->last = 0;
+      a->in_use = a->peak = 0;
+   }
+}
+
+static void *stbi__scratch_realloc(void *p, size_t oldsz, size_t newsz)
+{
+   stbi__scratch_arena *a = &stbi__g_scratch;
+   void *q;
+   if (p == NULL) return stbi__scratch_alloc(newsz);
+   if (newsz > INT_MAX) return NULL;
+   oldsz = *(size_t *) ((stbi_uc *) p - STBI__SCRATCH_ALIGN);
+   // growing the most recent allocation happens in place, as long as the block has room
+   if (stbi__scratch_is_last(a, p) && a->last + stbi__scratch_round(newsz) <= a->block->size) {
+      size_t end = a->last + stbi__scratch_round(newsz);
+      a->in_use = a->in_use - a->used + end;
+      if (a->in_use > a->peak) a->peak = a->in_use;
+      a->used = end;
+      *(size_t *) ((stbi_uc *) p - STBI__SCRATCH_ALIGN) = newsz;
+      return p;
+   }
+   q = stbi__scratch_alloc(newsz);
+   if (q == NULL) return NULL;
+   memcpy(q, p, oldsz < newsz ? oldsz : newsz);
+   stbi__scratch_free(p);
+   return q;
+}
+
+STBIDEF void stbi_scratch_release(void)
+{
+   stbi__scratch_arena *a = &stbi__g_scratch;
+   if (a->live == 0) {
+      stbi__scratch_free_blocks(a);
+      a->next_size = 0;
+   }
+}
+#else
+static void *stbi__scratch_alloc(size_t size)
+{
+   return STBI_MALLOC(size);
+}
+
+static void stbi__scratch_free(void *p)
+{
+   STBI_FREE(p);
+}
+
+static void *stbi__scratch_realloc(void *p, size_t oldsz, size_t newsz)
+{
+   STBI_NOTUSED(oldsz);
+   return STBI_REALLOC_SIZED(p, oldsz, newsz);
+}
+
+STBIDEF void stbi_scratch_release(void)
+{
+}
+#endif
+
 // stb_image uses ints pervasively, including for offset calculations.
 // therefore the largest decoded image size we can support with the
 // current code, even on 64-bit targets, is INT_MAX. this is not a
@@ -988,6 +1375,7 @@ STBIDEF void stbi_image_free(void *retval_from_stbi_load)
 
 #ifndef STBI_NO_LINEAR
 static float   *stbi__ldr_to_hdr(stbi_uc *data, int x, int y, int comp);
+static stbi__uint16 *stbi__float_to_half_image(float *data, int x, int y, int comp);
 #endif
 
 #ifndef STBI_NO_HDR
@@ -995,12 +1383,33 @@ static stbi_uc *stbi__hdr_to_ldr(float   *data, int x, int y, int comp);
 #endif
 
 static int stbi__vertically_flip_on_load = 0;
+static int stbi__unpremultiply_on_load = 0;
+static int stbi__de_iphone_flag = 0;
 
 STBIDEF void stbi_set_flip_vertically_on_load(int flag_true_if_should_flip)
 {
     stbi__vertically_flip_on_load = flag_true_if_should_flip;
 }
 
+static void stbi__start_options(stbi__context *s)
+{
+   s->flip_vertically = stbi__vertically_flip_on_load;
+   s->unpremultiply = stbi__unpremultiply_on_load;
+   s->de_iphone = stbi__de_iphone_flag;
+}
+
+static void stbi__apply_options(stbi__context *s, stbi_load_options const *options)
+{
+   s->flip_vertically = options->flip_vertically;
+   s->unpremultiply = options->unpremultiply;
+   s->de_iphone = options->convert_iphone_png;
+}
+
+STBIDEF void stbi_load_options_default(stbi_load_options *options)
+{
+   memset(options, 0, sizeof(*options));
+}
+
 static void *stbi__load_main(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri, int bpc)
 {
    memset(ri, 0, sizeof(*ri)); // make sure it's initialized if we add new fields
@@ -1046,33 +1455,44 @@ static void *stbi__load_main(stbi__context *s, int *x, int *y, int *comp, int re
    return stbi__errpuc("unknown image type", "Image not of any known type, or corrupt");
 }
 
-static stbi_uc *stbi__convert_16_to_8(stbi__uint16 *orig, int w, int h, int channels)
+// when flip is set, the rows are written bottom-up so the image doesn't need a separate flip
+static stbi_uc *stbi__convert_16_to_8(stbi__uint16 *orig, int w, int h, int channels, int flip)
 {
-   int i;
-   int img_len = w * h * channels;
+   int i,j;
+   int row_len = w * channels;
+   int img_len = row_len * h;
    stbi_uc *reduced;
 
    reduced = (stbi_uc *) stbi__malloc(img_len);
    if (reduced == NULL) return stbi__errpuc("outofmem", "Out of memory");
 
-   for (i = 0; i < img_len; ++i)
-      reduced[i] = (stbi_uc)((orig[i] >> 8) & 0xFF); // top half of each byte is sufficient approx of 16->8 bit scaling
+   for (j = 0; j < h; ++j) {
+      stbi__uint16 *src = orig + j * row_len;
+      stbi_uc *dest = reduced + (flip ? h-1-j : j) * row_len;
+      for (i = 0; i < row_len; ++i)
+         dest[i] = (stbi_uc)((src[i] >> 8) & 0xFF); // top half of each byte is sufficient approx of 16->8 bit scaling
+   }
 
    STBI_FREE(orig);
    return reduced;
 }
 
-static stbi__uint16 *stbi__convert_8_to_16(stbi_uc *orig, int w, int h, int channels)
+static stbi__uint16 *stbi__convert_8_to_16(stbi_uc *orig, int w, int h, int channels, int flip)
 {
-   int i;
-   int img_len = w * h * channels;
+   int i,j;
+   int row_len = w * channels;
+   int img_len = row_len * h;
    stbi__uint16 *enlarged;
 
    enlarged = (stbi__uint16 *) stbi__malloc(img_len*2);
    if (enlarged == NULL) return (stbi__uint16 *) stbi__errpuc("outofmem", "Out of memory");
 
-   for (i = 0; i < img_len; ++i)
-      enlarged[i] = (stbi__uint16)((orig[i] << 8) + orig[i]); // replicate to high and low byte, maps 0->0, 255->0xffff
+   for (j = 0; j < h; ++j) {
+      stbi_uc *src = orig + j * row_len;
+      stbi__uint16 *dest = enlarged + (flip ? h-1-j : j) * row_len;
+      for (i = 0; i < row_len; ++i)
+         dest[i] = (stbi__uint16)((src[i] << 8) + src[i]); // replicate to high and low byte, maps 0->0, 255->0xffff
+   }
 
    STBI_FREE(orig);
    return enlarged;
@@ -1126,13 +1546,14 @@ static unsigned char *stbi__load_and_postprocess_8bit(stbi__context *s, int *x,
 
    if (ri.bits_per_channel != 8) {
       STBI_ASSERT(ri.bits_per_channel == 16);
-      result = stbi__convert_16_to_8((stbi__uint16 *) result, *x, *y, req_comp == 0 ? *comp : req_comp);
+      result = stbi__convert_16_to_8((stbi__uint16 *) result, *x, *y, req_comp == 0 ? *comp : req_comp, s->flip_vertically && !ri.flipped);
       ri.bits_per_channel = 8;
+      ri.flipped = s->flip_vertically;
    }
 
    // @TODO: move stbi__convert_format to here
 
-   if (stbi__vertically_flip_on_load) {
+   if (s->flip_vertically && !ri.flipped) {
       int channels = req_comp ? req_comp : *comp;
       stbi__vertical_flip(result, *x, *y, channels * sizeof(stbi_uc));
    }
@@ -1150,14 +1571,15 @@ static stbi__uint16 *stbi__load_and_postprocess_16bit(stbi__context *s, int *x,
 
    if (ri.bits_per_channel != 16) {
       STBI_ASSERT(ri.bits_per_channel == 8);
-      result = stbi__convert_8_to_16((stbi_uc *) result, *x, *y, req_comp == 0 ? *comp : req_comp);
+      result = stbi__convert_8_to_16((stbi_uc *) result, *x, *y, req_comp == 0 ? *comp : req_comp, s->flip_vertically && !ri.flipped);
       ri.bits_per_channel = 16;
+      ri.flipped = s->flip_vertically;
    }
 
    // @TODO: move stbi__convert_format16 to here
    // @TODO: special case RGB-to-Y (and RGBA-to-YA) for 8-bit-to-16-bit case to keep more precision
 
-   if (stbi__vertically_flip_on_load) {
+   if (s->flip_vertically && !ri.flipped) {
       int channels = req_comp ? req_comp : *comp;
       stbi__vertical_flip(result, *x, *y, channels * sizeof(stbi__uint16));
    }
@@ -1166,9 +1588,9 @@ static stbi__uint16 *stbi__load_and_postprocess_16bit(stbi__context *s, int *x,
 }
 
 #if !defined(STBI_NO_HDR) && !defined(STBI_NO_LINEAR)
-static void stbi__float_postprocess(float *result, int *x, int *y, int *comp, int req_comp)
+static void stbi__float_postprocess(stbi__context *s, float *result, int *x, int *y, int *comp, int req_comp)
 {
-   if (stbi__vertically_flip_on_load && result != NULL) {
+   if (s->flip_vertically && result != NULL) {
       int channels = req_comp ? req_comp : *comp;
       stbi__vertical_flip(result, *x, *y, channels * sizeof(float));
    }
@@ -1267,6 +1689,76 @@ STBIDEF stbi_us *stbi_load_16(char const *filename, int *x, int *y, int *comp, i
 
 #endif //!STBI_NO_STDIO
 
+static stbi_uc *stbi__load_scaled(stbi__context *s, int *x, int *y, int *comp, int req_comp, int scale)
+{
+   int shift = scale == 8 ? 3 : scale == 4 ? 2 : scale == 2 ? 1 : scale == 1 ? 0 : -1;
+   if (shift < 0) return stbi__errpuc("bad scale", "Scale must be 1, 2, 4 or 8");
+   #ifndef STBI_NO_JPEG
+   if (shift > 0 && stbi__jpeg_test(s)) {
+      return stbi__jpeg_load_scaled(s, x, y, comp, req_comp, shift);
+   }
+   #endif
+   return stbi__load_and_postprocess_8bit(s, x, y, comp, req_comp);
+}
+
+#ifndef STBI_NO_STDIO
+STBIDEF stbi_uc *stbi_load_scaled(char const *filename, int *x, int *y, int *comp, int req_comp, int scale)
+{
+   FILE *f = stbi__fopen(filename, "rb");
+   unsigned char *result;
+   stbi__context s;
+   if (!f) return stbi__errpuc("can't fopen", "Unable to open file");
+   stbi__start_file(&s,f);
+   result = stbi__load_scaled(&s,x,y,comp,req_comp,scale);
+   fclose(f);
+   return result;
+}
+#endif
+
+STBIDEF stbi_uc *stbi_load_scaled_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, int scale)
+{
+   stbi__context s;
+   stbi__start_mem(&s,buffer,len);
+   return stbi__load_scaled(&s,x,y,comp,req_comp,scale);
+}
+
+static stbi_uc *stbi__load_with_options(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi_load_options const *options)
+{
+   stbi__apply_options(s, options);
+   stbi__g_failure_reason = NULL;
+   return stbi__load_scaled(s, x, y, comp, req_comp, options->scale ? options->scale : 1);
+}
+
+STBIDEF stbi_uc *stbi_load_from_memory_with_options(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, stbi_load_options const *options)
+{
+   stbi__context s;
+   stbi__start_mem(&s,buffer,len);
+   return stbi__load_with_options(&s,x,y,comp,req_comp,options);
+}
+
+#ifndef STBI_NO_STDIO
+STBIDEF stbi_uc *stbi_load_with_options(char const *filename, int *x, int *y, int *comp, int req_comp, stbi_load_options const *options)
+{
+   FILE *f = stbi__fopen(filename, "rb");
+   unsigned char *result;
+   stbi__context s;
+   if (!f) return stbi__errpuc("can't fopen", "Unable to open file");
+   stbi__start_file(&s,f);
+   result = stbi__load_with_options(&s,x,y,comp,req_comp,options);
+   fclose(f);
+   return result;
+}
+#endif
+
+STBIDEF stbi_us *stbi_load_16_from_memory_with_options(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, stbi_load_options const *options)
+{
+   stbi__context s;
+   stbi__start_mem(&s,buffer,len);
+   stbi__apply_options(&s, options);
+   stbi__g_failure_reason = NULL;
+   return stbi__load_and_postprocess_16bit(&s,x,y,comp,req_comp);
+}
+
 STBIDEF stbi_us *stbi_load_16_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels)
 {
    stbi__context s;
@@ -1303,8 +1795,8 @@ STBIDEF stbi_uc *stbi_load_gif_from_memory(stbi_uc const *buffer, int len, int *
    stbi__start_mem(&s,buffer,len); 
    
    result = (unsigned char*) stbi__load_gif_main(&s, delays, x, y, z, comp, req_comp);
-   if (stbi__vertically_flip_on_load) {
-      stbi__vertical_flip_slices( result, *x, *y, *z, *comp ); 
+   if (result && s.flip_vertically) {
+      stbi__vertical_flip_slices( result, *x, *y, *z, req_comp ? req_comp : *comp ); 
    }
 
    return result; 
@@ -1320,7 +1812,7 @@ static float *stbi__loadf_main(stbi__context *s, int *x, int *y, int *comp, int
       stbi__result_info ri;
       float *hdr_data = stbi__hdr_load(s,x,y,comp,req_comp, &ri);
       if (hdr_data)
-         stbi__float_postprocess(hdr_data,x,y,comp,req_comp);
+         stbi__float_postprocess(s,hdr_data,x,y,comp,req_comp);
       return hdr_data;
    }
    #endif
@@ -1337,6 +1829,15 @@ STBIDEF float *stbi_loadf_from_memory(stbi_uc const *buffer, int len, int *x, in
    return stbi__loadf_main(&s,x,y,comp,req_comp);
 }
 
+STBIDEF float *stbi_loadf_from_memory_with_options(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, stbi_load_options const *options)
+{
+   stbi__context s;
+   stbi__start_mem(&s,buffer,len);
+   stbi__apply_options(&s, options);
+   stbi__g_failure_reason = NULL;
+   return stbi__loadf_main(&s,x,y,comp,req_comp);
+}
+
 STBIDEF float *stbi_loadf_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *comp, int req_comp)
 {
    stbi__context s;
@@ -1363,6 +1864,46 @@ STBIDEF float *stbi_loadf_from_file(FILE *f, int *x, int *y, int *comp, int req_
 }
 #endif // !STBI_NO_STDIO
 
+static stbi_us *stbi__load_half_main(stbi__context *s, int *x, int *y, int *comp, int req_comp)
+{
+   float *data = stbi__loadf_main(s, x, y, comp, req_comp);
+   if (!data) return NULL;
+   return stbi__float_to_half_image(data, *x, *y, req_comp ? req_comp : *comp);
+}
+
+STBIDEF stbi_us *stbi_load_half_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp)
+{
+   stbi__context s;
+   stbi__start_mem(&s,buffer,len);
+   return stbi__load_half_main(&s,x,y,comp,req_comp);
+}
+
+STBIDEF stbi_us *stbi_load_half_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *comp, int req_comp)
+{
+   stbi__context s;
+   stbi__start_callbacks(&s, (stbi_io_callbacks *) clbk, user);
+   return stbi__load_half_main(&s,x,y,comp,req_comp);
+}
+
+#ifndef STBI_NO_STDIO
+STBIDEF stbi_us *stbi_load_half(char const *filename, int *x, int *y, int *comp, int req_comp)
+{
+   stbi_us *result;
+   FILE *f = stbi__fopen(filename, "rb");
+   if (!f) return (stbi_us *) stbi__errpuc("can't fopen", "Unable to open file");
+   result = stbi_load_half_from_file(f,x,y,comp,req_comp);
+   fclose(f);
+   return result;
+}
+
+STBIDEF stbi_us *stbi_load_half_from_file(FILE *f, int *x, int *y, int *comp, int req_comp)
+{
+   stbi__context s;
+   stbi__start_file(&s,f);
+   return stbi__load_half_main(&s,x,y,comp,req_comp);
+}
+#endif // !STBI_NO_STDIO
+
 #endif // !STBI_NO_LINEAR
 
 // these is-hdr-or-not is defined independent of whether STBI_NO_LINEAR is
@@ -1572,32 +2113,212 @@ static stbi__uint32 stbi__get32le(stbi__context *s)
 //
 //  assume data buffer is malloced, so malloc a new one and free that one
 //  only failure mode is malloc failing
+//
+//  when flip is set the rows are also written bottom-up, so loaders that convert
+//  get the vertical flip for free instead of as another pass over the image
 
 static stbi_uc stbi__compute_y(int r, int g, int b)
 {
    return (stbi_uc) (((r*77) + (g*150) +  (29*b)) >> 8);
 }
 
-static unsigned char *stbi__convert_format(unsigned char *data, int img_n, int req_comp, unsigned int x, unsigned int y)
+#ifdef STBI__SSSE3
+// converts whole blocks of 16 pixels, returning how many pixels it did. every block is
+// first brought to 4 registers of 4 rgba pixels each, then written out as req_comp
+STBI__SSSE3_TARGET
+static int stbi__convert_row_simd(unsigned char *dest, unsigned char const *src, int img_n, int req_comp, int count)
+{
+   int i,k;
+   __m128i alpha = _mm_set1_epi32((int) 0xff000000);
+   __m128i zero = _mm_setzero_si128();
+   __m128i rgb_to_rgba = _mm_setr_epi8(0,1,2,-1, 3,4,5,-1, 6,7,8,-1, 9,10,11,-1);
+   __m128i rgba_to_rgb = _mm_setr_epi8(0,1,2,4, 5,6,8,9, 10,12,13,14, -1,-1,-1,-1);
+   __m128i ga_to_rgba  = _mm_setr_epi8(0,0,0,1, 2,2,2,3, 4,4,4,5, 6,6,6,7);
+   __m128i g_to_rgba   = _mm_setr_epi8(0,0,0,-1, 1,1,1,-1, 2,2,2,-1, 3,3,3,-1);
+   __m128i planar      = _mm_setr_epi8(0,4,8,12, 1,5,9,13, 2,6,10,14, 3,7,11,15);
+   __m128i w_r = _mm_set1_epi16(77), w_g = _mm_set1_epi16(150), w_b = _mm_set1_epi16(29);
+
+   for (i=0; i + 16 <= count; i += 16, src += 16*img_n, dest += 16*req_comp) {
+      __m128i px[4];
+
+      switch (img_n) {
+         case 1: {
+            __m128i g = _mm_loadu_si128((__m128i const *) src);
+            px[0] = _mm_or_si128(_mm_shuffle_epi8(g, g_to_rgba), alpha);
+            px[1] = _mm_or_si128(_mm_shuffle_epi8(_mm_srli_si128(g, 4), g_to_rgba), alpha);
+            px[2] = _mm_or_si128(_mm_shuffle_epi8(_mm_srli_si128(g, 8), g_to_rgba), alpha);
+            px[3] = _mm_or_si128(_mm_shuffle_epi8(_mm_srli_si128(g, 12), g_to_rgba), alpha);
+            break;
+         }
+         case 2: {
+            __m128i ga0 = _mm_loadu_si128((__m128i const *) src);
+            __m128i ga1 = _mm_loadu_si128((__m128i const *) (src + 16));
+            px[0] = _mm_shuffle_epi8(ga0, ga_to_rgba);
+            px[1] = _mm_shuffle_epi8(_mm_srli_si128(ga0, 8), ga_to_rgba);
+            px[2] = _mm_shuffle_epi8(ga1, ga_to_rgba);
+            px[3] = _mm_shuffle_epi8(_mm_srli_si128(ga1, 8), ga_to_rgba);
+            break;
+         }
+         case 3: {
+            // 48 bytes hold the 16 pixels, so every 4 of them start 12 bytes further
+            __m128i v0 = _mm_loadu_si128((__m128i const *) src);
+            __m128i v1 = _mm_loadu_si128((__m128i const *) (src + 16));
+            __m128i v2 = _mm_loadu_si128((__m128i const *) (src + 32));
+            px[0] = _mm_or_si128(_mm_shuffle_epi8(v0, rgb_to_rgba), alpha);
+            px[1] = _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(v1, v0, 12), rgb_to_rgba), alpha);
+            px[2] = _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(v2, v1, 8), rgb_to_rgba), alpha);
+            px[3] = _mm_or_si128(_mm_shuffle_epi8(_mm_srli_si128(v2, 4), rgb_to_rgba), alpha);
+            break;
+         }
+         default:
+            for (k=0; k < 4; ++k)
+               px[k] = _mm_loadu_si128((__m128i const *) (src + 16*k));
+            break;
+      }
+
+      switch (req_comp) {
+         case 1:
+         case 2: {
+            // luma of 8 pixels at a time in 16 bits; the weights add up to 256 so the
+            // sum never exceeds 65280, and grey pixels come out exactly as they went in
+            __m128i y[2], a[2];
+            for (k=0; k < 2; ++k) {
+               __m128i p0 = _mm_shuffle_epi8(px[2*k  ], planar);
+               __m128i p1 = _mm_shuffle_epi8(px[2*k+1], planar);
+               __m128i rg = _mm_unpacklo_epi32(p0, p1);
+               __m128i ba = _mm_unpackhi_epi32(p0, p1);
+               __m128i sum = _mm_mullo_epi16(_mm_unpacklo_epi8(rg, zero), w_r);
+               sum = _mm_add_epi16(sum, _mm_mullo_epi16(_mm_unpackhi_epi8(rg, zero), w_g));
+               sum = _mm_add_epi16(sum, _mm_mullo_epi16(_mm_unpacklo_epi8(ba, zero), w_b));
+               y[k] = _mm_packus_epi16(_mm_srli_epi16(sum, 8), zero);
+               a[k] = _mm_srli_si128(ba, 8);
+            }
+            y[0] = _mm_unpacklo_epi64(y[0], y[1]);
+            if (req_comp == 1) {
+               _mm_storeu_si128((__m128i *) dest, y[0]);
+            } else {
+               a[0] = _mm_unpacklo_epi64(a[0], a[1]);
+               _mm_storeu_si128((__m128i *) dest, _mm_unpacklo_epi8(y[0], a[0]));
+               _mm_storeu_si128((__m128i *) (dest + 16), _mm_unpackhi_epi8(y[0], a[0]));
+            }
+            break;
+         }
+         case 3: {
+            // 12 bytes out of every register, stitched back together into 48
+            __m128i c0 = _mm_shuffle_epi8(px[0], rgba_to_rgb);
+            __m128i c1 = _mm_shuffle_epi8(px[1], rgba_to_rgb);
+            __m128i c2 = _mm_shuffle_epi8(px[2], rgba_to_rgb);
+            __m128i c3 = _mm_shuffle_epi8(px[3], rgba_to_rgb);
+            _mm_storeu_si128((__m128i *) dest, _mm_or_si128(c0, _mm_slli_si128(c1, 12)));
+            _mm_storeu_si128((__m128i *) (dest + 16), _mm_or_si128(_mm_srli_si128(c1, 4), _mm_slli_si128(c2, 8)));
+            _mm_storeu_si128((__m128i *) (dest + 32), _mm_or_si128(_mm_srli_si128(c2, 8), _mm_slli_si128(c3, 4)));
+            break;
+         }
+         default:
+            for (k=0; k < 4; ++k)
+               _mm_storeu_si128((__m128i *) (dest + 16*k), px[k]);
+            break;
+      }
+   }
+   return i;
+}
+
+#elif defined(STBI_NEON)
+// converts whole blocks of 16 pixels, returning how many pixels it did. the interleaved
+// loads and stores split the pixels into a register per channel and back
+static int stbi__convert_row_simd(unsigned char *dest, unsigned char const *src, int img_n, int req_comp, int count)
 {
-   int i,j;
-   unsigned char *good;
+   int i;
+   uint8x16_t r, g, b, a;
+   uint8x16_t opaque = vdupq_n_u8(255);
+
+   for (i=0; i + 16 <= count; i += 16, src += 16*img_n, dest += 16*req_comp) {
+      switch (img_n) {
+         case 1: r = g = b = vld1q_u8(src); a = opaque; break;
+         case 2: { uint8x16x2_t ga = vld2q_u8(src); r = g = b = ga.val[0]; a = ga.val[1]; break; }
+         case 3: { uint8x16x3_t v = vld3q_u8(src); r = v.val[0]; g = v.val[1]; b = v.val[2]; a = opaque; break; }
+         default: { uint8x16x4_t v = vld4q_u8(src); r = v.val[0]; g = v.val[1]; b = v.val[2]; a = v.val[3]; break; }
+      }
 
-   if (req_comp == img_n) return data;
-   STBI_ASSERT(req_comp >= 1 && req_comp <= 4);
+      switch (req_comp) {
+         case 1:
+         case 2: {
+            // the weights add up to 256, so the sum fits in 16 bits and grey stays as it was
+            uint8x8_t w_r = vdup_n_u8(77), w_g = vdup_n_u8(150), w_b = vdup_n_u8(29);
+            uint16x8_t lo = vmull_u8(vget_low_u8(r), w_r);
+            uint16x8_t hi = vmull_u8(vget_high_u8(r), w_r);
+            uint8x16_t y;
+            lo = vmlal_u8(lo, vget_low_u8(g), w_g);
+            hi = vmlal_u8(hi, vget_high_u8(g), w_g);
+            lo = vmlal_u8(lo, vget_low_u8(b), w_b);
+            hi = vmlal_u8(hi, vget_high_u8(b), w_b);
+            y = vcombine_u8(vshrn_n_u16(lo, 8), vshrn_n_u16(hi, 8));
+            if (req_comp == 1) {
+               vst1q_u8(dest, y);
+            } else {
+               uint8x16x2_t ya;
+               ya.val[0] = y;
+               ya.val[1] = a;
+               vst2q_u8(dest, ya);
+            }
+            break;
+         }
+         case 3: {
+            uint8x16x3_t v;
+            v.val[0] = r; v.val[1] = g; v.val[2] = b;
+            vst3q_u8(dest, v);
+            break;
+         }
+         default: {
+            uint8x16x4_t v;
+            v.val[0] = r; v.val[1] = g; v.val[2] = b; v.val[3] = a;
+            vst4q_u8(dest, v);
+            break;
+         }
+      }
+   }
+   return i;
+}
+#endif
 
-   good = (unsigned char *) stbi__malloc_mad3(req_comp, x, y, 0);
-   if (good == NULL) {
-      STBI_FREE(data);
-      return stbi__errpuc("outofmem", "Out of memory");
+// writes the converted image to good instead of a new buffer, so callers converting many
+// images of the same size (the frames of a GIF) can reuse one
+static void stbi__convert_format_into(unsigned char *good, unsigned char const *data, int img_n, int req_comp, unsigned int x, unsigned int y, int flip)
+{
+   int i,j,done;
+   int simd = 0;
+
+   STBI_ASSERT(req_comp >= 1 && req_comp <= 4);
+   if (req_comp == img_n) {
+      for (j=0; j < (int) y; ++j)
+         memcpy(good + (flip ? y-1-j : (unsigned int) j) * x * img_n, data + j * x * img_n, (size_t) x * img_n);
+      return;
    }
 
+#ifdef STBI__SSSE3
+   simd = stbi__ssse3_available();
+#elif defined(STBI_NEON)
+   simd = 1;
+#else
+   STBI_NOTUSED(simd);
+#endif
+
    for (j=0; j < (int) y; ++j) {
-      unsigned char *src  = data + j * x * img_n   ;
-      unsigned char *dest = good + j * x * req_comp;
+      unsigned char const *src = data + j * x * img_n   ;
+      unsigned char *dest = good + (flip ? y-1-j : (unsigned int) j) * x * req_comp;
+
+      // the SIMD loops take the bulk of the row, the scalar ones below finish it
+      done = 0;
+#if defined(STBI__SSSE3) || defined(STBI_NEON)
+      if (simd) {
+         done = stbi__convert_row_simd(dest, src, img_n, req_comp, (int) x);
+         src += done * img_n;
+         dest += done * req_comp;
+      }
+#endif
 
       #define STBI__COMBO(a,b)  ((a)*8+(b))
-      #define STBI__CASE(a,b)   case STBI__COMBO(a,b): for(i=x-1; i >= 0; --i, src += a, dest += b)
+      #define STBI__CASE(a,b)   case STBI__COMBO(a,b): for(i=(int) x-done-1; i >= 0; --i, src += a, dest += b)
       // convert source image with img_n components to one with req_comp components;
       // avoid switch per pixel, so use switch per scanline and massive macros
       switch (STBI__COMBO(img_n, req_comp)) {
@@ -1617,7 +2338,25 @@ static unsigned char *stbi__convert_format(unsigned char *data, int img_n, int r
       }
       #undef STBI__CASE
    }
+}
+
+static unsigned char *stbi__convert_format(unsigned char *data, int img_n, int req_comp, unsigned int x, unsigned int y, int flip)
+{
+   unsigned char *good;
+
+   if (req_comp == img_n) {
+      if (flip) stbi__vertical_flip(data, x, y, img_n);
+      return data;
+   }
+   STBI_ASSERT(req_comp >= 1 && req_comp <= 4);
+
+   good = (unsigned char *) stbi__malloc_mad3(req_comp, x, y, 0);
+   if (good == NULL) {
+      STBI_FREE(data);
+      return stbi__errpuc("outofmem", "Out of memory");
+   }
 
+   stbi__convert_format_into(good, data, img_n, req_comp, x, y, flip);
    STBI_FREE(data);
    return good;
 }
@@ -1627,12 +2366,15 @@ static stbi__uint16 stbi__compute_y_16(int r, int g, int b)
    return (stbi__uint16) (((r*77) + (g*150) +  (29*b)) >> 8);
 }
 
-static stbi__uint16 *stbi__convert_format16(stbi__uint16 *data, int img_n, int req_comp, unsigned int x, unsigned int y)
+static stbi__uint16 *stbi__convert_format16(stbi__uint16 *data, int img_n, int req_comp, unsigned int x, unsigned int y, int flip)
 {
    int i,j;
    stbi__uint16 *good;
 
-   if (req_comp == img_n) return data;
+   if (req_comp == img_n) {
+      if (flip) stbi__vertical_flip(data, x, y, img_n * 2);
+      return data;
+   }
    STBI_ASSERT(req_comp >= 1 && req_comp <= 4);
 
    good = (stbi__uint16 *) stbi__malloc(req_comp * x * y * 2);
@@ -1643,7 +2385,7 @@ static stbi__uint16 *stbi__convert_format16(stbi__uint16 *data, int img_n, int r
 
    for (j=0; j < (int) y; ++j) {
       stbi__uint16 *src  = data + j * x * img_n   ;
-      stbi__uint16 *dest = good + j * x * req_comp;
+      stbi__uint16 *dest = good + (flip ? y-1-j : (unsigned int) j) * x * req_comp;
 
       #define STBI__COMBO(a,b)  ((a)*8+(b))
       #define STBI__CASE(a,b)   case STBI__COMBO(a,b): for(i=x-1; i >= 0; --i, src += a, dest += b)
@@ -1676,14 +2418,18 @@ static float   *stbi__ldr_to_hdr(stbi_uc *data, int x, int y, int comp)
 {
    int i,k,n;
    float *output;
+   float table[256];
    if (!data) return NULL;
    output = (float *) stbi__malloc_mad4(x, y, comp, sizeof(float), 0);
    if (output == NULL) { STBI_FREE(data); return stbi__errpf("outofmem", "Out of memory"); }
+   // there are only 256 possible inputs, so do the pow() once for each of them
+   for (i=0; i < 256; ++i)
+      table[i] = (float) (pow(i/255.0f, stbi__l2h_gamma) * stbi__l2h_scale);
    // compute number of non-alpha components
    if (comp & 1) n = comp; else n = comp-1;
    for (i=0; i < x*y; ++i) {
       for (k=0; k < n; ++k) {
-         output[i*comp + k] = (float) (pow(data[i*comp+k]/255.0f, stbi__l2h_gamma) * stbi__l2h_scale);
+         output[i*comp + k] = table[data[i*comp+k]];
       }
    }
    if (n < comp) {
@@ -1694,25 +2440,146 @@ static float   *stbi__ldr_to_hdr(stbi_uc *data, int x, int y, int comp)
    STBI_FREE(data);
    return output;
 }
+
+// rounds to the nearest half, overflowing to infinity and keeping NaNs NaN
+static stbi__uint16 stbi__float_to_half(float f)
+{
+   union { float f; stbi__uint32 u; } v, magic;
+   stbi__uint32 sign, bits;
+   v.f = f;
+   sign = v.u & 0x80000000u;
+   v.u ^= sign;
+   if (v.u >= (143u << 23)) {
+      bits = v.u > 0x7f800000u ? 0x7e00 : 0x7c00;
+   } else if (v.u < (113u << 23)) {
+      // denormal or zero as a half; adding 0.5 lines the bits up so the FPU does the rounding
+      magic.u = 126u << 23;
+      v.f += magic.f;
+      bits = v.u - magic.u;
+   } else {
+      // rebias the exponent and round the 13 dropped mantissa bits to nearest even
+      stbi__uint32 odd = (v.u >> 13) & 1;
+      v.u += 0xc8000fffu + odd;
+      bits = v.u >> 13;
+   }
+   return (stbi__uint16) (bits | (sign >> 16));
+}
+
+#ifdef STBI__F16C
+STBI__F16C_TARGET
+static int stbi__float_to_half_f16c(stbi__uint16 *output, float const *input, int count)
+{
+   int i;
+   for (i=0; i + 8 <= count; i += 8) {
+      __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(input + i), 0);
+      _mm_storeu_si128((__m128i *) (output + i), h);
+   }
+   return i;
+}
+#endif
+
+STBIDEF void stbi_float_to_half(stbi_us *output, float const *input, int count)
+{
+   int i = 0;
+#ifdef STBI__F16C
+   if (stbi__f16c_available())
+      i = stbi__float_to_half_f16c(output, input, count);
+#elif defined(STBI_NEON) && defined(__aarch64__)
+   for (; i + 4 <= count; i += 4)
+      vst1_u16(output + i, vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(input + i))));
+#endif
+   for (; i < count; ++i)
+      output[i] = stbi__float_to_half(input[i]);
+}
+
+static stbi__uint16 *stbi__float_to_half_image(float *data, int x, int y, int comp)
+{
+   stbi__uint16 *output;
+   if (!data) return NULL;
+   output = (stbi__uint16 *) stbi__malloc_mad4(x, y, comp, 2, 0);
+   if (output == NULL) { STBI_FREE(data); return (stbi__uint16 *) stbi__errpuc("outofmem", "Out of memory"); }
+   stbi_float_to_half(output, data, x * y * comp);
+   STBI_FREE(data);
+   return output;
+}
 #endif
 
 #ifndef STBI_NO_HDR
 #define stbi__float2int(x)   ((int) (x))
+
+static int stbi__hdr_to_ldr_value(float v)
+{
+   float z = (float) pow(v*stbi__h2l_scale_i, stbi__h2l_gamma_i) * 255 + 0.5f;
+   if (z < 0) z = 0;
+   if (z > 255) z = 255;
+   return (stbi_uc) stbi__float2int(z);
+}
+
+// the curve only goes up and has only 256 possible outputs, so find the smallest input
+// that reaches each of them. any input then maps to the number of thresholds it's at or
+// above, which a binary search finds instead of a pow() per channel. returns 0 if the
+// settings make the curve unsuitable for that, or a threshold doesn't settle
+static int stbi__hdr_to_ldr_thresholds(float *threshold)
+{
+   int k, steps;
+   union { float f; stbi__uint32 u; } t, below;
+   if (!(stbi__h2l_scale_i > 0) || !(stbi__h2l_gamma_i > 0))
+      return 0;
+   threshold[0] = 0;
+   for (k=1; k < 256; ++k) {
+      // start from the inverse of the curve and walk to the exact float one ulp at a time
+      t.f = (float) (pow((k - 0.5) / 255, 1.0 / stbi__h2l_gamma_i) / stbi__h2l_scale_i);
+      if (!(t.f > 0) || t.u >= 0x7f800000u)
+         return 0;
+      for (steps=0; steps < 64 && stbi__hdr_to_ldr_value(t.f) < k; ++steps)
+         ++t.u;
+      for (; steps < 64; ++steps) {
+         below.u = t.u - 1;
+         if (below.u == 0 || stbi__hdr_to_ldr_value(below.f) < k)
+            break;
+         t.u = below.u;
+      }
+      if (steps == 64 || stbi__hdr_to_ldr_value(t.f) < k)
+         return 0;
+      threshold[k] = t.f;
+   }
+   return 1;
+}
+
+static stbi_uc stbi__hdr_to_ldr_lookup(float const *threshold, float v)
+{
+   int k = 0;
+   if (v >= threshold[k+128]) k += 128;
+   if (v >= threshold[k+ 64]) k +=  64;
+   if (v >= threshold[k+ 32]) k +=  32;
+   if (v >= threshold[k+ 16]) k +=  16;
+   if (v >= threshold[k+  8]) k +=   8;
+   if (v >= threshold[k+  4]) k +=   4;
+   if (v >= threshold[k+  2]) k +=   2;
+   if (v >= threshold[k+  1]) k +=   1;
+   return (stbi_uc) k;
+}
+
 static stbi_uc *stbi__hdr_to_ldr(float   *data, int x, int y, int comp)
 {
    int i,k,n;
+   int use_thresholds;
+   float threshold[256];
    stbi_uc *output;
    if (!data) return NULL;
    output = (stbi_uc *) stbi__malloc_mad3(x, y, comp, 0);
    if (output == NULL) { STBI_FREE(data); return stbi__errpuc("outofmem", "Out of memory"); }
+   use_thresholds = stbi__hdr_to_ldr_thresholds(threshold);
    // compute number of non-alpha components
    if (comp & 1) n = comp; else n = comp-1;
    for (i=0; i < x*y; ++i) {
       for (k=0; k < n; ++k) {
-         float z = (float) pow(data[i*comp+k]*stbi__h2l_scale_i, stbi__h2l_gamma_i) * 255 + 0.5f;
-         if (z < 0) z = 0;
-         if (z > 255) z = 255;
-         output[i*comp + k] = (stbi_uc) stbi__float2int(z);
+         // negative values (and NaNs) take the slow way, an even power makes them positive again
+         float v = data[i*comp+k];
+         if (use_thresholds && v >= 0)
+            output[i*comp + k] = stbi__hdr_to_ldr_lookup(threshold, v);
+         else
+            output[i*comp + k] = (stbi_uc) stbi__hdr_to_ldr_value(v);
       }
       if (k < comp) {
          float z = data[i*comp+k] * 255 + 0.5f;
@@ -1807,6 +2674,8 @@ typedef struct
    int            jfif;
    int            app14_color_transform; // Adobe APP14 tag
    int            rgb;
+   int            scale_shift; // decode at 1/(1 << scale_shift) of the size
+   int            scratch;     // component buffers come from the scratch arena (one-shot decodes only)
 
    int scan_n, order[4];
    int restart_interval, todo;
@@ -2715,6 +3584,71 @@ static void stbi__idct_simd(stbi_uc *out, int out_stride, short data[64])
 
 #endif // STBI_NEON
 
+// reduced idcts for decoding at 1/2 and 1/4 of the size: the 4 or 2 point idct of the
+// lowest frequency coefficients, scaled so the DC term lands on the same value as in the
+// full 8x8 idct. the 4 point one is split into even and odd halves like the 8 point one
+#define STBI__IDCT_4(s0,s1,s2,s3) \
+   int e0,e1,o0,o1; \
+   e0 = ((s0) + (s2)) * stbi__f2f(0.35355339f); \
+   e1 = ((s0) - (s2)) * stbi__f2f(0.35355339f); \
+   o0 = (s1) * stbi__f2f(0.46193977f) + (s3) * stbi__f2f(0.19134172f); \
+   o1 = (s1) * stbi__f2f(0.19134172f) - (s3) * stbi__f2f(0.46193977f); \
+   x0 = e0 + o0; \
+   x1 = e1 + o1; \
+   x2 = e1 - o1; \
+   x3 = e0 - o0;
+
+static void stbi__idct_block_4x4(stbi_uc *out, int out_stride, short data[64])
+{
+   int i,tmp[16];
+   // columns, keeping 2 extra bits of precision
+   for (i=0; i < 4; ++i) {
+      int x0,x1,x2,x3;
+      STBI__IDCT_4(data[i], data[8+i], data[16+i], data[24+i])
+      tmp[i   ] = (x0 + 512) >> 10;
+      tmp[i+ 4] = (x1 + 512) >> 10;
+      tmp[i+ 8] = (x2 + 512) >> 10;
+      tmp[i+12] = (x3 + 512) >> 10;
+   }
+   // rows, then undo the 4096 and the extra 2 bits and add back the 128 level shift,
+   // the rounding and the level shift folded into one bias
+   for (i=0; i < 4; ++i, out += out_stride) {
+      int x0,x1,x2,x3;
+      int *v = tmp + i*4;
+      STBI__IDCT_4(v[0], v[1], v[2], v[3])
+      out[0] = stbi__clamp((x0 + (1 << 13) + (128 << 14)) >> 14);
+      out[1] = stbi__clamp((x1 + (1 << 13) + (128 << 14)) >> 14);
+      out[2] = stbi__clamp((x2 + (1 << 13) + (128 << 14)) >> 14);
+      out[3] = stbi__clamp((x3 + (1 << 13) + (128 << 14)) >> 14);
+   }
+}
+
+static void stbi__idct_block_2x2(stbi_uc *out, int out_stride, short data[64])
+{
+   // the 2 point idct is a sum and a difference, scaled by 0.5 * C(0) in each direction
+   int a = data[0] + data[8], b = data[0] - data[8];
+   int c = data[1] + data[9], d = data[1] - data[9];
+   out[0]            = stbi__clamp(((a + c + 4) >> 3) + 128);
+   out[1]            = stbi__clamp(((a - c + 4) >> 3) + 128);
+   out[out_stride]   = stbi__clamp(((b + d + 4) >> 3) + 128);
+   out[out_stride+1] = stbi__clamp(((b - d + 4) >> 3) + 128);
+}
+
+// idct the block at (bx,by) of component n into its plane, at whatever size we decode at
+static void stbi__jpeg_idct(stbi__jpeg *z, int n, int bx, int by, short data[64])
+{
+   int size = 8 >> z->scale_shift;
+   stbi_uc *out = z->img_comp[n].data + z->img_comp[n].w2*by*size + bx*size;
+   if (size == 8)
+      z->idct_block_kernel(out, z->img_comp[n].w2, data);
+   else if (size == 1)
+      *out = stbi__clamp(((data[0] + 4) >> 3) + 128); // the DC term alone is the block's average
+   else if (size == 4)
+      stbi__idct_block_4x4(out, z->img_comp[n].w2, data);
+   else
+      stbi__idct_block_2x2(out, z->img_comp[n].w2, data);
+}
+
 #define STBI__MARKER_none  0xff
 // if there's a pending marker from the entropy stream, return that
 // otherwise, fetch from the stream and get a marker. if there's no
@@ -2767,7 +3701,7 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
             for (i=0; i < w; ++i) {
                int ha = z->img_comp[n].ha;
                if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+               stbi__jpeg_idct(z, n, i, j, data);
                // every data block is an MCU, so countdown the restart interval
                if (--z->todo <= 0) {
                   if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
@@ -2791,11 +3725,9 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
                   // by the basic H and V specified for the component
                   for (y=0; y < z->img_comp[n].v; ++y) {
                      for (x=0; x < z->img_comp[n].h; ++x) {
-                        int x2 = (i*z->img_comp[n].h + x)*8;
-                        int y2 = (j*z->img_comp[n].v + y)*8;
                         int ha = z->img_comp[n].ha;
                         if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-                        z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
+                        stbi__jpeg_idct(z, n, i*z->img_comp[n].h + x, j*z->img_comp[n].v + y, data);
                      }
                   }
                }
@@ -2892,13 +3824,34 @@ static void stbi__jpeg_finish(stbi__jpeg *z)
             for (i=0; i < w; ++i) {
                short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
                stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+               stbi__jpeg_idct(z, n, i, j, data);
             }
          }
       }
    }
 }
 
+// like stbi__jpeg_finish, but dequantizes a copy of every block so that later scans
+// can still refine the coefficients
+static void stbi__jpeg_idct_preview(stbi__jpeg *z)
+{
+   int i,j,k,n;
+   STBI_SIMD_ALIGN(short, data[64]);
+   for (n=0; n < z->s->img_n; ++n) {
+      int w = (z->img_comp[n].x+7) >> 3;
+      int h = (z->img_comp[n].y+7) >> 3;
+      for (j=0; j < h; ++j) {
+         for (i=0; i < w; ++i) {
+            short *coeff = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
+            for (k=0; k < 64; ++k)
+               data[k] = coeff[k];
+            stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
+            stbi__jpeg_idct(z, n, i, j, data);
+         }
+      }
+   }
+}
+
 static int stbi__process_marker(stbi__jpeg *z, int m)
 {
    int L;
@@ -3041,22 +3994,35 @@ static int stbi__process_scan_header(stbi__jpeg *z)
    return 1;
 }
 
+// a stbi_progressive_jpeg keeps its components between calls, which may be on different
+// threads, so only a decode that's over when stbi__jpeg_load returns can use scratch memory
+static void *stbi__jpeg_malloc_mad3(stbi__jpeg *z, int a, int b, int c, int add)
+{
+   if (!stbi__mad3sizes_valid(a, b, c, add)) return NULL;
+   return z->scratch ? stbi__scratch_alloc(a*b*c + add) : stbi__malloc(a*b*c + add);
+}
+
+static void stbi__jpeg_free(stbi__jpeg *z, void *p)
+{
+   if (z->scratch) stbi__scratch_free(p); else STBI_FREE(p);
+}
+
 static int stbi__free_jpeg_components(stbi__jpeg *z, int ncomp, int why)
 {
    int i;
    for (i=0; i < ncomp; ++i) {
       if (z->img_comp[i].raw_data) {
-         STBI_FREE(z->img_comp[i].raw_data);
+         stbi__jpeg_free(z, z->img_comp[i].raw_data);
          z->img_comp[i].raw_data = NULL;
          z->img_comp[i].data = NULL;
       }
       if (z->img_comp[i].raw_coeff) {
-         STBI_FREE(z->img_comp[i].raw_coeff);
+         stbi__jpeg_free(z, z->img_comp[i].raw_coeff);
          z->img_comp[i].raw_coeff = 0;
          z->img_comp[i].coeff = 0;
       }
       if (z->img_comp[i].linebuf) {
-         STBI_FREE(z->img_comp[i].linebuf);
+         stbi__jpeg_free(z, z->img_comp[i].linebuf);
          z->img_comp[i].linebuf = NULL;
       }
    }
@@ -3122,21 +4088,23 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
       //
       // img_mcu_x, img_mcu_y: <=17 bits; comp[i].h and .v are <=4 (checked earlier)
       // so these muls can't overflow with 32-bit ints (which we require)
-      z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * 8;
-      z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * 8;
+      //
+      // when decoding at a smaller size, every block only takes up 8 >> scale_shift
+      // pixels in each direction
+      z->img_comp[i].w2 = (z->img_mcu_x * z->img_comp[i].h * 8) >> z->scale_shift;
+      z->img_comp[i].h2 = (z->img_mcu_y * z->img_comp[i].v * 8) >> z->scale_shift;
       z->img_comp[i].coeff = 0;
       z->img_comp[i].raw_coeff = 0;
       z->img_comp[i].linebuf = NULL;
-      z->img_comp[i].raw_data = stbi__malloc_mad2(z->img_comp[i].w2, z->img_comp[i].h2, 15);
+      z->img_comp[i].raw_data = stbi__jpeg_malloc_mad3(z, z->img_comp[i].w2, z->img_comp[i].h2, 1, 15);
       if (z->img_comp[i].raw_data == NULL)
          return stbi__free_jpeg_components(z, i+1, stbi__err("outofmem", "Out of memory"));
       // align blocks for idct using mmx/sse
       z->img_comp[i].data = (stbi_uc*) (((size_t) z->img_comp[i].raw_data + 15) & ~15);
       if (z->progressive) {
-         // w2, h2 are multiples of 8 (see above)
-         z->img_comp[i].coeff_w = z->img_comp[i].w2 / 8;
-         z->img_comp[i].coeff_h = z->img_comp[i].h2 / 8;
-         z->img_comp[i].raw_coeff = stbi__malloc_mad3(z->img_comp[i].w2, z->img_comp[i].h2, sizeof(short), 15);
+         z->img_comp[i].coeff_w = z->img_mcu_x * z->img_comp[i].h;
+         z->img_comp[i].coeff_h = z->img_mcu_y * z->img_comp[i].v;
+         z->img_comp[i].raw_coeff = stbi__jpeg_malloc_mad3(z, z->img_comp[i].coeff_w * 8, z->img_comp[i].coeff_h * 8, sizeof(short), 15);
          if (z->img_comp[i].raw_coeff == NULL)
             return stbi__free_jpeg_components(z, i+1, stbi__err("outofmem", "Out of memory"));
          z->img_comp[i].coeff = (short*) (((size_t) z->img_comp[i].raw_coeff + 15) & ~15);
@@ -3597,6 +4565,8 @@ static void stbi__setup_jpeg(stbi__jpeg *j)
    j->idct_block_kernel = stbi__idct_block;
    j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_row;
    j->resample_row_hv_2_kernel = stbi__resample_row_hv_2;
+   j->scale_shift = 0;
+   j->scratch = 0;
 
 #ifdef STBI_SSE2
    if (stbi__sse2_available()) {
@@ -3619,6 +4589,18 @@ static void stbi__cleanup_jpeg(stbi__jpeg *j)
    stbi__free_jpeg_components(j, j->s->img_n, 0);
 }
 
+// free only the line buffers used while resampling, the decoded components stay
+static void stbi__free_jpeg_linebufs(stbi__jpeg *j)
+{
+   int i;
+   for (i=0; i < j->s->img_n; ++i) {
+      if (j->img_comp[i].linebuf) {
+         stbi__jpeg_free(j, j->img_comp[i].linebuf);
+         j->img_comp[i].linebuf = NULL;
+      }
+   }
+}
+
 typedef struct
 {
    resample_row_func resample;
@@ -3636,9 +4618,11 @@ static stbi_uc stbi__blinn_8x8(stbi_uc x, stbi_uc y)
    return (stbi_uc) ((t + (t >>8)) >> 8);
 }
 
+static stbi_uc *stbi__jpeg_output(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp);
+
 static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
 {
-   int n, decode_n, is_rgb;
+   stbi_uc *output;
    z->s->img_n = 0; // make stbi__cleanup_jpeg safe
 
    // validate req_comp
@@ -3647,6 +4631,20 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
    // load a jpeg image from whichever source, but leave in YCbCr format
    if (!stbi__decode_jpeg_image(z)) { stbi__cleanup_jpeg(z); return NULL; }
 
+   output = stbi__jpeg_output(z, out_x, out_y, comp, req_comp);
+   stbi__cleanup_jpeg(z);
+   return output;
+}
+
+// resample and color-convert the decoded components into the output image, leaving the
+// components themselves alone
+static stbi_uc *stbi__jpeg_output(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
+{
+   int n, decode_n, is_rgb;
+   int scale = 1 << z->scale_shift;
+   stbi__uint32 img_x = (z->s->img_x + scale-1) >> z->scale_shift;
+   stbi__uint32 img_y = (z->s->img_y + scale-1) >> z->scale_shift;
+
    // determine actual number of components to generate
    n = req_comp ? req_comp : z->s->img_n >= 3 ? 3 : 1;
 
@@ -3671,13 +4669,13 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
 
          // allocate line buffer big enough for upsampling off the edges
          // with upsample factor of 4
-         z->img_comp[k].linebuf = (stbi_uc *) stbi__malloc(z->s->img_x + 3);
-         if (!z->img_comp[k].linebuf) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
+         z->img_comp[k].linebuf = (stbi_uc *) stbi__jpeg_malloc_mad3(z, img_x, 1, 1, 3);
+         if (!z->img_comp[k].linebuf) { stbi__free_jpeg_linebufs(z); return stbi__errpuc("outofmem", "Out of memory"); }
 
          r->hs      = z->img_h_max / z->img_comp[k].h;
          r->vs      = z->img_v_max / z->img_comp[k].v;
          r->ystep   = r->vs >> 1;
-         r->w_lores = (z->s->img_x + r->hs-1) / r->hs;
+         r->w_lores = (img_x + r->hs-1) / r->hs;
          r->ypos    = 0;
          r->line0   = r->line1 = z->img_comp[k].data;
 
@@ -3689,12 +4687,17 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
       }
 
       // can't error after this so, this is safe
-      output = (stbi_uc *) stbi__malloc_mad3(n, z->s->img_x, z->s->img_y, 1);
-      if (!output) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
+      output = (stbi_uc *) stbi__malloc_mad3(n, img_x, img_y, 1);
+      if (!output) { stbi__free_jpeg_linebufs(z); return stbi__errpuc("outofmem", "Out of memory"); }
 
       // now go ahead and resample
-      for (j=0; j < z->s->img_y; ++j) {
-         stbi_uc *out = output + n * z->s->img_x * j;
+      for (j=0; j < img_y; ++j) {
+         stbi_uc *out = output + n * img_x * (z->s->flip_vertically ? img_y-1-j : j);
+         // with 3 channels the converters below store a 4th byte past the end of the row. going
+         // bottom-up, that's the first byte of a row we already wrote, so it has to be put back
+         stbi_uc *after_row = out + n * img_x;
+         int restore = z->s->flip_vertically && j > 0;
+         stbi_uc after_row_byte = restore ? *after_row : 0;
          for (k=0; k < decode_n; ++k) {
             stbi__resample *r = &res_comp[k];
             int y_bot = r->ystep >= (r->vs >> 1);
@@ -3705,7 +4708,7 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
             if (++r->ystep >= r->vs) {
                r->ystep = 0;
                r->line0 = r->line1;
-               if (++r->ypos < z->img_comp[k].y)
+               if (++r->ypos < (z->img_comp[k].y + scale-1) >> z->scale_shift)
                   r->line1 += z->img_comp[k].w2;
             }
          }
@@ -3713,7 +4716,7 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
             stbi_uc *y = coutput[0];
             if (z->s->img_n == 3) {
                if (is_rgb) {
-                  for (i=0; i < z->s->img_x; ++i) {
+                  for (i=0; i < img_x; ++i) {
                      out[0] = y[i];
                      out[1] = coutput[1][i];
                      out[2] = coutput[2][i];
@@ -3721,11 +4724,11 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
                      out += n;
                   }
                } else {
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], img_x, n);
                }
             } else if (z->s->img_n == 4) {
                if (z->app14_color_transform == 0) { // CMYK
-                  for (i=0; i < z->s->img_x; ++i) {
+                  for (i=0; i < img_x; ++i) {
                      stbi_uc m = coutput[3][i];
                      out[0] = stbi__blinn_8x8(coutput[0][i], m);
                      out[1] = stbi__blinn_8x8(coutput[1][i], m);
@@ -3734,8 +4737,8 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
                      out += n;
                   }
                } else if (z->app14_color_transform == 2) { // YCCK
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-                  for (i=0; i < z->s->img_x; ++i) {
+                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], img_x, n);
+                  for (i=0; i < img_x; ++i) {
                      stbi_uc m = coutput[3][i];
                      out[0] = stbi__blinn_8x8(255 - out[0], m);
                      out[1] = stbi__blinn_8x8(255 - out[1], m);
@@ -3743,10 +4746,10 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
                      out += n;
                   }
                } else { // YCbCr + alpha?  Ignore the fourth channel for now
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], img_x, n);
                }
             } else
-               for (i=0; i < z->s->img_x; ++i) {
+               for (i=0; i < img_x; ++i) {
                   out[0] = out[1] = out[2] = y[i];
                   out[3] = 255; // not used if n==3
                   out += n;
@@ -3754,16 +4757,16 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
          } else {
             if (is_rgb) {
                if (n == 1)
-                  for (i=0; i < z->s->img_x; ++i)
+                  for (i=0; i < img_x; ++i)
                      *out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
                else {
-                  for (i=0; i < z->s->img_x; ++i, out += 2) {
+                  for (i=0; i < img_x; ++i, out += 2) {
                      out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
                      out[1] = 255;
                   }
                }
             } else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
-               for (i=0; i < z->s->img_x; ++i) {
+               for (i=0; i < img_x; ++i) {
                   stbi_uc m = coutput[3][i];
                   stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
                   stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
@@ -3773,7 +4776,7 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
                   out += n;
                }
             } else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
-               for (i=0; i < z->s->img_x; ++i) {
+               for (i=0; i < img_x; ++i) {
                   out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
                   out[1] = 255;
                   out += n;
@@ -3781,15 +4784,16 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
             } else {
                stbi_uc *y = coutput[0];
                if (n == 1)
-                  for (i=0; i < z->s->img_x; ++i) out[i] = y[i];
+                  for (i=0; i < img_x; ++i) out[i] = y[i];
                else
-                  for (i=0; i < z->s->img_x; ++i) { *out++ = y[i]; *out++ = 255; }
+                  for (i=0; i < img_x; ++i) { *out++ = y[i]; *out++ = 255; }
             }
          }
+         if (restore) *after_row = after_row_byte;
       }
-      stbi__cleanup_jpeg(z);
-      *out_x = z->s->img_x;
-      *out_y = z->s->img_y;
+      stbi__free_jpeg_linebufs(z);
+      *out_x = img_x;
+      *out_y = img_y;
       if (comp) *comp = z->s->img_n >= 3 ? 3 : 1; // report original components, not output
       return output;
    }
@@ -3798,24 +4802,41 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
 static void *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri)
 {
    unsigned char* result;
-   stbi__jpeg* j = (stbi__jpeg*) stbi__malloc(sizeof(stbi__jpeg));
-   STBI_NOTUSED(ri);
+   stbi__jpeg* j = (stbi__jpeg*) stbi__scratch_alloc(sizeof(stbi__jpeg));
+   if (!j) return stbi__errpuc("outofmem", "Out of memory");
+   j->s = s;
+   stbi__setup_jpeg(j);
+   j->scratch = 1;
+   result = load_jpeg_image(j, x,y,comp,req_comp);
+   ri->flipped = s->flip_vertically; // stbi__jpeg_output writes the rows bottom-up
+   stbi__scratch_free(j);
+   return result;
+}
+
+static stbi_uc *stbi__jpeg_load_scaled(stbi__context *s, int *x, int *y, int *comp, int req_comp, int scale_shift)
+{
+   unsigned char* result;
+   stbi__jpeg* j = (stbi__jpeg*) stbi__scratch_alloc(sizeof(stbi__jpeg));
+   if (!j) return stbi__errpuc("outofmem", "Out of memory");
    j->s = s;
    stbi__setup_jpeg(j);
+   j->scale_shift = scale_shift;
+   j->scratch = 1;
    result = load_jpeg_image(j, x,y,comp,req_comp);
-   STBI_FREE(j);
+   stbi__scratch_free(j);
    return result;
 }
 
 static int stbi__jpeg_test(stbi__context *s)
 {
    int r;
-   stbi__jpeg* j = (stbi__jpeg*)stbi__malloc(sizeof(stbi__jpeg));
+   stbi__jpeg* j = (stbi__jpeg*) stbi__scratch_alloc(sizeof(stbi__jpeg));
+   if (!j) return stbi__err("outofmem", "Out of memory");
    j->s = s;
    stbi__setup_jpeg(j);
    r = stbi__decode_jpeg_header(j, STBI__SCAN_type);
    stbi__rewind(s);
-   STBI_FREE(j);
+   stbi__scratch_free(j);
    return r;
 }
 
@@ -3834,12 +4855,128 @@ static int stbi__jpeg_info_raw(stbi__jpeg *j, int *x, int *y, int *comp)
 static int stbi__jpeg_info(stbi__context *s, int *x, int *y, int *comp)
 {
    int result;
-   stbi__jpeg* j = (stbi__jpeg*) (stbi__malloc(sizeof(stbi__jpeg)));
+   stbi__jpeg* j = (stbi__jpeg*) stbi__scratch_alloc(sizeof(stbi__jpeg));
+   if (!j) return stbi__err("outofmem", "Out of memory");
    j->s = s;
    result = stbi__jpeg_info_raw(j, x, y, comp);
-   STBI_FREE(j);
+   stbi__scratch_free(j);
    return result;
 }
+
+struct stbi__progressive_jpeg
+{
+   stbi__context s;
+   stbi__jpeg j;
+   int marker;    // the marker to handle on the next call
+   int scans;     // scans decoded so far
+   int dc_seen;   // one bit per component whose DC coefficients have been decoded
+   int done;
+};
+
+STBIDEF stbi_progressive_jpeg *stbi_progressive_jpeg_open(stbi_uc const *buffer, int len)
+{
+   return stbi_progressive_jpeg_open_with_options(buffer, len, NULL);
+}
+
+// only the flip setting applies, failures are reported through stbi_failure_reason
+STBIDEF stbi_progressive_jpeg *stbi_progressive_jpeg_open_with_options(stbi_uc const *buffer, int len, stbi_load_options const *options)
+{
+   int i;
+   stbi_progressive_jpeg *p = (stbi_progressive_jpeg *) stbi__malloc(sizeof(stbi_progressive_jpeg));
+   if (!p) return (stbi_progressive_jpeg *) stbi__errpuc("outofmem", "Out of memory");
+   memset(p, 0, sizeof(*p)); // also makes stbi__cleanup_jpeg safe
+   stbi__start_mem(&p->s, buffer, len);
+   if (options) stbi__apply_options(&p->s, options);
+   p->j.s = &p->s;
+   stbi__setup_jpeg(&p->j);
+   if (!stbi__decode_jpeg_header(&p->j, STBI__SCAN_load)) {
+      stbi__cleanup_jpeg(&p->j);
+      STBI_FREE(p);
+      return NULL;
+   }
+
+   // components that haven't been in a scan yet come out flat instead of as garbage
+   for (i=0; i < p->s.img_n; ++i) {
+      memset(p->j.img_comp[i].data, 0, (size_t) p->j.img_comp[i].w2 * p->j.img_comp[i].h2);
+      if (p->j.progressive)
+         memset(p->j.img_comp[i].coeff, 0, (size_t) p->j.img_comp[i].coeff_w * p->j.img_comp[i].coeff_h * 64 * sizeof(short));
+   }
+   p->marker = stbi__get_marker(&p->j);
+   return p;
+}
+
+// the same loop as stbi__decode_jpeg_image, except it returns after every scan
+STBIDEF int stbi_progressive_jpeg_next_scan(stbi_progressive_jpeg *p)
+{
+   stbi__jpeg *j = &p->j;
+   int k, m = p->marker;
+   while (!p->done && !stbi__EOI(m)) {
+      if (stbi__SOS(m)) {
+         if (!stbi__process_scan_header(j)) break;
+         if (!stbi__parse_entropy_coded_data(j)) break;
+         if (j->marker == STBI__MARKER_none ) {
+            // handle 0s at the end of image data from IP Kamera 9060
+            while (!stbi__at_eof(j->s)) {
+               int x = stbi__get8(j->s);
+               if (x == 255) {
+                  j->marker = stbi__get8(j->s);
+                  break;
+               }
+            }
+         }
+         if (j->spec_start == 0)
+            for (k=0; k < j->scan_n; ++k)
+               p->dc_seen |= 1 << j->order[k];
+         ++p->scans;
+         p->marker = stbi__get_marker(j);
+         return 1;
+      } else if (stbi__DNL(m)) {
+         int Ld = stbi__get16be(j->s);
+         stbi__uint32 NL = stbi__get16be(j->s);
+         if (Ld != 4) { (void) stbi__err("bad DNL len", "Corrupt JPEG"); break; }
+         if (NL != j->s->img_y) { (void) stbi__err("bad DNL height", "Corrupt JPEG"); break; }
+      } else {
+         if (!stbi__process_marker(j, m)) break;
+      }
+      m = stbi__get_marker(j);
+   }
+   // finished, or the rest of the file is corrupt; either way the scans so far can still be used
+   p->done = 1;
+   return 0;
+}
+
+STBIDEF int stbi_progressive_jpeg_dc_complete(stbi_progressive_jpeg *p)
+{
+   return p->s.img_n > 0 && p->dc_seen == (1 << p->s.img_n) - 1;
+}
+
+STBIDEF int stbi_progressive_jpeg_done(stbi_progressive_jpeg *p)
+{
+   return p->done;
+}
+
+STBIDEF int stbi_progressive_jpeg_is_progressive(stbi_progressive_jpeg *p)
+{
+   return p->j.progressive;
+}
+
+STBIDEF stbi_uc *stbi_progressive_jpeg_image(stbi_progressive_jpeg *p, int *x, int *y, int *comp, int req_comp)
+{
+   if (req_comp < 0 || req_comp > 4) return stbi__errpuc("bad req_comp", "Internal error");
+   if (p->scans == 0) return stbi__errpuc("no scans", "Corrupt JPEG");
+
+   // baseline scans write their pixels directly, progressive ones only add coefficients
+   if (p->j.progressive)
+      stbi__jpeg_idct_preview(&p->j);
+   return stbi__jpeg_output(&p->j, x, y, comp, req_comp);
+}
+
+STBIDEF void stbi_progressive_jpeg_close(stbi_progressive_jpeg *p)
+{
+   if (!p) return;
+   stbi__cleanup_jpeg(&p->j);
+   STBI_FREE(p);
+}
 #endif
 
 // public domain zlib decode    v0.2  Sean Barrett 2006-11-18
@@ -3947,6 +5084,7 @@ typedef struct
    char *zout_start;
    char *zout_end;
    int   z_expandable;
+   int   z_scratch;     // zout_start came from the scratch arena
 
    stbi__zhuffman z_length, z_distance;
 } stbi__zbuf;
@@ -4018,7 +5156,10 @@ static int stbi__zexpand(stbi__zbuf *z, char *zout, int n)  // need to make room
    limit = old_limit = (int) (z->zout_end - z->zout_start);
    while (cur + n > limit)
       limit *= 2;
-   q = (char *) STBI_REALLOC_SIZED(z->zout_start, old_limit, limit);
+   if (z->z_scratch)
+      q = (char *) stbi__scratch_realloc(z->zout_start, old_limit, limit);
+   else
+      q = (char *) STBI_REALLOC_SIZED(z->zout_start, old_limit, limit);
    STBI_NOTUSED(old_limit);
    if (q == NULL) return stbi__err("outofmem", "Out of memory");
    z->zout_start = q;
@@ -4237,6 +5378,7 @@ static int stbi__do_zlib(stbi__zbuf *a, char *obuf, int olen, int exp, int parse
    a->zout       = obuf;
    a->zout_end   = obuf + olen;
    a->z_expandable = exp;
+   a->z_scratch  = 0;
 
    return stbi__parse_zlib(a, parse_header);
 }
@@ -4393,7 +5535,9 @@ static int stbi__paeth(int a, int b, int c)
 static const stbi_uc stbi__depth_scale_table[9] = { 0, 0xff, 0x55, 0, 0x11, 0,0,0, 0x01 };
 
 // create the png data from post-deflated data
-static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 raw_len, int out_n, stbi__uint32 x, stbi__uint32 y, int depth, int color)
+// with flip set the rows are stored bottom-up; every later step works on whole rows or
+// single pixels, so that is all it takes to flip the image
+static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 raw_len, int out_n, stbi__uint32 x, stbi__uint32 y, int depth, int color, int flip)
 {
    int bytes = (depth == 16? 2 : 1);
    stbi__context *s = a->s;
@@ -4420,7 +5564,7 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
    if (raw_len < img_len) return stbi__err("not enough pixels","Corrupt PNG");
 
    for (j=0; j < y; ++j) {
-      stbi_uc *cur = a->out + stride*j;
+      stbi_uc *cur = a->out + stride*(flip ? y-1-j : j);
       stbi_uc *prior;
       int filter = *raw++;
 
@@ -4433,7 +5577,7 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
          filter_bytes = 1;
          width = img_width_bytes;
       }
-      prior = cur - stride; // bugfix: need to compute this after 'cur +=' computation above
+      prior = flip ? cur + stride : cur - stride; // bugfix: need to compute this after 'cur +=' computation above
 
       // if first row, use special filter that doesn't sample previous row
       if (j == 0) filter = first_row_filter[filter];
@@ -4509,7 +5653,7 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
          // the loop above sets the high byte of the pixels' alpha, but for
          // 16 bit png files we also need the low byte set. we'll do that here.
          if (depth == 16) {
-            cur = a->out + stride*j; // start at the beginning of the row again
+            cur = a->out + stride*(flip ? y-1-j : j); // start at the beginning of the row again
             for (i=0; i < x; ++i,cur+=output_bytes) {
                cur[filter_bytes+1] = 255;
             }
@@ -4609,10 +5753,11 @@ static int stbi__create_png_image(stbi__png *a, stbi_uc *image_data, stbi__uint3
 {
    int bytes = (depth == 16 ? 2 : 1);
    int out_bytes = out_n * bytes;
+   int flip = a->s->flip_vertically;
    stbi_uc *final;
    int p;
    if (!interlaced)
-      return stbi__create_png_image_raw(a, image_data, image_data_len, out_n, a->s->img_x, a->s->img_y, depth, color);
+      return stbi__create_png_image_raw(a, image_data, image_data_len, out_n, a->s->img_x, a->s->img_y, depth, color, flip);
 
    // de-interlacing
    final = (stbi_uc *) stbi__malloc_mad3(a->s->img_x, a->s->img_y, out_bytes, 0);
@@ -4627,7 +5772,7 @@ static int stbi__create_png_image(stbi__png *a, stbi_uc *image_data, stbi__uint3
       y = (a->s->img_y - yorig[p] + yspc[p]-1) / yspc[p];
       if (x && y) {
          stbi__uint32 img_len = ((((a->s->img_n * x * depth) + 7) >> 3) + 1) * y;
-         if (!stbi__create_png_image_raw(a, image_data, image_data_len, out_n, x, y, depth, color)) {
+         if (!stbi__create_png_image_raw(a, image_data, image_data_len, out_n, x, y, depth, color, 0)) {
             STBI_FREE(final);
             return 0;
          }
@@ -4635,6 +5780,7 @@ static int stbi__create_png_image(stbi__png *a, stbi_uc *image_data, stbi__uint3
             for (i=0; i < x; ++i) {
                int out_y = j*yspc[p]+yorig[p];
                int out_x = i*xspc[p]+xorig[p];
+               if (flip) out_y = a->s->img_y-1-out_y;
                memcpy(final + out_y*a->s->img_x*out_bytes + out_x*out_bytes,
                       a->out + (j*x+i)*out_bytes, out_bytes);
             }
@@ -4736,9 +5882,6 @@ static int stbi__expand_png_palette(stbi__png *a, stbi_uc *palette, int len, int
    return 1;
 }
 
-static int stbi__unpremultiply_on_load = 0;
-static int stbi__de_iphone_flag = 0;
-
 STBIDEF void stbi_set_unpremultiply_on_load(int flag_true_if_should_unpremultiply)
 {
    stbi__unpremultiply_on_load = flag_true_if_should_unpremultiply;
@@ -4764,7 +5907,7 @@ static void stbi__de_iphone(stbi__png *z)
       }
    } else {
       STBI_ASSERT(s->img_out_n == 4);
-      if (stbi__unpremultiply_on_load) {
+      if (s->unpremultiply) {
          // convert bgr to rgb and unpremultiply
          for (i=0; i < pixel_count; ++i) {
             stbi_uc a = p[3];
@@ -4794,6 +5937,49 @@ static void stbi__de_iphone(stbi__png *z)
 
 #define STBI__PNG_TYPE(a,b,c,d)  (((unsigned) (a) << 24) + ((unsigned) (b) << 16) + ((unsigned) (c) << 8) + (unsigned) (d))
 
+// the exact size of the inflated IDAT stream: every row of every pass starts with its filter
+// byte, so decoding into a buffer of this size never has to grow it
+static stbi__uint32 stbi__png_raw_size(stbi__context *s, int depth, int interlace)
+{
+   static const int xorig[] = { 0,4,0,2,0,1,0 };
+   static const int yorig[] = { 0,0,4,0,2,0,1 };
+   static const int xspc[]  = { 8,8,4,4,2,2,1 };
+   static const int yspc[]  = { 8,8,8,4,4,2,2 };
+   stbi__uint32 raw_len = 0, x, y;
+   int p;
+   if (!interlace)
+      return (((s->img_n * s->img_x * depth) + 7) >> 3) * s->img_y + s->img_y;
+   for (p=0; p < 7; ++p) {
+      x = (s->img_x - xorig[p] + xspc[p]-1) / xspc[p];
+      y = (s->img_y - yorig[p] + yspc[p]-1) / yspc[p];
+      if (x && y)
+         raw_len += ((((s->img_n * x * depth) + 7) >> 3) + 1) * y;
+   }
+   return raw_len;
+}
+
+// like stbi_zlib_decode_malloc_guesssize_headerflag, but the output is scratch memory
+static char *stbi__zlib_decode_scratch(const char *buffer, int len, int initial_size, int *outlen, int parse_header)
+{
+   stbi__zbuf a;
+   char *p = (char *) stbi__scratch_alloc(initial_size);
+   if (p == NULL) return (char *) stbi__errpuc("outofmem", "Out of memory");
+   a.zbuffer = (stbi_uc *) buffer;
+   a.zbuffer_end = (stbi_uc *) buffer + len;
+   a.zout_start = p;
+   a.zout       = p;
+   a.zout_end   = p + initial_size;
+   a.z_expandable = 1;
+   a.z_scratch  = 1;
+   if (stbi__parse_zlib(&a, parse_header)) {
+      if (outlen) *outlen = (int) (a.zout - a.zout_start);
+      return a.zout_start;
+   } else {
+      stbi__scratch_free(a.zout_start);
+      return NULL;
+   }
+}
+
 static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
 {
    stbi_uc palette[1024], pal_img_n=0;
@@ -4892,11 +6078,14 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
             if (ioff + c.length > idata_limit) {
                stbi__uint32 idata_limit_old = idata_limit;
                stbi_uc *p;
+               // reading from memory, every IDAT has to fit in what's left of the buffer, so
+               // making room for all of that up front means the chunks never get copied again
+               if (idata_limit == 0 && !s->read_from_callbacks && s->img_buffer_end - s->img_buffer > (int) c.length)
+                  idata_limit = (stbi__uint32) (s->img_buffer_end - s->img_buffer);
                if (idata_limit == 0) idata_limit = c.length > 4096 ? c.length : 4096;
                while (ioff + c.length > idata_limit)
                   idata_limit *= 2;
-               STBI_NOTUSED(idata_limit_old);
-               p = (stbi_uc *) STBI_REALLOC_SIZED(z->idata, idata_limit_old, idata_limit); if (p == NULL) return stbi__err("outofmem", "Out of memory");
+               p = (stbi_uc *) stbi__scratch_realloc(z->idata, idata_limit_old, idata_limit); if (p == NULL) return stbi__err("outofmem", "Out of memory");
                z->idata = p;
             }
             if (!stbi__getn(s, z->idata+ioff,c.length)) return stbi__err("outofdata","Corrupt PNG");
@@ -4905,16 +6094,14 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
          }
 
          case STBI__PNG_TYPE('I','E','N','D'): {
-            stbi__uint32 raw_len, bpl;
+            stbi__uint32 raw_len;
             if (first) return stbi__err("first not IHDR", "Corrupt PNG");
             if (scan != STBI__SCAN_load) return 1;
             if (z->idata == NULL) return stbi__err("no IDAT","Corrupt PNG");
-            // initial guess for decoded data size to avoid unnecessary reallocs
-            bpl = (s->img_x * z->depth + 7) / 8; // bytes per line, per component
-            raw_len = bpl * s->img_y * s->img_n /* pixels */ + s->img_y /* filter mode per row */;
-            z->expanded = (stbi_uc *) stbi_zlib_decode_malloc_guesssize_headerflag((char *) z->idata, ioff, raw_len, (int *) &raw_len, !is_iphone);
+            raw_len = stbi__png_raw_size(s, z->depth, interlace);
+            z->expanded = (stbi_uc *) stbi__zlib_decode_scratch((char *) z->idata, ioff, raw_len, (int *) &raw_len, !is_iphone);
             if (z->expanded == NULL) return 0; // zlib should set error
-            STBI_FREE(z->idata); z->idata = NULL;
+            stbi__scratch_free(z->idata); z->idata = NULL;
             if ((req_comp == s->img_n+1 && req_comp != 3 && !pal_img_n) || has_trans)
                s->img_out_n = s->img_n+1;
             else
@@ -4927,7 +6114,7 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
                   if (!stbi__compute_transparency(z, tc, s->img_out_n)) return 0;
                }
             }
-            if (is_iphone && stbi__de_iphone_flag && s->img_out_n > 2)
+            if (is_iphone && s->de_iphone && s->img_out_n > 2)
                stbi__de_iphone(z);
             if (pal_img_n) {
                // pal_img_n == 3 or 4
@@ -4940,7 +6127,7 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
                // non-paletted image with tRNS -> source image has (constant) alpha
                ++s->img_n;
             }
-            STBI_FREE(z->expanded); z->expanded = NULL;
+            stbi__scratch_free(z->expanded); z->expanded = NULL;
             return 1;
          }
 
@@ -4949,8 +6136,12 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
             if (first) return stbi__err("first not IHDR", "Corrupt PNG");
             if ((c.type & (1 << 29)) == 0) {
                #ifndef STBI_NO_FAILURE_STRINGS
+               #ifdef STBI_THREAD_LOCAL
+               static STBI_THREAD_LOCAL char invalid_chunk[] = "XXXX PNG chunk not known";
+               #else
                // not threadsafe
                static char invalid_chunk[] = "XXXX PNG chunk not known";
+               #endif
                invalid_chunk[0] = STBI__BYTECAST(c.type >> 24);
                invalid_chunk[1] = STBI__BYTECAST(c.type >> 16);
                invalid_chunk[2] = STBI__BYTECAST(c.type >>  8);
@@ -4977,11 +6168,12 @@ static void *stbi__do_png(stbi__png *p, int *x, int *y, int *n, int req_comp, st
          ri->bits_per_channel = p->depth;
       result = p->out;
       p->out = NULL;
+      ri->flipped = p->s->flip_vertically;
       if (req_comp && req_comp != p->s->img_out_n) {
          if (ri->bits_per_channel == 8)
-            result = stbi__convert_format((unsigned char *) result, p->s->img_out_n, req_comp, p->s->img_x, p->s->img_y);
+            result = stbi__convert_format((unsigned char *) result, p->s->img_out_n, req_comp, p->s->img_x, p->s->img_y, 0);
          else
-            result = stbi__convert_format16((stbi__uint16 *) result, p->s->img_out_n, req_comp, p->s->img_x, p->s->img_y);
+            result = stbi__convert_format16((stbi__uint16 *) result, p->s->img_out_n, req_comp, p->s->img_x, p->s->img_y, 0);
          p->s->img_out_n = req_comp;
          if (result == NULL) return result;
       }
@@ -4990,8 +6182,8 @@ static void *stbi__do_png(stbi__png *p, int *x, int *y, int *n, int req_comp, st
       if (n) *n = p->s->img_n;
    }
    STBI_FREE(p->out);      p->out      = NULL;
-   STBI_FREE(p->expanded); p->expanded = NULL;
-   STBI_FREE(p->idata);    p->idata    = NULL;
+   stbi__scratch_free(p->expanded); p->expanded = NULL;
+   stbi__scratch_free(p->idata);    p->idata    = NULL;
 
    return result;
 }
@@ -5373,8 +6565,9 @@ static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req
    }
 
    if (req_comp && req_comp != target) {
-      out = stbi__convert_format(out, target, req_comp, s->img_x, s->img_y);
+      out = stbi__convert_format(out, target, req_comp, s->img_x, s->img_y, s->flip_vertically);
       if (out == NULL) return out; // stbi__convert_format frees input on failure
+      ri->flipped = s->flip_vertically;
    }
 
    *x = s->img_x;
@@ -5703,8 +6896,10 @@ static void *stbi__tga_load(stbi__context *s, int *x, int *y, int *comp, int req
    }
 
    // convert to target component count
-   if (req_comp && req_comp != tga_comp)
-      tga_data = stbi__convert_format(tga_data, tga_comp, req_comp, tga_width, tga_height);
+   if (req_comp && req_comp != tga_comp) {
+      tga_data = stbi__convert_format(tga_data, tga_comp, req_comp, tga_width, tga_height, s->flip_vertically);
+      ri->flipped = s->flip_vertically;
+   }
 
    //   the things I do to get rid of an error message, and yet keep
    //   Microsoft's C compilers happy... [8^(
@@ -5949,10 +7144,11 @@ static void *stbi__psd_load(stbi__context *s, int *x, int *y, int *comp, int req
    // convert to desired output format
    if (req_comp && req_comp != 4) {
       if (ri->bits_per_channel == 16)
-         out = (stbi_uc *) stbi__convert_format16((stbi__uint16 *) out, 4, req_comp, w, h);
+         out = (stbi_uc *) stbi__convert_format16((stbi__uint16 *) out, 4, req_comp, w, h, s->flip_vertically);
       else
-         out = stbi__convert_format(out, 4, req_comp, w, h);
+         out = stbi__convert_format(out, 4, req_comp, w, h, s->flip_vertically);
       if (out == NULL) return out; // stbi__convert_format frees input on failure
+      ri->flipped = s->flip_vertically;
    }
 
    if (comp) *comp = 4;
@@ -6166,7 +7362,8 @@ static void *stbi__pic_load(stbi__context *s,int *px,int *py,int *comp,int req_c
    *px = x;
    *py = y;
    if (req_comp == 0) req_comp = *comp;
-   result=stbi__convert_format(result,4,req_comp,x,y);
+   result=stbi__convert_format(result,4,req_comp,x,y,s->flip_vertically);
+   ri->flipped = s->flip_vertically;
 
    return result;
 }
@@ -6615,7 +7812,7 @@ static void *stbi__load_gif_main(stbi__context *s, int **delays, int *x, int *y,
             }
             memcpy( out + ((layers - 1) * stride), u, stride ); 
             if (layers >= 2) {
-               two_back = out - 2 * stride; 
+               two_back = out + (layers - 2) * stride; 
             }
 
             if (delays) {
@@ -6631,7 +7828,7 @@ static void *stbi__load_gif_main(stbi__context *s, int **delays, int *x, int *y,
 
       // do the final conversion after loading everything; 
       if (req_comp && req_comp != 4)
-         out = stbi__convert_format(out, 4, req_comp, layers * g.w, g.h);
+         out = stbi__convert_format(out, 4, req_comp, layers * g.w, g.h, 0);
 
       *z = layers; 
       return out;
@@ -6656,7 +7853,7 @@ static void *stbi__gif_load(stbi__context *s, int *x, int *y, int *comp, int req
       // moved conversion to after successful load so that the same
       // can be done for multiple frames. 
       if (req_comp && req_comp != 4)
-         u = stbi__convert_format(u, 4, req_comp, g.w, g.h);
+         u = stbi__convert_format(u, 4, req_comp, g.w, g.h, 0);
    } else if (g.out) {
       // if there was an error and we allocated an image buffer, free it!
       STBI_FREE(g.out);
@@ -6673,6 +7870,151 @@ static int stbi__gif_info(stbi__context *s, int *x, int *y, int *comp)
 {
    return stbi__gif_info_raw(s,x,y,comp);
 }
+
+// walks the blocks of the file without decoding any pixels, counting the frames and
+// collecting their delays the way stbi__gif_load_next() would report them
+static int stbi__gif_scan_frames(stbi__context *s, int *delays)
+{
+   int count = 0, delay = 0, flags, len;
+
+   stbi__skip(s, 10);
+   flags = stbi__get8(s);
+   stbi__skip(s, 2);
+   if (flags & 0x80) stbi__skip(s, 3 * (2 << (flags & 7)));
+
+   while (!stbi__at_eof(s)) {
+      switch (stbi__get8(s)) {
+         case 0x2C: // Image Descriptor
+            stbi__skip(s, 8);
+            flags = stbi__get8(s);
+            if (flags & 0x80) stbi__skip(s, 3 * (2 << (flags & 7)));
+            stbi__get8(s); // lzw code size
+            if (delays) delays[count] = delay;
+            ++count;
+            break;
+
+         case 0x21: // Extension
+            if (stbi__get8(s) == 0xF9) {
+               len = stbi__get8(s);
+               if (len == 4) {
+                  stbi__get8(s);
+                  delay = 10 * stbi__get16le(s);
+                  stbi__get8(s);
+               } else {
+                  stbi__skip(s, len);
+               }
+            }
+            break;
+
+         default: // 0x3B ends the stream, anything else is corrupt and ends it as well
+            return count;
+      }
+      while ((len = stbi__get8(s)) != 0)
+         stbi__skip(s, len);
+   }
+   return count;
+}
+
+struct stbi__gif_frames
+{
+   stbi__context s;
+   stbi__gif g;
+   int *delays;
+   int frame_count;
+   int decoded;
+   stbi_uc *two_back;   // the frame before the last one, which "restore previous" disposal goes back to
+   stbi_uc *frame;      // the returned frame when it has to be converted or flipped, otherwise scratch
+};
+
+STBIDEF stbi_gif_frames *stbi_gif_frames_open(stbi_uc const *buffer, int len, int *x, int *y, int *frame_count)
+{
+   return stbi_gif_frames_open_with_options(buffer, len, x, y, frame_count, NULL);
+}
+
+// only the flip setting applies, failures are reported through stbi_failure_reason
+STBIDEF stbi_gif_frames *stbi_gif_frames_open_with_options(stbi_uc const *buffer, int len, int *x, int *y, int *frame_count, stbi_load_options const *options)
+{
+   int size;
+   stbi_gif_frames *f = (stbi_gif_frames *) stbi__malloc(sizeof(stbi_gif_frames));
+   if (!f) return (stbi_gif_frames *) stbi__errpuc("outofmem", "Out of memory");
+   memset(f, 0, sizeof(*f));
+   stbi__start_mem(&f->s, buffer, len);
+   if (options) stbi__apply_options(&f->s, options);
+
+   if (!stbi__gif_test(&f->s) || !stbi__gif_info_raw(&f->s, x, y, NULL)) {
+      STBI_FREE(f);
+      return (stbi_gif_frames *) stbi__errpuc("not GIF", "Corrupt GIF");
+   }
+   stbi__rewind(&f->s);
+   if (!stbi__mad3sizes_valid(4, *x, *y, 0)) {
+      STBI_FREE(f);
+      return (stbi_gif_frames *) stbi__errpuc("too large", "GIF image is too large");
+   }
+   size = 4 * *x * *y;
+
+   f->frame_count = stbi__gif_scan_frames(&f->s, NULL);
+   stbi__rewind(&f->s);
+   f->delays = (int *) stbi__malloc_mad2(f->frame_count + 1, (int) sizeof(int), 0);
+   f->two_back = (stbi_uc *) stbi__malloc(size);
+   f->frame = (stbi_uc *) stbi__malloc(size);
+   if (!f->delays || !f->two_back || !f->frame) {
+      stbi_gif_frames_close(f);
+      return (stbi_gif_frames *) stbi__errpuc("outofmem", "Out of memory");
+   }
+   stbi__gif_scan_frames(&f->s, f->delays);
+   stbi__rewind(&f->s);
+
+   if (frame_count) *frame_count = f->frame_count;
+   return f;
+}
+
+STBIDEF int const *stbi_gif_frames_delays(stbi_gif_frames *f)
+{
+   return f->delays;
+}
+
+STBIDEF stbi_uc *stbi_gif_frames_next(stbi_gif_frames *f, int *delay, int req_comp)
+{
+   stbi_uc *u, *swap;
+   int size;
+   if (req_comp < 0 || req_comp > 4) return stbi__errpuc("bad req_comp", "Internal error");
+   if (f->decoded == f->frame_count) return NULL;
+
+   // the new frame is composited over the last one in place, so that is kept for the one after
+   size = 4 * f->g.w * f->g.h;
+   if (f->decoded > 0) memcpy(f->frame, f->g.out, size);
+   u = stbi__gif_load_next(&f->s, &f->g, NULL, 4, f->decoded >= 2 ? f->two_back : NULL);
+   if (f->decoded > 0) {
+      swap = f->two_back;
+      f->two_back = f->frame;
+      f->frame = swap;
+   }
+   if (u == (stbi_uc *) &f->s) u = NULL; // end of animated gif marker
+   if (!u) {
+      // corrupt, the frames from here on don't exist after all
+      f->frame_count = f->decoded;
+      return NULL;
+   }
+   ++f->decoded;
+   if (delay) *delay = f->g.delay;
+
+   if ((req_comp == 0 || req_comp == 4) && !f->s.flip_vertically)
+      return u;
+   stbi__convert_format_into(f->frame, u, 4, req_comp ? req_comp : 4, f->g.w, f->g.h, f->s.flip_vertically);
+   return f->frame;
+}
+
+STBIDEF void stbi_gif_frames_close(stbi_gif_frames *f)
+{
+   if (!f) return;
+   STBI_FREE(f->g.out);
+   STBI_FREE(f->g.background);
+   STBI_FREE(f->g.history);
+   STBI_FREE(f->delays);
+   STBI_FREE(f->two_back);
+   STBI_FREE(f->frame);
+   STBI_FREE(f);
+}
 #endif
 
 // *************************************************************************************************
@@ -6750,6 +8092,79 @@ static void stbi__hdr_convert(float *output, stbi_uc *input, int req_comp)
    }
 }
 
+// converts a scanline of rgbe pixels. for rgb and rgba output the SIMD loops build the
+// exponent as two powers of two that are each a normal float, so the result is exact
+// for every exponent and matches stbi__hdr_convert to the bit
+static void stbi__hdr_convert_row(float *output, stbi_uc *input, int count, int req_comp)
+{
+   int i = 0;
+#ifdef STBI_SSE2
+   if (req_comp >= 3 && stbi__sse2_available()) {
+      __m128i zero = _mm_setzero_si128();
+      __m128i bias = _mm_set1_epi32(127 - 68);
+      __m128 rgb = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+      __m128 alpha = _mm_setr_ps(0, 0, 0, 1.0f);
+      // 4 pixels at a time, but always leaving one behind since rgb stores spill a float into the next pixel
+      for (; i + 5 <= count; i += 4) {
+         __m128i rgbe = _mm_loadu_si128((__m128i const *) (input + i*4));
+         __m128i lo = _mm_unpacklo_epi8(rgbe, zero);
+         __m128i hi = _mm_unpackhi_epi8(rgbe, zero);
+         __m128i px[4];
+         int k;
+         px[0] = _mm_unpacklo_epi16(lo, zero);
+         px[1] = _mm_unpackhi_epi16(lo, zero);
+         px[2] = _mm_unpacklo_epi16(hi, zero);
+         px[3] = _mm_unpackhi_epi16(hi, zero);
+         for (k=0; k < 4; ++k) {
+            __m128i e = _mm_shuffle_epi32(px[k], 0xff);
+            __m128i e1 = _mm_srli_epi32(e, 1);
+            __m128 f1 = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(e1, bias), 23));
+            __m128 f2 = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(_mm_sub_epi32(e, e1), bias), 23));
+            __m128 v = _mm_mul_ps(_mm_mul_ps(_mm_cvtepi32_ps(px[k]), f1), f2);
+            v = _mm_andnot_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(e, zero)), v);
+            _mm_storeu_ps(output + (i+k)*req_comp, _mm_or_ps(_mm_and_ps(v, rgb), alpha));
+         }
+      }
+   }
+#elif defined(STBI_NEON)
+   if (req_comp >= 3) {
+      uint32x4_t bias = vdupq_n_u32(127 - 68);
+      float32x4_t zero = vdupq_n_f32(0), one = vdupq_n_f32(1.0f);
+      for (; i + 8 <= count; i += 8) {
+         uint8x8x4_t rgbe = vld4_u8(input + i*4);
+         uint16x8_t wide[3];
+         uint16x8_t e16 = vmovl_u8(rgbe.val[3]);
+         int h, k;
+         for (k=0; k < 3; ++k)
+            wide[k] = vmovl_u8(rgbe.val[k]);
+         for (h=0; h < 2; ++h) {
+            uint32x4_t e = vmovl_u16(h ? vget_high_u16(e16) : vget_low_u16(e16));
+            uint32x4_t e1 = vshrq_n_u32(e, 1);
+            float32x4_t f1 = vreinterpretq_f32_u32(vshlq_n_u32(vaddq_u32(e1, bias), 23));
+            float32x4_t f2 = vreinterpretq_f32_u32(vshlq_n_u32(vaddq_u32(vsubq_u32(e, e1), bias), 23));
+            uint32x4_t black = vceqq_u32(e, vdupq_n_u32(0));
+            float32x4_t c[3];
+            for (k=0; k < 3; ++k) {
+               uint32x4_t v = vmovl_u16(h ? vget_high_u16(wide[k]) : vget_low_u16(wide[k]));
+               c[k] = vbslq_f32(black, zero, vmulq_f32(vmulq_f32(vcvtq_f32_u32(v), f1), f2));
+            }
+            if (req_comp == 3) {
+               float32x4x3_t out;
+               out.val[0] = c[0]; out.val[1] = c[1]; out.val[2] = c[2];
+               vst3q_f32(output + (i + h*4)*3, out);
+            } else {
+               float32x4x4_t out;
+               out.val[0] = c[0]; out.val[1] = c[1]; out.val[2] = c[2]; out.val[3] = one;
+               vst4q_f32(output + (i + h*4)*4, out);
+            }
+         }
+      }
+   }
+#endif
+   for (; i < count; ++i)
+      stbi__hdr_convert(output + i*req_comp, input + i*4, req_comp);
+}
+
 static float *stbi__hdr_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri)
 {
    char buffer[STBI__HDR_BUFLEN];
@@ -6760,6 +8175,7 @@ static float *stbi__hdr_load(stbi__context *s, int *x, int *y, int *comp, int re
    float *hdr_data;
    int len;
    unsigned char count, value;
+   stbi_uc dump[128];
    int i, j, k, c1,c2, z;
    const char *headerToken;
    STBI_NOTUSED(ri);
@@ -6834,14 +8250,14 @@ static float *stbi__hdr_load(stbi__context *s, int *x, int *y, int *comp, int re
             stbi__hdr_convert(hdr_data, rgbe, req_comp);
             i = 1;
             j = 0;
-            STBI_FREE(scanline);
+            stbi__scratch_free(scanline);
             goto main_decode_loop; // yes, this makes no sense
          }
          len <<= 8;
          len |= stbi__get8(s);
-         if (len != width) { STBI_FREE(hdr_data); STBI_FREE(scanline); return stbi__errpf("invalid decoded scanline length", "corrupt HDR"); }
+         if (len != width) { STBI_FREE(hdr_data); stbi__scratch_free(scanline); return stbi__errpf("invalid decoded scanline length", "corrupt HDR"); }
          if (scanline == NULL) {
-            scanline = (stbi_uc *) stbi__malloc_mad2(width, 4, 0);
+            scanline = (stbi_uc *) stbi__scratch_alloc((size_t) width * 4);
             if (!scanline) {
                STBI_FREE(hdr_data);
                return stbi__errpf("outofmem", "Out of memory");
@@ -6857,22 +8273,22 @@ static float *stbi__hdr_load(stbi__context *s, int *x, int *y, int *comp, int re
                   // Run
                   value = stbi__get8(s);
                   count -= 128;
-                  if (count > nleft) { STBI_FREE(hdr_data); STBI_FREE(scanline); return stbi__errpf("corrupt", "bad RLE data in HDR"); }
+                  if (count > nleft) { STBI_FREE(hdr_data); stbi__scratch_free(scanline); return stbi__errpf("corrupt", "bad RLE data in HDR"); }
                   for (z = 0; z < count; ++z)
                      scanline[i++ * 4 + k] = value;
                } else {
-                  // Dump
-                  if (count > nleft) { STBI_FREE(hdr_data); STBI_FREE(scanline); return stbi__errpf("corrupt", "bad RLE data in HDR"); }
+                  // Dump, read in one go rather than a byte at a time
+                  if (count > nleft) { STBI_FREE(hdr_data); stbi__scratch_free(scanline); return stbi__errpf("corrupt", "bad RLE data in HDR"); }
+                  if (!stbi__getn(s, dump, count))
+                     memset(dump, 0, count);
                   for (z = 0; z < count; ++z)
-                     scanline[i++ * 4 + k] = stbi__get8(s);
+                     scanline[i++ * 4 + k] = dump[z];
                }
             }
          }
-         for (i=0; i < width; ++i)
-            stbi__hdr_convert(hdr_data+(j*width + i)*req_comp, scanline + i*4, req_comp);
+         stbi__hdr_convert_row(hdr_data + j*width*req_comp, scanline, width, req_comp);
       }
-      if (scanline)
-         STBI_FREE(scanline);
+      stbi__scratch_free(scanline);
    }
 
    return hdr_data;
@@ -7110,8 +8526,9 @@ static void *stbi__pnm_load(stbi__context *s, int *x, int *y, int *comp, int req
    stbi__getn(s, out, s->img_n * s->img_x * s->img_y);
 
    if (req_comp && req_comp != s->img_n) {
-      out = stbi__convert_format(out, s->img_n, req_comp, s->img_x, s->img_y);
+      out = stbi__convert_format(out, s->img_n, req_comp, s->img_x, s->img_y, s->flip_vertically);
       if (out == NULL) return out; // stbi__convert_format frees input on failure
+      ri->flipped = s->flip_vertically;
    }
    return out;
 }
@@ -7304,6 +8721,58 @@ STBIDEF int stbi_info_from_callbacks(stbi_io_callbacks const *c, void *user, int
    return stbi__info_main(&s,x,y,comp);
 }
 
+static int stbi__header_main(stbi__context *s, stbi_header *h)
+{
+   memset(h, 0, sizeof(*h));
+   h->bits_per_channel = 8;
+
+   #ifndef STBI_NO_JPEG
+   {
+      int r;
+      stbi__jpeg *j = (stbi__jpeg *) stbi__scratch_alloc(sizeof(stbi__jpeg));
+      if (!j) return stbi__err("outofmem", "Out of memory");
+      j->s = s;
+      r = stbi__jpeg_info_raw(j, &h->x, &h->y, &h->channels);
+      h->is_progressive = r && j->progressive;
+      stbi__scratch_free(j);
+      if (r) return 1;
+   }
+   #endif
+
+   #ifndef STBI_NO_PNG
+   {
+      stbi__png p;
+      p.s = s;
+      if (stbi__png_info_raw(&p, &h->x, &h->y, &h->channels)) {
+         h->bits_per_channel = p.depth == 16 ? 16 : 8;
+         return 1;
+      }
+   }
+   #endif
+
+   #ifndef STBI_NO_PSD
+   if (stbi__psd_is16(s)) h->bits_per_channel = 16;
+   stbi__rewind(s);
+   #endif
+
+   #ifndef STBI_NO_HDR
+   if (stbi__hdr_test(s)) {
+      h->bits_per_channel = 32;
+      h->is_hdr = 1;
+   }
+   #endif
+
+   // the rest have nothing to add to stbi_info; JPEG and PNG fail on their first bytes this time
+   return stbi__info_main(s, &h->x, &h->y, &h->channels);
+}
+
+STBIDEF int stbi_header_from_memory(stbi_uc const *buffer, int len, stbi_header *header)
+{
+   stbi__context s;
+   stbi__start_mem(&s,buffer,len);
+   return stbi__header_main(&s,header);
+}
+
 STBIDEF int stbi_is_16_bit_from_memory(stbi_uc const *buffer, int len)
 {
    stbi__context s;
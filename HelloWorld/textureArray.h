@@ -0,0 +1,81 @@
+#ifndef TEXTUREARRAY_H
+#define TEXTUREARRAY_H
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <vector>
+
+/*
+ The texture layers of every object, kept in a buffer texture next to the instance buffer so
+ the vertex shader can look them up with the same index as the model matrix. Each object has
+ one layer per texture it samples, stored as an RG32I texel.
+ */
+class TextureLayerBuffer {
+
+public:
+    static const int LAYERS_PER_OBJECT = 2;
+
+    TextureLayerBuffer() : buffer(0), texture(0), capacity(0), dirty(false) {
+    }
+
+    ~TextureLayerBuffer() {
+        if (buffer) {
+            glDeleteBuffers(1, &buffer);
+            glDeleteTextures(1, &texture);
+        }
+    }
+
+    TextureLayerBuffer(const TextureLayerBuffer&) = delete;
+    TextureLayerBuffer& operator=(const TextureLayerBuffer&) = delete;
+
+    void set(size_t object, int layer0, int layer1) {
+        if (layers.size() < (object + 1) * LAYERS_PER_OBJECT) {
+            layers.resize((object + 1) * LAYERS_PER_OBJECT, 0);
+            dirty = true;
+        }
+        int32_t *objectLayers = &layers[object * LAYERS_PER_OBJECT];
+        if (objectLayers[0] != layer0 || objectLayers[1] != layer1) {
+            objectLayers[0] = layer0;
+            objectLayers[1] = layer1;
+            dirty = true;
+        }
+    }
+
+    // Uploads the layers if any of them changed since the last update
+    void update() {
+        if (!dirty || layers.empty()) {
+            return;
+        }
+        if (!buffer) {
+            glGenBuffers(1, &buffer);
+            glGenTextures(1, &texture);
+        }
+
+        glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+        if (layers.size() > capacity) {
+            capacity = layers.size() + layers.size() / 2;
+            glBufferData(GL_TEXTURE_BUFFER, capacity * sizeof(int32_t), NULL, GL_DYNAMIC_DRAW);
+            glBindTexture(GL_TEXTURE_BUFFER, texture);
+            glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32I, buffer);
+        }
+        glBufferSubData(GL_TEXTURE_BUFFER, 0, layers.size() * sizeof(int32_t), &layers[0]);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        dirty = false;
+    }
+
+    // Binds the layers to the given texture unit for the vertex shader's isamplerBuffer
+    void bind(unsigned int unit) const {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_BUFFER, texture);
+    }
+
+private:
+    unsigned int buffer;
+    unsigned int texture;
+    size_t capacity;
+    bool dirty;
+    std::vector<int32_t> layers;
+};
+
+#endif
@@ -0,0 +1,404 @@
+#ifndef TEXTUREATLAS_H
+#define TEXTUREATLAS_H
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+/*
+ Packs rectangles into a fixed size area using a skyline: the packed area is described by
+ its top outline, a list of horizontal segments. Every new rectangle is placed on top of
+ the outline where its top edge ends up lowest, which fills the area from the bottom up
+ without ever having to remember the free space underneath the outline.
+ */
+class SkylinePacker {
+
+public:
+    SkylinePacker(int width, int height) : width(width), height(height) {
+        Segment first;
+        first.x = 0;
+        first.y = 0;
+        first.width = width;
+        skyline.push_back(first);
+    }
+
+    // Finds room for a width x height rectangle and returns false if it doesn't fit anymore
+    bool insert(int rectangleWidth, int rectangleHeight, int &x, int &y) {
+        int bestIndex = -1, bestTop = height + 1, bestWidth = width + 1;
+        for (size_t i = 0; i < skyline.size(); i++) {
+            int top;
+            if (!fits(i, rectangleWidth, rectangleHeight, top)) {
+                continue;
+            }
+            // Preferring the lowest spot, and the narrowest segment when there's a tie so wide ones stay open
+            if (top < bestTop || (top == bestTop && skyline[i].width < bestWidth)) {
+                bestIndex = (int) i;
+                bestTop = top;
+                bestWidth = skyline[i].width;
+            }
+        }
+        if (bestIndex < 0) {
+            return false;
+        }
+        x = skyline[bestIndex].x;
+        y = bestTop - rectangleHeight;
+        addSegment(bestIndex, x, bestTop, rectangleWidth);
+        return true;
+    }
+
+    // Raises the outline over [x, x + rectangleWidth) to at least top, for rectangles that were placed without insert()
+    void occupy(int x, int rectangleWidth, int top) {
+        std::vector<Segment> raised;
+        for (size_t i = 0; i < skyline.size(); i++) {
+            const Segment &segment = skyline[i];
+            int segmentEnd = segment.x + segment.width;
+            int begin = segment.x > x ? segment.x : x;
+            int end = segmentEnd < x + rectangleWidth ? segmentEnd : x + rectangleWidth;
+            if (begin >= end) {
+                raised.push_back(segment);
+                continue;
+            }
+            appendSegment(raised, segment.x, segment.y, begin - segment.x);
+            appendSegment(raised, begin, segment.y > top ? segment.y : top, end - begin);
+            appendSegment(raised, end, segment.y, segmentEnd - end);
+        }
+        skyline.swap(raised);
+        mergeSegments();
+    }
+
+private:
+    struct Segment {
+        int x, y, width;
+    };
+
+    int width, height;
+    std::vector<Segment> skyline;
+
+    // Whether the rectangle fits with its left edge at the start of the given segment, and how high its top would be
+    bool fits(size_t index, int rectangleWidth, int rectangleHeight, int &top) const {
+        int x = skyline[index].x;
+        if (x + rectangleWidth > width) {
+            return false;
+        }
+        int y = 0;
+        int remaining = rectangleWidth;
+        for (size_t i = index; remaining > 0; i++) {
+            y = skyline[i].y > y ? skyline[i].y : y;
+            remaining -= skyline[i].width;
+        }
+        top = y + rectangleHeight;
+        return top <= height;
+    }
+
+    void addSegment(int index, int x, int y, int segmentWidth) {
+        Segment added;
+        added.x = x;
+        added.y = y;
+        added.width = segmentWidth;
+        skyline.insert(skyline.begin() + index, added);
+
+        // Trimming or removing the segments that are now underneath the new one
+        for (size_t i = index + 1; i < skyline.size(); ) {
+            int covered = x + segmentWidth - skyline[i].x;
+            if (covered <= 0) {
+                break;
+            }
+            if (covered < skyline[i].width) {
+                skyline[i].x += covered;
+                skyline[i].width -= covered;
+                break;
+            }
+            skyline.erase(skyline.begin() + i);
+        }
+        mergeSegments();
+    }
+
+    static void appendSegment(std::vector<Segment> &segments, int x, int y, int segmentWidth) {
+        if (segmentWidth <= 0) {
+            return;
+        }
+        Segment appended;
+        appended.x = x;
+        appended.y = y;
+        appended.width = segmentWidth;
+        segments.push_back(appended);
+    }
+
+    // Merging neighbours at the same height
+    void mergeSegments() {
+        for (size_t i = 0; i + 1 < skyline.size(); ) {
+            if (skyline[i].y == skyline[i + 1].y) {
+                skyline[i].width += skyline[i + 1].width;
+                skyline.erase(skyline.begin() + i + 1);
+            } else {
+                i++;
+            }
+        }
+    }
+};
+
+// Where an image ended up in the atlas, along with the transform that moves its UVs there
+struct AtlasRegion {
+    unsigned int page;
+    int x, y, width, height;    // In pixels, without the gutter
+    float uvOffset[2];
+    float uvScale[2];
+};
+
+/*
+ Packs many small images into a few large RGBA8 textures (pages), so they can all be drawn
+ with the same texture bound. Each image is surrounded by a gutter of copies of its edge
+ pixels, so filtering and the smaller mip levels don't bleed neighbouring images into it.
+ Regions also start on multiples of the alignment, which keeps their borders on whole texels
+ for that many mip levels down.
+
+ The atlas can be built at runtime with add() and upload(), or built ahead of time with
+ add() and save() and then loaded with load() and upload(), skipping the packing.
+
+ Images that rely on GL_REPEAT can't live in an atlas, since repeating would wrap around the
+ whole page instead of the image.
+ */
+class TextureAtlas {
+
+public:
+    // Pixels around each image that are filled with its edges, and what region positions are rounded to
+    static const int GUTTER = 8;
+    static const int ALIGNMENT = 8;
+
+    TextureAtlas(int pageSize = 2048) : pageSize(pageSize) {
+    }
+
+    ~TextureAtlas() {
+        for (size_t i = 0; i < textures.size(); i++) {
+            glDeleteTextures(1, &textures[i]);
+        }
+    }
+
+    TextureAtlas(const TextureAtlas&) = delete;
+    TextureAtlas& operator=(const TextureAtlas&) = delete;
+
+    /*
+     Packs an image with 1 to 4 channels of 8 bits each into one of the pages and returns the
+     index of its region. Returns -1 if the image is too large to fit on a page at all.
+     */
+    int add(int width, int height, int channels, const unsigned char *pixels) {
+        int paddedWidth = alignUp(width + 2 * GUTTER);
+        int paddedHeight = alignUp(height + 2 * GUTTER);
+        if (paddedWidth > pageSize || paddedHeight > pageSize) {
+            return -1;
+        }
+
+        // Trying the pages we already have before starting a new one
+        int x = 0, y = 0;
+        size_t page = 0;
+        while (page < packers.size() && !packers[page].insert(paddedWidth, paddedHeight, x, y)) {
+            page++;
+        }
+        if (page == packers.size()) {
+            packers.push_back(SkylinePacker(pageSize, pageSize));
+            pages.push_back(std::vector<unsigned char>((size_t) pageSize * pageSize * 4, 0));
+            packers[page].insert(paddedWidth, paddedHeight, x, y);
+        }
+
+        AtlasRegion region;
+        region.page = (unsigned int) page;
+        region.x = x + GUTTER;
+        region.y = y + GUTTER;
+        region.width = width;
+        region.height = height;
+        computeUVs(region);
+        copyWithGutter(region, channels, pixels);
+        regions.push_back(region);
+        return (int) regions.size() - 1;
+    }
+
+    const AtlasRegion& region(int index) const {
+        return regions[index];
+    }
+
+    size_t regionCount() const {
+        return regions.size();
+    }
+
+    size_t pageCount() const {
+        return pages.size();
+    }
+
+    /*
+     Moves the UVs of a mesh onto the image's region. The UVs are expected to be in [0, 1]
+     and sit uvOffset floats into each vertex of stride floats.
+     */
+    void rewriteUVs(int regionIndex, float *vertices, size_t vertexCount, size_t stride, size_t uvOffset) const {
+        const AtlasRegion &target = regions[regionIndex];
+        for (size_t i = 0; i < vertexCount; i++) {
+            float *uv = vertices + i * stride + uvOffset;
+            uv[0] = target.uvOffset[0] + uv[0] * target.uvScale[0];
+            uv[1] = target.uvOffset[1] + uv[1] * target.uvScale[1];
+        }
+    }
+
+    // Creates a mipmapped texture for every page, stopping at the mip level the gutters stop protecting
+    void upload() {
+        int maxLevel = 0;
+        while ((2 << maxLevel) <= GUTTER && (2 << maxLevel) <= ALIGNMENT) {
+            maxLevel++;
+        }
+        for (size_t i = textures.size(); i < pages.size(); i++) {
+            unsigned int texture;
+            glGenTextures(1, &texture);
+            glBindTexture(GL_TEXTURE_2D, texture);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, maxLevel);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, pageSize, pageSize, 0, GL_RGBA, GL_UNSIGNED_BYTE, &pages[i][0]);
+            glGenerateMipmap(GL_TEXTURE_2D);
+            textures.push_back(texture);
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    // The texture of a page, only valid after upload()
+    unsigned int texture(unsigned int page) const {
+        return textures[page];
+    }
+
+    /*
+     Writes the packed atlas to a file: a small header, the region table and then the raw
+     pixels of every page. Returns false if the file couldn't be written.
+     */
+    bool save(const char *path) const {
+        std::ofstream file(path, std::ios::binary);
+        if (!file) {
+            return false;
+        }
+        uint32_t header[5] = { FILE_MAGIC, FILE_VERSION, (uint32_t) pageSize, (uint32_t) pages.size(), (uint32_t) regions.size() };
+        file.write((const char*) header, sizeof(header));
+        for (size_t i = 0; i < regions.size(); i++) {
+            int32_t entry[5] = { (int32_t) regions[i].page, regions[i].x, regions[i].y, regions[i].width, regions[i].height };
+            file.write((const char*) entry, sizeof(entry));
+        }
+        for (size_t i = 0; i < pages.size(); i++) {
+            file.write((const char*) &pages[i][0], pages[i].size());
+        }
+        return (bool) file;
+    }
+
+    /*
+     Replaces the contents of the atlas with one written by save(), returns false and leaves the
+     atlas as it was if the file isn't a valid atlas. Images added afterwards are packed around
+     the loaded ones, and the next upload() creates textures for every page.
+     */
+    bool load(const char *path) {
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        uint32_t header[5];
+        std::streamoff fileSize = file.tellg();
+        file.seekg(0);
+        if (!file.read((char*) header, sizeof(header)) || header[0] != FILE_MAGIC || header[1] != FILE_VERSION) {
+            return false;
+        }
+        // Checking the sizes against the file before allocating anything, so a corrupt header can't ask for gigabytes
+        if (header[2] == 0 || header[2] > MAX_PAGE_SIZE || header[3] == 0 || header[3] > MAX_PAGES) {
+            return false;
+        }
+        int loadedPageSize = (int) header[2];
+        size_t pageBytes = (size_t) loadedPageSize * loadedPageSize * 4;
+        uint64_t expectedSize = sizeof(header) + (uint64_t) header[4] * 5 * sizeof(int32_t) + (uint64_t) header[3] * pageBytes;
+        if ((uint64_t) fileSize != expectedSize) {
+            return false;
+        }
+
+        std::vector<AtlasRegion> loadedRegions(header[4]);
+        for (size_t i = 0; i < loadedRegions.size(); i++) {
+            int32_t entry[5];
+            if (!file.read((char*) entry, sizeof(entry))) {
+                return false;
+            }
+            if (entry[0] < 0 || (uint32_t) entry[0] >= header[3] || entry[1] < 0 || entry[2] < 0 || entry[3] <= 0 || entry[4] <= 0 ||
+                entry[3] > loadedPageSize - entry[1] || entry[4] > loadedPageSize - entry[2]) {
+                return false;
+            }
+            loadedRegions[i].page = (unsigned int) entry[0];
+            loadedRegions[i].x = entry[1];
+            loadedRegions[i].y = entry[2];
+            loadedRegions[i].width = entry[3];
+            loadedRegions[i].height = entry[4];
+        }
+        std::vector<std::vector<unsigned char>> loadedPages(header[3], std::vector<unsigned char>(pageBytes));
+        for (size_t i = 0; i < loadedPages.size(); i++) {
+            if (!file.read((char*) &loadedPages[i][0], pageBytes)) {
+                return false;
+            }
+        }
+
+        pageSize = loadedPageSize;
+        pages.swap(loadedPages);
+        regions.swap(loadedRegions);
+        for (size_t i = 0; i < regions.size(); i++) {
+            computeUVs(regions[i]);
+        }
+
+        // Rebuilding the outline of every page from the padded rectangles add() reserved for its regions
+        packers.assign(pages.size(), SkylinePacker(pageSize, pageSize));
+        for (size_t i = 0; i < regions.size(); i++) {
+            int x = regions[i].x - GUTTER;
+            int top = regions[i].y - GUTTER + alignUp(regions[i].height + 2 * GUTTER);
+            packers[regions[i].page].occupy(x, alignUp(regions[i].width + 2 * GUTTER), top < pageSize ? top : pageSize);
+        }
+
+        // The old pages' textures are gone, upload() makes new ones for every loaded page
+        for (size_t i = 0; i < textures.size(); i++) {
+            glDeleteTextures(1, &textures[i]);
+        }
+        textures.clear();
+        return true;
+    }
+
+private:
+    static const uint32_t FILE_MAGIC = 0x534C5441;     // "ATLS"
+    static const uint32_t FILE_VERSION = 1;
+
+    // Anything beyond these in a file is taken to be corruption rather than an atlas
+    static const uint32_t MAX_PAGE_SIZE = 16384;
+    static const uint32_t MAX_PAGES = 256;
+
+    int pageSize;
+    std::vector<SkylinePacker> packers;
+    std::vector<std::vector<unsigned char>> pages;
+    std::vector<AtlasRegion> regions;
+    std::vector<unsigned int> textures;
+
+    static int alignUp(int size) {
+        return (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    }
+
+    void computeUVs(AtlasRegion &region) const {
+        region.uvOffset[0] = (float) region.x / pageSize;
+        region.uvOffset[1] = (float) region.y / pageSize;
+        region.uvScale[0] = (float) region.width / pageSize;
+        region.uvScale[1] = (float) region.height / pageSize;
+    }
+
+    // Copies the image into its region, then fills the gutter by clamping to the nearest edge pixel
+    void copyWithGutter(const AtlasRegion &region, int channels, const unsigned char *pixels) {
+        std::vector<unsigned char> &page = pages[region.page];
+        for (int y = -GUTTER; y < region.height + GUTTER; y++) {
+            int sourceY = y < 0 ? 0 : (y >= region.height ? region.height - 1 : y);
+            for (int x = -GUTTER; x < region.width + GUTTER; x++) {
+                int sourceX = x < 0 ? 0 : (x >= region.width ? region.width - 1 : x);
+                const unsigned char *source = pixels + ((size_t) sourceY * region.width + sourceX) * channels;
+                unsigned char *destination = &page[((size_t) (region.y + y) * pageSize + region.x + x) * 4];
+                destination[0] = source[0];
+                destination[1] = channels >= 3 ? source[1] : source[0];
+                destination[2] = channels >= 3 ? source[2] : source[0];
+                destination[3] = channels == 4 ? source[3] : (channels == 2 ? source[1] : 255);
+            }
+        }
+    }
+};
+
+#endif
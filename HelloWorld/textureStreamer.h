@@ -0,0 +1,606 @@
+#ifndef TEXTURESTREAMER_H
+#define TEXTURESTREAMER_H
+
+#include <glad/glad.h>
+
+#include "stb_image.h"
+#include "jobSystem.h"
+#include "assetIndex.h"
+#include "fileWatcher.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+// Where an image ended up: which of the streamed textures, and which layer of it
+struct TextureLayer {
+    int texture;    // -1 if the image couldn't be read
+    int layer;
+};
+
+/*
+ Keeps only the mip levels of each texture that are actually needed on the GPU. A texture
+ starts out with just its small mip levels, which are cheap to load. Every frame the objects
+ using it report how large they appear on the screen, and once that calls for a finer level
+ it gets decoded on the job system and uploaded when it's ready. If the levels on the GPU add
+ up to more than the memory budget, the finest levels of textures that don't need them (or
+ haven't been seen in a while) are dropped again.
+
+ Each level is its own glTexImage3D, so dropping one really frees it. GL_TEXTURE_BASE_LEVEL
+ points at the finest level that is loaded, so levels that aren't there are never sampled.
+
+ JPEGs are only decoded as far as the levels being loaded need: straight to a smaller size
+ for the coarse levels, and progressive ones only up to their first scans for the initial
+ levels, so they show up as soon as possible.
+
+ Streamed textures are GL_TEXTURE_2D_ARRAY textures, with one layer per image, so a group of
+ same sized images shares a single bind and the shaders pick their images out of it by layer.
+ addGrouped() sorts any mix of images into as few of these arrays as their sizes allow.
+
+ Images with 16 bits per channel are kept at that precision as GL_RGBA16, and HDR images are
+ stored as GL_RGBA16F half floats, which keeps their range at half the memory of floats.
+ */
+class TextureStreamer {
+
+public:
+    // Levels no larger than this are loaded as soon as a texture is added, and are never dropped
+    static const int INITIAL_SIZE = 64;
+
+    // How many textures can be loading at the same time
+    static const int MAX_LOADS = 2;
+
+    // A texture that no object has asked for in this many updates can drop down to its initial levels
+    static const unsigned int UNUSED_UPDATES = 120;
+
+    // How many updates apart a texture that failed to load checks whether its images were replaced
+    static const unsigned int RETRY_UPDATES = 60;
+
+    // OpenGL 3.3 guarantees at least this many layers per array texture
+    static const int MAX_LAYERS = 256;
+
+    // How the levels of a texture are stored, picked from its images when it's added
+    enum Format {
+        RGBA8,
+        RGBA16,     // Images with 16 bits per channel, like some PNGs
+        RGBA16F     // HDR images, decoded as floats and stored as half floats
+    };
+
+    // The images are decoded on the workers, so how to flip them is kept here rather than in stb_image's global settings
+    TextureStreamer(JobSystem &jobSystem, size_t budget, bool flipVertically) :
+        jobSystem(jobSystem), budget(budget), resident(0), updateCount(0), loadsInFlight(0) {
+        stbi_load_options_default(&options);
+        options.flip_vertically = flipVertically;
+    }
+
+    ~TextureStreamer() {
+        for (size_t i = 0; i < textures.size(); i++) {
+            jobSystem.wait(textures[i].loading);
+            if (textures[i].name) {
+                glDeleteTextures(1, &textures[i].name);
+            }
+        }
+    }
+
+    TextureStreamer(const TextureStreamer&) = delete;
+    TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+    /*
+     Adds a texture made of the given images, which all have to be the same size, and starts
+     loading its initial levels. Returns the texture's index, or -1 if the images can't be read
+     or there are more than MAX_LAYERS of them.
+     Images that are in the index don't have their headers read again.
+     */
+    int add(const std::vector<std::string> &layerPaths, const AssetIndex *index = NULL) {
+        int width = 0, height = 0;
+        Format format = RGBA8;
+        for (size_t i = 0; i < layerPaths.size(); i++) {
+            int layerWidth, layerHeight;
+            Format layerFormat;
+            if (!describe(layerPaths[i], index, layerWidth, layerHeight, layerFormat) ||
+                (i > 0 && (layerWidth != width || layerHeight != height || layerFormat != format))) {
+                std::cout << "ERROR::TEXTURESTREAMER::CANNOT_STREAM " << layerPaths[i] << std::endl;
+                return -1;
+            }
+            width = layerWidth;
+            height = layerHeight;
+            format = layerFormat;
+        }
+        if (layerPaths.empty() || layerPaths.size() > (size_t) MAX_LAYERS) {
+            return -1;
+        }
+
+        textures.emplace_back();
+        StreamedTexture &texture = textures.back();
+        texture.paths = layerPaths;
+        texture.format = format;
+        texture.width = width;
+        texture.height = height;
+        texture.levelCount = 1;
+        while ((width >> texture.levelCount) > 0 || (height >> texture.levelCount) > 0) {
+            texture.levelCount++;
+        }
+        texture.initialLevel = 0;
+        while (std::max(width >> texture.initialLevel, height >> texture.initialLevel) > INITIAL_SIZE) {
+            texture.initialLevel++;
+        }
+        texture.residentLevel = texture.levelCount;
+        texture.requestedLevel = texture.levelCount;
+        texture.lastRequest = updateCount;
+        texture.loadingFirst = 0;
+        texture.loadingEnd = 0;
+        texture.failedLevel = -1;
+        texture.failedModified = -1;
+        texture.failedUpdate = 0;
+
+        glGenTextures(1, &texture.name);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture.name);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, texture.levelCount - 1);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, texture.levelCount - 1);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        startLoad(texture, texture.initialLevel);
+        return (int) textures.size() - 1;
+    }
+
+    /*
+     Adds any number of images, of any sizes. The ones with the same size and format become
+     layers of the same texture, up to MAX_LAYERS of them each. Returns where every image ended
+     up, in the order they were given.
+     */
+    std::vector<TextureLayer> addGrouped(const std::vector<std::string> &paths, const AssetIndex *index = NULL) {
+        struct Group {
+            int width, height;
+            Format format;
+            std::vector<size_t> images;
+        };
+        std::vector<Group> groups;
+        std::vector<TextureLayer> placed(paths.size());
+        for (size_t i = 0; i < paths.size(); i++) {
+            placed[i].texture = -1;
+            placed[i].layer = 0;
+            int width, height;
+            Format format;
+            if (!describe(paths[i], index, width, height, format)) {
+                std::cout << "ERROR::TEXTURESTREAMER::CANNOT_STREAM " << paths[i] << std::endl;
+                continue;
+            }
+            size_t group = 0;
+            while (group < groups.size() && (groups[group].width != width || groups[group].height != height ||
+                                             groups[group].format != format || groups[group].images.size() >= (size_t) MAX_LAYERS)) {
+                group++;
+            }
+            if (group == groups.size()) {
+                Group created;
+                created.width = width;
+                created.height = height;
+                created.format = format;
+                groups.push_back(created);
+            }
+            groups[group].images.push_back(i);
+        }
+
+        for (size_t group = 0; group < groups.size(); group++) {
+            const std::vector<size_t> &images = groups[group].images;
+            std::vector<std::string> layerPaths;
+            for (size_t i = 0; i < images.size(); i++) {
+                layerPaths.push_back(paths[images[i]]);
+            }
+            int texture = add(layerPaths, index);
+            for (size_t i = 0; i < images.size(); i++) {
+                placed[images[i]].texture = texture;
+                placed[images[i]].layer = texture >= 0 ? (int) i : 0;
+            }
+        }
+        return placed;
+    }
+
+    unsigned int texture(int index) const {
+        return textures[index].name;
+    }
+
+    // The GPU memory taken up by every level that is currently loaded
+    size_t residentBytes() const {
+        return resident;
+    }
+
+    /*
+     Reports that an object using the texture covers about screenSize pixels across. Only the
+     largest request between two updates counts. Can't be called from several threads at once.
+     */
+    void request(int index, float screenSize) {
+        StreamedTexture &texture = textures[index];
+        int level = 0;
+        if (screenSize > 0.0f) {
+            float texelsPerPixel = (float) std::max(texture.width, texture.height) / screenSize;
+            level = texelsPerPixel > 1.0f ? (int) std::floor(std::log2(texelsPerPixel)) : 0;
+        } else {
+            level = texture.levelCount - 1;
+        }
+        level = std::min(level, texture.levelCount - 1);
+        texture.requestedLevel = std::min(texture.requestedLevel, level);
+        texture.lastRequest = updateCount;
+    }
+
+    /*
+     Uploads whatever finished loading, starts loading the levels that were asked for and drops
+     levels to stay under the budget. Has to be called on the thread that owns the GL context.
+     */
+    void update() {
+        updateCount++;
+        for (size_t i = 0; i < textures.size(); i++) {
+            finishLoad(textures[i]);
+        }
+
+        for (size_t i = 0; i < textures.size() && loadsInFlight < MAX_LOADS; i++) {
+            StreamedTexture &texture = textures[i];
+            if (texture.failedLevel >= 0 && (updateCount - texture.failedUpdate) % RETRY_UPDATES == 0 &&
+                newestModification(texture) != texture.failedModified) {
+                texture.failedLevel = -1;
+            }
+            // Levels that failed to load aren't tried again, but coarser ones still might work
+            int wanted = std::max(std::min(texture.requestedLevel, texture.initialLevel), texture.failedLevel + 1);
+            if (isLoading(texture) || wanted >= texture.residentLevel) {
+                continue;
+            }
+
+            // Making room for the new levels if we can, and settling for coarser ones if we can't
+            size_t needed = levelBytes(texture, wanted, texture.residentLevel);
+            if (resident + needed > budget) {
+                evict(resident + needed - budget, &texture);
+            }
+            while (wanted < texture.residentLevel && resident + levelBytes(texture, wanted, texture.residentLevel) > budget) {
+                wanted++;
+            }
+            if (wanted < texture.residentLevel) {
+                startLoad(texture, wanted);
+            }
+        }
+        if (resident > budget) {
+            evict(resident - budget, NULL);
+        }
+
+        for (size_t i = 0; i < textures.size(); i++) {
+            textures[i].requestedLevel = textures[i].levelCount;
+        }
+    }
+
+    // Blocks until every load that has been started is uploaded, helping with the decoding in the meantime
+    void finishLoading() {
+        for (size_t i = 0; i < textures.size(); i++) {
+            jobSystem.wait(textures[i].loading);
+            finishLoad(textures[i]);
+        }
+    }
+
+private:
+    struct StreamedTexture {
+        std::vector<std::string> paths;
+        Format format;
+        int width, height;
+        int levelCount;
+        int initialLevel;           // The first level that is small enough to always be loaded
+        int residentLevel;          // The finest level on the GPU, levelCount if there are none yet
+        int requestedLevel;         // The finest level asked for since the last update
+        unsigned int lastRequest;   // The update during which the texture was last asked for
+        unsigned int name;
+
+        // Levels [loadingFirst, loadingEnd) are being decoded into loadedLevels by a job
+        JobCounter loading;
+        int loadingFirst, loadingEnd;
+        std::vector<std::vector<unsigned char>> loadedLevels;   // Already in the texture's format
+
+        // A failed load isn't retried every update, only once one of the images has been saved again
+        int failedLevel;            // The coarsest level that failed to load, -1 if none did
+        long long failedModified;   // The newest modification time of the images when it failed
+        unsigned int failedUpdate;
+    };
+
+    JobSystem &jobSystem;
+    stbi_load_options options;
+    size_t budget;
+    size_t resident;
+    unsigned int updateCount;
+    int loadsInFlight;
+    std::deque<StreamedTexture> textures;  // A deque so the jobs can hold on to their texture while more are added
+
+    // Reads the size of an image and how it would be stored, from the index if it's in there
+    static bool describe(const std::string &path, const AssetIndex *index, int &width, int &height, Format &format) {
+        const AssetInfo *info = index ? index->find(path) : NULL;
+        AssetInfo read;
+        if (!info) {
+            AssetIndex::readHeader(path, read);
+            info = &read;
+        }
+        width = info->header.x;
+        height = info->header.y;
+        format = info->header.is_hdr ? RGBA16F : (info->header.bits_per_channel == 16 ? RGBA16 : RGBA8);
+        return info->valid;
+    }
+
+    static int levelSize(int size, int level) {
+        return std::max(size >> level, 1);
+    }
+
+    static size_t bytesPerPixel(Format format) {
+        return format == RGBA8 ? 4 : 8;
+    }
+
+    static void glFormat(Format format, GLint &internalFormat, GLenum &type) {
+        switch (format) {
+            case RGBA16:
+                internalFormat = GL_RGBA16;
+                type = GL_UNSIGNED_SHORT;
+                break;
+            case RGBA16F:
+                internalFormat = GL_RGBA16F;
+                type = GL_HALF_FLOAT;
+                break;
+            default:
+                internalFormat = GL_RGBA8;
+                type = GL_UNSIGNED_BYTE;
+                break;
+        }
+    }
+
+    // Bytes taken up by levels [first, end) of a texture
+    static size_t levelBytes(const StreamedTexture &texture, int first, int end) {
+        size_t bytes = 0;
+        for (int level = first; level < end; level++) {
+            bytes += (size_t) levelSize(texture.width, level) * levelSize(texture.height, level) * bytesPerPixel(texture.format) *
+                     texture.paths.size();
+        }
+        return bytes;
+    }
+
+    bool isLoading(const StreamedTexture &texture) const {
+        return texture.loadingEnd > texture.loadingFirst;
+    }
+
+    static long long newestModification(const StreamedTexture &texture) {
+        long long newest = -1;
+        for (size_t i = 0; i < texture.paths.size(); i++) {
+            newest = std::max(newest, FileWatcher::modificationTime(texture.paths[i]));
+        }
+        return newest;
+    }
+
+    // Decodes every layer and halves it down to the levels from first up to the ones already loaded
+    void startLoad(StreamedTexture &texture, int first) {
+        texture.loadingFirst = first;
+        texture.loadingEnd = texture.residentLevel;
+        texture.loadedLevels.assign(texture.loadingEnd - first, std::vector<unsigned char>());
+        loadsInFlight++;
+
+        StreamedTexture *target = &texture;
+        stbi_load_options layerOptions = options;
+        jobSystem.run([target, layerOptions]() {
+            for (size_t layer = 0; layer < target->paths.size(); layer++) {
+                if (!loadLayer(*target, target->paths[layer], layerOptions)) {
+                    std::cout << "ERROR::TEXTURESTREAMER::FAILED_TO_LOAD " << target->paths[layer] << std::endl;
+                    target->loadedLevels.clear();
+                    return;
+                }
+            }
+        }, &texture.loading);
+    }
+
+    // Decodes one layer with the entry point that matches the texture's format and adds its levels to the load
+    static bool loadLayer(StreamedTexture &texture, const std::string &path, stbi_load_options options) {
+        std::ifstream file(path, std::ios::binary);
+        std::vector<unsigned char> contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        if (contents.empty()) {
+            return false;
+        }
+
+        int width = 0, height = 0, channels;
+        if (texture.format == RGBA16) {
+            stbi_us *data = stbi_load_16_from_memory_with_options(&contents[0], (int) contents.size(), &width, &height,
+                                                                  &channels, 4, &options);
+            return addLevels(texture, data, width, height, 0);
+        }
+        if (texture.format == RGBA16F) {
+            float *data = stbi_loadf_from_memory_with_options(&contents[0], (int) contents.size(), &width, &height,
+                                                             &channels, 4, &options);
+            return addLevels(texture, data, width, height, 0);
+        }
+        int decodedLevel;
+        unsigned char *data = decode(contents, options, texture.loadingFirst, texture.width, texture.height, width, height,
+                                     decodedLevel);
+        return addLevels(texture, data, width, height, decodedLevel);
+    }
+
+    // Halves the decoded image down through the levels being loaded, appending the ones that are wanted
+    template <typename T>
+    static bool addLevels(StreamedTexture &texture, T *data, int width, int height, int decodedLevel) {
+        if (!data || width != levelSize(texture.width, decodedLevel) || height != levelSize(texture.height, decodedLevel)) {
+            stbi_image_free(data);
+            return false;
+        }
+
+        std::vector<T> level(data, data + (size_t) width * height * 4);
+        stbi_image_free(data);
+        for (int l = decodedLevel; l < texture.loadingEnd; l++) {
+            if (l >= texture.loadingFirst) {
+                appendLevel(texture.loadedLevels[l - texture.loadingFirst], level);
+            }
+            if (l + 1 < texture.loadingEnd) {
+                level = halve(level, levelSize(texture.width, l), levelSize(texture.height, l));
+            }
+        }
+        return true;
+    }
+
+    template <typename T>
+    static void appendLevel(std::vector<unsigned char> &output, const std::vector<T> &level) {
+        const unsigned char *bytes = (const unsigned char*) &level[0];
+        output.insert(output.end(), bytes, bytes + level.size() * sizeof(T));
+    }
+
+    // Floats are filtered at full precision and only become half floats on their way to the GPU
+    static void appendLevel(std::vector<unsigned char> &output, const std::vector<float> &level) {
+        size_t offset = output.size();
+        output.resize(offset + level.size() * sizeof(uint16_t));
+        stbi_float_to_half((stbi_us*) &output[offset], &level[0], (int) level.size());
+    }
+
+    /*
+     Decodes an image as RGBA, for levels first and coarser, and sets decodedLevel to the level
+     it came out as. JPEGs are decoded straight to level 1, 2 or 3 with stb_image's reduced IDCT
+     when their size divides evenly. Every level from 3 on is at most an eighth of the image
+     across, so for those a progressive JPEG only has to be decoded until its DC scans are in,
+     which is a fraction of the file and of the decoding time.
+     */
+    static unsigned char *decode(const std::vector<unsigned char> &contents, stbi_load_options options, int first, int fullWidth,
+                                 int fullHeight, int &width, int &height, int &decodedLevel) {
+        int channels;
+        decodedLevel = 0;
+        if (first >= 3) {
+            stbi_progressive_jpeg *jpeg = stbi_progressive_jpeg_open_with_options(&contents[0], (int) contents.size(), &options);
+            if (jpeg && stbi_progressive_jpeg_is_progressive(jpeg)) {
+                while (!stbi_progressive_jpeg_dc_complete(jpeg) && stbi_progressive_jpeg_next_scan(jpeg)) {
+                }
+                unsigned char *data = stbi_progressive_jpeg_image(jpeg, &width, &height, &channels, 4);
+                stbi_progressive_jpeg_close(jpeg);
+                return data;
+            }
+            stbi_progressive_jpeg_close(jpeg);
+        }
+
+        int scaledLevel = std::min(first, 3);
+        if (fullWidth % (1 << scaledLevel) != 0 || fullHeight % (1 << scaledLevel) != 0) {
+            scaledLevel = 0;
+        }
+        options.scale = 1 << scaledLevel;
+        unsigned char *data = stbi_load_from_memory_with_options(&contents[0], (int) contents.size(), &width, &height,
+                                                                 &channels, 4, &options);
+        // Only JPEGs actually come out smaller
+        if (data && width < fullWidth) {
+            decodedLevel = scaledLevel;
+        }
+        return data;
+    }
+
+    // Uploads the levels of a finished load and moves the base level down to them
+    void finishLoad(StreamedTexture &texture) {
+        if (!isLoading(texture) || !texture.loading.done()) {
+            return;
+        }
+        int first = texture.loadingFirst;
+        int end = texture.loadingEnd;
+        texture.loadingFirst = texture.loadingEnd = 0;
+        loadsInFlight--;
+        if (texture.loadedLevels.empty()) {
+            texture.failedLevel = std::max(texture.failedLevel, first);
+            texture.failedModified = newestModification(texture);
+            texture.failedUpdate = updateCount;
+            return;
+        }
+
+        GLint internalFormat;
+        GLenum type;
+        glFormat(texture.format, internalFormat, type);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture.name);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (int level = first; level < end; level++) {
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, level, internalFormat, levelSize(texture.width, level), levelSize(texture.height, level),
+                         (GLsizei) texture.paths.size(), 0, GL_RGBA, type, &texture.loadedLevels[level - first][0]);
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, first);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        resident += levelBytes(texture, first, end);
+        texture.residentLevel = first;
+        std::vector<std::vector<unsigned char>>().swap(texture.loadedLevels);
+    }
+
+    /*
+     Drops up to the given number of bytes, one level at a time. Levels that are finer than
+     their texture was asked for go first, then the textures that haven't been asked for in the
+     longest time. The initial levels and the texture we are making room for are left alone, and
+     so are textures that don't hold more than they were asked for, otherwise two textures that
+     both want more than fits would keep evicting each other.
+     */
+    void evict(size_t bytes, const StreamedTexture *keep) {
+        size_t freed = 0;
+        while (freed < bytes) {
+            StreamedTexture *victim = NULL;
+            int victimSurplus = 0;
+            unsigned int victimAge = 0;
+            for (size_t i = 0; i < textures.size(); i++) {
+                StreamedTexture &texture = textures[i];
+                if (&texture == keep || isLoading(texture) || texture.residentLevel >= texture.initialLevel) {
+                    continue;
+                }
+                unsigned int age = updateCount - texture.lastRequest;
+                int wanted = age > UNUSED_UPDATES ? texture.initialLevel : std::min(texture.requestedLevel, texture.initialLevel);
+                int surplus = wanted - texture.residentLevel;
+                if (surplus <= 0) {
+                    continue;
+                }
+                if (!victim || surplus > victimSurplus || (surplus == victimSurplus && age > victimAge)) {
+                    victim = &texture;
+                    victimSurplus = surplus;
+                    victimAge = age;
+                }
+            }
+            if (!victim) {
+                return;
+            }
+
+            // Redefining the level with no pixels lets the driver free it
+            int level = victim->residentLevel;
+            GLint internalFormat;
+            GLenum type;
+            glFormat(victim->format, internalFormat, type);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, victim->name);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, level + 1);
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, level, internalFormat, 0, 0, 0, 0, GL_RGBA, type, NULL);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+            size_t levelSizeBytes = levelBytes(*victim, level, level + 1);
+            resident -= levelSizeBytes;
+            freed += levelSizeBytes;
+            victim->residentLevel = level + 1;
+        }
+    }
+
+    static unsigned char average(unsigned char a, unsigned char b, unsigned char c, unsigned char d) {
+        return (unsigned char) ((a + b + c + d + 2) / 4);
+    }
+
+    static uint16_t average(uint16_t a, uint16_t b, uint16_t c, uint16_t d) {
+        return (uint16_t) ((a + b + c + d + 2) / 4);
+    }
+
+    static float average(float a, float b, float c, float d) {
+        return (a + b + c + d) * 0.25f;
+    }
+
+    // A 2x2 box filter, odd sizes repeat their last row or column
+    template <typename T>
+    static std::vector<T> halve(const std::vector<T> &pixels, int width, int height) {
+        int halfWidth = std::max(width / 2, 1), halfHeight = std::max(height / 2, 1);
+        std::vector<T> result((size_t) halfWidth * halfHeight * 4);
+        for (int y = 0; y < halfHeight; y++) {
+            int y0 = std::min(y * 2, height - 1), y1 = std::min(y * 2 + 1, height - 1);
+            for (int x = 0; x < halfWidth; x++) {
+                int x0 = std::min(x * 2, width - 1), x1 = std::min(x * 2 + 1, width - 1);
+                for (int c = 0; c < 4; c++) {
+                    result[((size_t) y * halfWidth + x) * 4 + c] =
+                        average(pixels[((size_t) y0 * width + x0) * 4 + c], pixels[((size_t) y0 * width + x1) * 4 + c],
+                                pixels[((size_t) y1 * width + x0) * 4 + c], pixels[((size_t) y1 * width + x1) * 4 + c]);
+                }
+            }
+        }
+        return result;
+    }
+};
+
+#endif
@@ -0,0 +1,288 @@
+#ifndef TRANSFORMSTORE_H
+#define TRANSFORMSTORE_H
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TRANSFORMSTORE_SSE2
+#include <emmintrin.h>
+#endif
+
+/*
+ Stores the transforms of all our objects in structure-of-arrays form: every component
+ lives in its own tightly packed array, so the kernels below can load the same
+ component of four objects with a single instruction. Model matrices are written into
+ one contiguous array of glm::mat4, which can be uploaded as-is for instanced drawing.
+
+ Every model matrix is translate(position) * rotate(angle, axis) * scale(scale), which
+ matches what we used to build one cube at a time with glm.
+
+ Most objects never move, so each one carries a dirty flag that the setters raise.
+ Only dirty matrices are rebuilt, and every rebuilt matrix bumps the object's version
+ and is remembered as changed until the next call to takeChangedRanges(), so that
+ only those parts of an instance buffer have to be uploaded again.
+ */
+class TransformStore {
+
+public:
+    // Adds an object and returns its index. The angle is in radians and the axis doesn't need to be normalized
+    size_t add(const glm::vec3 &position, const glm::vec3 &axis, float angle, const glm::vec3 &scale = glm::vec3(1.0f)) {
+        glm::vec3 unitAxis = glm::normalize(axis);
+        positionX.push_back(position.x);
+        positionY.push_back(position.y);
+        positionZ.push_back(position.z);
+        axisX.push_back(unitAxis.x);
+        axisY.push_back(unitAxis.y);
+        axisZ.push_back(unitAxis.z);
+        angles.push_back(angle);
+        scaleX.push_back(scale.x);
+        scaleY.push_back(scale.y);
+        scaleZ.push_back(scale.z);
+        models.push_back(glm::mat4(1.0f));
+        dirty.push_back(1);
+        changed.push_back(0);
+        versions.push_back(0);
+        return models.size() - 1;
+    }
+
+    size_t size() const {
+        return models.size();
+    }
+
+    void setPosition(size_t index, const glm::vec3 &position) {
+        if (positionX[index] != position.x || positionY[index] != position.y || positionZ[index] != position.z) {
+            positionX[index] = position.x;
+            positionY[index] = position.y;
+            positionZ[index] = position.z;
+            dirty[index] = 1;
+        }
+    }
+
+    glm::vec3 position(size_t index) const {
+        return glm::vec3(positionX[index], positionY[index], positionZ[index]);
+    }
+
+    void setAngle(size_t index, float angle) {
+        if (angles[index] != angle) {
+            angles[index] = angle;
+            dirty[index] = 1;
+        }
+    }
+
+    void setScale(size_t index, const glm::vec3 &scale) {
+        if (scaleX[index] != scale.x || scaleY[index] != scale.y || scaleZ[index] != scale.z) {
+            scaleX[index] = scale.x;
+            scaleY[index] = scale.y;
+            scaleZ[index] = scale.z;
+            dirty[index] = 1;
+        }
+    }
+
+    // Goes up by one every time the object's model matrix is rebuilt
+    uint32_t version(size_t index) const {
+        return versions[index];
+    }
+
+    // The model matrices as computed by the last call to computeModelMatrices()
+    const glm::mat4& model(size_t index) const {
+        return models[index];
+    }
+
+    // Start of the contiguous model matrix buffer, 16 floats per object in column-major order
+    const float* modelData() const {
+        return models.empty() ? NULL : &models[0][0][0];
+    }
+
+    /*
+     Rebuilds the model matrices of the dirty objects in [begin, end). Distinct ranges
+     can be computed on different threads at the same time.
+     */
+    void computeModelMatrices(size_t begin, size_t end) {
+        size_t i = begin;
+#ifdef TRANSFORMSTORE_SSE2
+        for (; i + 4 <= end; i += 4) {
+            // Checking the four dirty flags at once, a group with any dirty object gets rebuilt as a whole.
+            // The clean ones come out the same as before, so they aren't reported as changed
+            uint32_t groupDirty;
+            memcpy(&groupDirty, &dirty[i], sizeof(groupDirty));
+            if (groupDirty == 0) {
+                continue;
+            }
+            computeFourSSE2(i);
+            for (size_t j = i; j < i + 4; j++) {
+                if (dirty[j]) {
+                    markComputed(j);
+                }
+            }
+        }
+#endif
+        for (; i < end; i++) {
+            if (dirty[i]) {
+                computeOne(i);
+                markComputed(i);
+            }
+        }
+    }
+
+    /*
+     Collects the [begin, end) ranges of objects whose matrices have changed since the
+     last call and clears them. Runs separated by at most mergeGap unchanged objects are
+     merged, since one slightly larger upload is cheaper than two small ones.
+     */
+    void takeChangedRanges(std::vector<std::pair<size_t, size_t>> &ranges, size_t mergeGap = 4) {
+        ranges.clear();
+        size_t count = changed.size();
+        size_t i = 0;
+        while (i < count) {
+            if (!changed[i]) {
+                i++;
+                continue;
+            }
+            size_t begin = i;
+            size_t end = i + 1;
+            changed[i] = 0;
+            for (size_t j = end; j < count && j <= end + mergeGap; j++) {
+                if (changed[j]) {
+                    changed[j] = 0;
+                    end = j + 1;
+                }
+            }
+            ranges.push_back(std::make_pair(begin, end));
+            i = end;
+        }
+    }
+
+private:
+    std::vector<float> positionX, positionY, positionZ;
+    std::vector<float> axisX, axisY, axisZ;
+    std::vector<float> angles;
+    std::vector<float> scaleX, scaleY, scaleZ;
+    std::vector<glm::mat4> models;
+    std::vector<uint8_t> dirty;         // The matrix has to be rebuilt
+    std::vector<uint8_t> changed;       // The matrix was rebuilt but hasn't been picked up by takeChangedRanges()
+    std::vector<uint32_t> versions;
+
+    void markComputed(size_t i) {
+        dirty[i] = 0;
+        changed[i] = 1;
+        versions[i]++;
+    }
+
+    // The scalar path, used for the leftovers that don't fill a group of four
+    void computeOne(size_t i) {
+        float c = std::cos(angles[i]);
+        float s = std::sin(angles[i]);
+        float t = 1.0f - c;
+        float x = axisX[i], y = axisY[i], z = axisZ[i];
+
+        glm::mat4 &m = models[i];
+        m[0] = glm::vec4((t * x * x + c) * scaleX[i], (t * x * y + s * z) * scaleX[i], (t * x * z - s * y) * scaleX[i], 0.0f);
+        m[1] = glm::vec4((t * x * y - s * z) * scaleY[i], (t * y * y + c) * scaleY[i], (t * y * z + s * x) * scaleY[i], 0.0f);
+        m[2] = glm::vec4((t * x * z + s * y) * scaleZ[i], (t * y * z - s * x) * scaleZ[i], (t * z * z + c) * scaleZ[i], 0.0f);
+        m[3] = glm::vec4(positionX[i], positionY[i], positionZ[i], 1.0f);
+    }
+
+#ifdef TRANSFORMSTORE_SSE2
+    /*
+     Computes the sine and cosine of four angles at once. The angles are reduced into
+     [-pi/2, pi/2] by subtracting the nearest multiple of pi (in two parts to keep the
+     precision), then both are evaluated with Taylor polynomials which are accurate to
+     about 1e-7 over that range. An odd multiple of pi flips the sign of both results.
+     */
+    static void sinCosSSE2(__m128 angle, __m128 &sine, __m128 &cosine) {
+        const __m128 inversePi = _mm_set1_ps(0.318309886183790671538f);
+        const __m128 piHigh = _mm_set1_ps(3.140625f);
+        const __m128 piLow = _mm_set1_ps(9.67653589793e-4f);
+
+        __m128i quadrant = _mm_cvtps_epi32(_mm_mul_ps(angle, inversePi));
+        __m128 k = _mm_cvtepi32_ps(quadrant);
+        __m128 r = _mm_sub_ps(_mm_sub_ps(angle, _mm_mul_ps(k, piHigh)), _mm_mul_ps(k, piLow));
+        __m128 r2 = _mm_mul_ps(r, r);
+
+        // sin(r) = r - r^3/3! + r^5/5! - r^7/7! + r^9/9! - r^11/11!
+        __m128 s = _mm_set1_ps(-2.5052108385e-8f);
+        s = _mm_add_ps(_mm_mul_ps(s, r2), _mm_set1_ps(2.7557319224e-6f));
+        s = _mm_add_ps(_mm_mul_ps(s, r2), _mm_set1_ps(-1.9841269841e-4f));
+        s = _mm_add_ps(_mm_mul_ps(s, r2), _mm_set1_ps(8.3333333333e-3f));
+        s = _mm_add_ps(_mm_mul_ps(s, r2), _mm_set1_ps(-1.6666666667e-1f));
+        s = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(s, r2), r), r);
+
+        // cos(r) = 1 - r^2/2! + r^4/4! - r^6/6! + r^8/8! - r^10/10! + r^12/12!
+        __m128 c = _mm_set1_ps(2.0876756988e-9f);
+        c = _mm_add_ps(_mm_mul_ps(c, r2), _mm_set1_ps(-2.7557319224e-7f));
+        c = _mm_add_ps(_mm_mul_ps(c, r2), _mm_set1_ps(2.4801587302e-5f));
+        c = _mm_add_ps(_mm_mul_ps(c, r2), _mm_set1_ps(-1.3888888889e-3f));
+        c = _mm_add_ps(_mm_mul_ps(c, r2), _mm_set1_ps(4.1666666667e-2f));
+        c = _mm_add_ps(_mm_mul_ps(c, r2), _mm_set1_ps(-0.5f));
+        c = _mm_add_ps(_mm_mul_ps(c, r2), _mm_set1_ps(1.0f));
+
+        // Moving the lowest bit of the quadrant into the sign bit
+        __m128 signFlip = _mm_castsi128_ps(_mm_slli_epi32(quadrant, 31));
+        sine = _mm_xor_ps(s, signFlip);
+        cosine = _mm_xor_ps(c, signFlip);
+    }
+
+    // Builds the model matrices for objects [i, i + 4)
+    void computeFourSSE2(size_t i) {
+        __m128 sine, cosine;
+        sinCosSSE2(_mm_loadu_ps(&angles[i]), sine, cosine);
+        __m128 t = _mm_sub_ps(_mm_set1_ps(1.0f), cosine);
+
+        __m128 x = _mm_loadu_ps(&axisX[i]);
+        __m128 y = _mm_loadu_ps(&axisY[i]);
+        __m128 z = _mm_loadu_ps(&axisZ[i]);
+        __m128 sx = _mm_loadu_ps(&scaleX[i]);
+        __m128 sy = _mm_loadu_ps(&scaleY[i]);
+        __m128 sz = _mm_loadu_ps(&scaleZ[i]);
+
+        __m128 tx = _mm_mul_ps(t, x);
+        __m128 ty = _mm_mul_ps(t, y);
+        __m128 tz = _mm_mul_ps(t, z);
+        __m128 sinX = _mm_mul_ps(sine, x);
+        __m128 sinY = _mm_mul_ps(sine, y);
+        __m128 sinZ = _mm_mul_ps(sine, z);
+        __m128 txy = _mm_mul_ps(tx, y);
+        __m128 txz = _mm_mul_ps(tx, z);
+        __m128 tyz = _mm_mul_ps(ty, z);
+
+        // Element (column, row) of the rotation, with the column's scale folded in
+        __m128 m00 = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(tx, x), cosine), sx);
+        __m128 m01 = _mm_mul_ps(_mm_add_ps(txy, sinZ), sx);
+        __m128 m02 = _mm_mul_ps(_mm_sub_ps(txz, sinY), sx);
+        __m128 m10 = _mm_mul_ps(_mm_sub_ps(txy, sinZ), sy);
+        __m128 m11 = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(ty, y), cosine), sy);
+        __m128 m12 = _mm_mul_ps(_mm_add_ps(tyz, sinX), sy);
+        __m128 m20 = _mm_mul_ps(_mm_add_ps(txz, sinY), sz);
+        __m128 m21 = _mm_mul_ps(_mm_sub_ps(tyz, sinX), sz);
+        __m128 m22 = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(tz, z), cosine), sz);
+        __m128 m30 = _mm_loadu_ps(&positionX[i]);
+        __m128 m31 = _mm_loadu_ps(&positionY[i]);
+        __m128 m32 = _mm_loadu_ps(&positionZ[i]);
+        __m128 zero = _mm_setzero_ps();
+        __m128 one = _mm_set1_ps(1.0f);
+
+        // Each register holds one element for four objects, transposing turns that into four matrix columns
+        float *out = &models[i][0][0];
+        storeColumns(out, 0, m00, m01, m02, zero);
+        storeColumns(out, 4, m10, m11, m12, zero);
+        storeColumns(out, 8, m20, m21, m22, zero);
+        storeColumns(out, 12, m30, m31, m32, one);
+    }
+
+    static void storeColumns(float *out, int offset, __m128 row0, __m128 row1, __m128 row2, __m128 row3) {
+        _MM_TRANSPOSE4_PS(row0, row1, row2, row3);
+        _mm_storeu_ps(out + offset, row0);
+        _mm_storeu_ps(out + 16 + offset, row1);
+        _mm_storeu_ps(out + 32 + offset, row2);
+        _mm_storeu_ps(out + 48 + offset, row3);
+    }
+#endif
+};
+
+#endif